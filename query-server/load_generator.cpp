@@ -0,0 +1,331 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "query_client.h"
+#include "query_server.h"
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+struct LoadConfig {
+  string tcp_address;
+  string unix_path;
+  size_t connections = 4;
+  size_t pipeline_depth = 8;
+  size_t requests = 20'000;
+  size_t documents = 10'000;
+  size_t words_per_document = 70;
+  size_t words_per_query = 10;
+};
+
+string GenerateWord(mt19937 &generator, int max_length) {
+  const int length = uniform_int_distribution(1, max_length)(generator);
+  string word;
+  for (int i = 0; i < length; ++i) {
+    word.push_back(uniform_int_distribution('a', 'z')(generator));
+  }
+  return word;
+}
+
+string GenerateText(mt19937 &generator, const vector<string> &dictionary,
+                    size_t word_count) {
+  string text;
+  for (size_t i = 0; i < word_count; ++i) {
+    if (!text.empty()) {
+      text.push_back(' ');
+    }
+    text += dictionary[uniform_int_distribution<size_t>(
+        0, dictionary.size() - 1)(generator)];
+  }
+  return text;
+}
+
+struct Corpus {
+  vector<string> documents;
+  vector<string> queries;
+};
+
+Corpus GenerateCorpus(const LoadConfig &config) {
+  mt19937 generator;
+  vector<string> dictionary;
+  for (int i = 0; i < 1000; ++i) {
+    dictionary.push_back(GenerateWord(generator, 10));
+  }
+  Corpus corpus;
+  for (size_t i = 0; i < config.documents; ++i) {
+    corpus.documents.push_back(
+        GenerateText(generator, dictionary, config.words_per_document));
+  }
+  for (int i = 0; i < 500; ++i) {
+    corpus.queries.push_back(
+        GenerateText(generator, dictionary, config.words_per_query));
+  }
+  return corpus;
+}
+
+QueryClient Connect(const LoadConfig &config) {
+  if (!config.unix_path.empty()) {
+    return QueryClient::ConnectUnix(config.unix_path);
+  }
+  const auto colon = config.tcp_address.rfind(':');
+  return QueryClient::ConnectTcp(
+      config.tcp_address.substr(0, colon),
+      stoi(config.tcp_address.substr(colon + 1)));
+}
+
+void Populate(const LoadConfig &config, const Corpus &corpus) {
+  QueryClient client = Connect(config);
+  size_t in_flight = 0;
+  for (size_t i = 0; i < corpus.documents.size(); ++i) {
+    client.SendAddDocument(static_cast<int>(i), corpus.documents[i],
+                           DocumentStatus::ACTUAL, {1, 2, 3});
+    if (++in_flight == config.pipeline_depth * 16) {
+      for (; in_flight > 0; --in_flight) {
+        client.ReceiveResponse();
+      }
+    }
+  }
+  for (; in_flight > 0; --in_flight) {
+    client.ReceiveResponse();
+  }
+}
+
+// Each connection keeps pipeline_depth queries in flight
+void RunLoad(const LoadConfig &config, const Corpus &corpus) {
+  vector<vector<double>> latencies(config.connections);
+  atomic<size_t> errors{0};
+  const size_t per_connection = config.requests / config.connections;
+  const auto start = Clock::now();
+  vector<thread> threads;
+  for (size_t c = 0; c < config.connections; ++c) {
+    threads.emplace_back([&, c] {
+      QueryClient client = Connect(config);
+      unordered_map<uint32_t, Clock::time_point> sent_at;
+      size_t sent = 0;
+      auto send_next = [&] {
+        const string &query =
+            corpus.queries[(c * per_connection + sent++) %
+                           corpus.queries.size()];
+        sent_at[client.SendFindTopDocuments(query)] = Clock::now();
+      };
+      while (sent < min(per_connection, config.pipeline_depth)) {
+        send_next();
+      }
+      for (size_t received = 0; received < per_connection; ++received) {
+        const Response response = client.ReceiveResponse();
+        const auto finish = Clock::now();
+        if (response.result != ResponseResult::OK) {
+          ++errors;
+        }
+        latencies[c].push_back(
+            chrono::duration<double, micro>(finish - sent_at.at(response.id))
+                .count());
+        sent_at.erase(response.id);
+        if (sent < per_connection) {
+          send_next();
+        }
+      }
+    });
+  }
+  for (thread &t : threads) {
+    t.join();
+  }
+  const double seconds =
+      chrono::duration<double>(Clock::now() - start).count();
+
+  vector<double> all;
+  for (const auto &part : latencies) {
+    all.insert(all.end(), part.begin(), part.end());
+  }
+  sort(all.begin(), all.end());
+  auto percentile = [&all](double p) {
+    return all.empty() ? 0.0 : all[min(all.size() - 1, size_t(p * all.size()))];
+  };
+  cout << "Requests: "s << all.size() << ", errors: "s << errors
+       << ", throughput: "s << all.size() / seconds << " req/s"s << endl;
+  cout << "Latency us: p50 = "s << percentile(0.5) << ", p90 = "s
+       << percentile(0.9) << ", p99 = "s << percentile(0.99) << ", max = "s
+       << (all.empty() ? 0.0 : all.back()) << endl;
+}
+
+bool SameDocuments(const vector<Document> &lhs, const vector<Document> &rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < lhs.size(); ++i) {
+    if (lhs[i].id != rhs[i].id || lhs[i].rating != rhs[i].rating ||
+        abs(lhs[i].relevance - rhs[i].relevance) > RELEVANCE_PRECISION) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#define CHECK(expr)                                                            \
+  if (!(expr)) {                                                               \
+    cerr << "Self-test check failed: "s << #expr << endl;                      \
+    return false;                                                              \
+  }
+
+// Starts a server in-process and checks it against a local SearchServer
+// over loopback TCP and a Unix socket, then runs a short load
+bool RunSelfTest(LoadConfig config) {
+  config.documents = 2'000;
+  config.requests = 4'000;
+  const Corpus corpus = GenerateCorpus(config);
+
+  SearchServer served{"and with"s};
+  QueryServer server{served, {4, 16, chrono::microseconds{200}}};
+  const uint16_t port = server.ListenTcp("127.0.0.1"s, 0);
+  const string unix_path =
+      "/tmp/search_query_server_"s + to_string(getpid()) + ".sock"s;
+  server.ListenUnix(unix_path);
+  thread loop([&server] { server.Run(); });
+
+  bool ok = [&] {
+    config.tcp_address = "127.0.0.1:"s + to_string(port);
+    Populate(config, corpus);
+    SearchServer reference{"and with"s};
+    for (size_t i = 0; i < corpus.documents.size(); ++i) {
+      reference.AddDocument(static_cast<int>(i), corpus.documents[i],
+                            DocumentStatus::ACTUAL, {1, 2, 3});
+    }
+
+    QueryClient tcp = QueryClient::ConnectTcp("127.0.0.1"s, port);
+    QueryClient local = QueryClient::ConnectUnix(unix_path);
+    for (size_t i = 0; i < 50; ++i) {
+      const string &query = corpus.queries[i];
+      CHECK(SameDocuments(tcp.FindTopDocuments(query),
+                          reference.FindTopDocuments(query)));
+      CHECK(SameDocuments(local.FindTopDocuments(query),
+                          reference.FindTopDocuments(query)));
+    }
+    const auto [words, status] = local.MatchDocument(corpus.queries[0], 7);
+    const auto [expected_words, expected_status] =
+        reference.MatchDocument(corpus.queries[0], 7);
+    CHECK(status == expected_status);
+    CHECK(vector<string>(expected_words.begin(), expected_words.end()) ==
+          words);
+
+    // Pipelined modifications and queries are applied in order
+    tcp.SendAddDocument(100'000, "unique pipelined words"s,
+                        DocumentStatus::ACTUAL, {5});
+    tcp.SendFindTopDocuments("pipelined"s);
+    tcp.SendRemoveDocument(100'000);
+    tcp.SendFindTopDocuments("pipelined"s);
+    tcp.SendAddDocument(-1, "negative id"s, DocumentStatus::ACTUAL, {});
+    vector<Response> responses;
+    for (int i = 0; i < 5; ++i) {
+      responses.push_back(tcp.ReceiveResponse());
+    }
+    sort(responses.begin(), responses.end(),
+         [](const Response &lhs, const Response &rhs) {
+           return lhs.id < rhs.id;
+         });
+    CHECK(responses[1].documents.size() == 1);
+    CHECK(responses[1].documents[0].id == 100'000);
+    CHECK(responses[3].documents.empty());
+    CHECK(responses[4].result == ResponseResult::ERROR);
+
+    bool rejected = false;
+    try {
+      tcp.FindTopDocuments("cat --dog"s);
+    } catch (const runtime_error &) {
+      rejected = true;
+    }
+    CHECK(rejected);
+
+    // More pipelined requests than the server queues per connection, then
+    // a half-close: every request is still answered before the server
+    // closes its side
+    QueryClient half_closed = QueryClient::ConnectUnix(unix_path);
+    const int pipelined = 3'000;
+    for (int i = 0; i < pipelined; ++i) {
+      half_closed.SendFindTopDocuments(corpus.queries[i % 50]);
+    }
+    half_closed.CloseWrite();
+    for (int i = 0; i < pipelined; ++i) {
+      CHECK(half_closed.ReceiveResponse().result == ResponseResult::OK);
+    }
+    bool closed = false;
+    try {
+      half_closed.ReceiveResponse();
+    } catch (const exception &) {
+      closed = true;
+    }
+    CHECK(closed);
+
+    RunLoad(config, corpus);
+    return true;
+  }();
+
+  server.Stop();
+  loop.join();
+  cout << (ok ? "Self-test passed"s : "Self-test FAILED"s) << endl;
+  return ok;
+}
+
+void PrintUsage() {
+  cerr << "Usage: search_load_generator --self-test\n"
+          "       search_load_generator (--tcp HOST:PORT | --unix PATH) "
+          "[--connections N] [--depth N] [--requests N] [--documents N]"s
+       << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  LoadConfig config;
+  bool self_test = false;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg == "--self-test"s) {
+      self_test = true;
+      continue;
+    }
+    if (i + 1 == argc) {
+      PrintUsage();
+      return 1;
+    }
+    const string value = argv[++i];
+    if (arg == "--tcp"s) {
+      config.tcp_address = value;
+    } else if (arg == "--unix"s) {
+      config.unix_path = value;
+    } else if (arg == "--connections"s) {
+      config.connections = max<size_t>(1, stoul(value));
+    } else if (arg == "--depth"s) {
+      config.pipeline_depth = max<size_t>(1, stoul(value));
+    } else if (arg == "--requests"s) {
+      config.requests = stoul(value);
+    } else if (arg == "--documents"s) {
+      config.documents = stoul(value);
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (self_test) {
+    return RunSelfTest(config) ? 0 : 1;
+  }
+  if (config.tcp_address.empty() && config.unix_path.empty()) {
+    PrintUsage();
+    return 1;
+  }
+  const Corpus corpus = GenerateCorpus(config);
+  if (config.documents > 0) {
+    Populate(config, corpus);
+  }
+  RunLoad(config, corpus);
+  return 0;
+}
@@ -0,0 +1,263 @@
+#include "protocol.h"
+#include <cstring>
+
+namespace {
+
+class WireWriter {
+public:
+  void PutU8(uint8_t value) { data_.push_back(static_cast<char>(value)); }
+
+  void PutU32(uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      PutU8(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  }
+
+  void PutI32(int value) { PutU32(static_cast<uint32_t>(value)); }
+
+  void PutF64(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    PutU32(static_cast<uint32_t>(bits));
+    PutU32(static_cast<uint32_t>(bits >> 32));
+  }
+
+  void PutString(string_view value) {
+    PutU32(static_cast<uint32_t>(value.size()));
+    data_.append(value);
+  }
+
+  string Release() { return move(data_); }
+
+private:
+  string data_;
+};
+
+class WireReader {
+public:
+  explicit WireReader(string_view data) : data_{data} {}
+
+  uint8_t GetU8() {
+    Require(1);
+    const auto value = static_cast<uint8_t>(data_[0]);
+    data_.remove_prefix(1);
+    return value;
+  }
+
+  uint32_t GetU32() {
+    Require(4);
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+      value |= uint32_t{static_cast<uint8_t>(data_[i])} << (8 * i);
+    }
+    data_.remove_prefix(4);
+    return value;
+  }
+
+  int GetI32() { return static_cast<int>(GetU32()); }
+
+  double GetF64() {
+    const uint64_t low = GetU32();
+    const uint64_t bits = low | (uint64_t{GetU32()} << 32);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  string GetString() {
+    const uint32_t size = GetU32();
+    Require(size);
+    string value{data_.substr(0, size)};
+    data_.remove_prefix(size);
+    return value;
+  }
+
+  DocumentStatus GetStatus() {
+    const uint8_t status = GetU8();
+    if (status > static_cast<uint8_t>(DocumentStatus::REMOVED)) {
+      throw ProtocolError("Unknown document status");
+    }
+    return static_cast<DocumentStatus>(status);
+  }
+
+  void ExpectEnd() const {
+    if (!data_.empty()) {
+      throw ProtocolError("Trailing bytes in message");
+    }
+  }
+
+private:
+  string_view data_;
+
+  void Require(size_t size) const {
+    if (data_.size() < size) {
+      throw ProtocolError("Truncated message");
+    }
+  }
+};
+
+} // namespace
+
+void AppendFrame(string &out, const string &payload) {
+  WireWriter header;
+  header.PutU32(static_cast<uint32_t>(payload.size()));
+  out += header.Release();
+  out += payload;
+}
+
+optional<string_view> ExtractFrame(string_view buffer, size_t &consumed) {
+  if (buffer.size() < 4) {
+    return nullopt;
+  }
+  const uint32_t size = WireReader{buffer.substr(0, 4)}.GetU32();
+  if (size > MAX_FRAME_SIZE) {
+    throw ProtocolError("Frame is too large");
+  }
+  if (buffer.size() < 4 + size) {
+    return nullopt;
+  }
+  consumed = 4 + size;
+  return buffer.substr(4, size);
+}
+
+string EncodeRequest(const Request &request) {
+  WireWriter writer;
+  writer.PutU32(request.id);
+  writer.PutU8(static_cast<uint8_t>(request.opcode));
+  switch (request.opcode) {
+  case Opcode::FIND_TOP_DOCUMENTS:
+    writer.PutU8(static_cast<uint8_t>(request.status));
+    writer.PutString(request.text);
+    break;
+  case Opcode::MATCH_DOCUMENT:
+    writer.PutI32(request.document_id);
+    writer.PutString(request.text);
+    break;
+  case Opcode::ADD_DOCUMENT:
+    writer.PutI32(request.document_id);
+    writer.PutU8(static_cast<uint8_t>(request.status));
+    writer.PutU32(static_cast<uint32_t>(request.ratings.size()));
+    for (int rating : request.ratings) {
+      writer.PutI32(rating);
+    }
+    writer.PutString(request.text);
+    break;
+  case Opcode::REMOVE_DOCUMENT:
+    writer.PutI32(request.document_id);
+    break;
+  }
+  return writer.Release();
+}
+
+Request DecodeRequest(string_view payload) {
+  WireReader reader{payload};
+  Request request;
+  request.id = reader.GetU32();
+  request.opcode = static_cast<Opcode>(reader.GetU8());
+  switch (request.opcode) {
+  case Opcode::FIND_TOP_DOCUMENTS:
+    request.status = reader.GetStatus();
+    request.text = reader.GetString();
+    break;
+  case Opcode::MATCH_DOCUMENT:
+    request.document_id = reader.GetI32();
+    request.text = reader.GetString();
+    break;
+  case Opcode::ADD_DOCUMENT: {
+    request.document_id = reader.GetI32();
+    request.status = reader.GetStatus();
+    const uint32_t rating_count = reader.GetU32();
+    if (rating_count > payload.size() / 4) {
+      throw ProtocolError("Truncated message");
+    }
+    request.ratings.resize(rating_count);
+    for (int &rating : request.ratings) {
+      rating = reader.GetI32();
+    }
+    request.text = reader.GetString();
+    break;
+  }
+  case Opcode::REMOVE_DOCUMENT:
+    request.document_id = reader.GetI32();
+    break;
+  default:
+    throw ProtocolError("Unknown opcode");
+  }
+  reader.ExpectEnd();
+  return request;
+}
+
+string EncodeResponse(const Response &response) {
+  WireWriter writer;
+  writer.PutU32(response.id);
+  writer.PutU8(static_cast<uint8_t>(response.result));
+  if (response.result == ResponseResult::ERROR) {
+    writer.PutString(response.error);
+    return writer.Release();
+  }
+  switch (response.opcode) {
+  case Opcode::FIND_TOP_DOCUMENTS:
+    writer.PutU32(static_cast<uint32_t>(response.documents.size()));
+    for (const Document &document : response.documents) {
+      writer.PutI32(document.id);
+      writer.PutF64(document.relevance);
+      writer.PutI32(document.rating);
+    }
+    break;
+  case Opcode::MATCH_DOCUMENT:
+    writer.PutU8(static_cast<uint8_t>(response.status));
+    writer.PutU32(static_cast<uint32_t>(response.words.size()));
+    for (const string &word : response.words) {
+      writer.PutString(word);
+    }
+    break;
+  case Opcode::ADD_DOCUMENT:
+  case Opcode::REMOVE_DOCUMENT:
+    break;
+  }
+  return writer.Release();
+}
+
+Response DecodeResponse(string_view payload, Opcode opcode) {
+  WireReader reader{payload};
+  Response response;
+  response.id = reader.GetU32();
+  response.opcode = opcode;
+  response.result = static_cast<ResponseResult>(reader.GetU8());
+  if (response.result == ResponseResult::ERROR) {
+    response.error = reader.GetString();
+    reader.ExpectEnd();
+    return response;
+  }
+  if (response.result != ResponseResult::OK) {
+    throw ProtocolError("Unknown response result");
+  }
+  switch (opcode) {
+  case Opcode::FIND_TOP_DOCUMENTS: {
+    const uint32_t count = reader.GetU32();
+    for (uint32_t i = 0; i < count; ++i) {
+      const int id = reader.GetI32();
+      const double relevance = reader.GetF64();
+      response.documents.emplace_back(id, relevance, reader.GetI32());
+    }
+    break;
+  }
+  case Opcode::MATCH_DOCUMENT: {
+    response.status = reader.GetStatus();
+    const uint32_t count = reader.GetU32();
+    for (uint32_t i = 0; i < count; ++i) {
+      response.words.push_back(reader.GetString());
+    }
+    break;
+  }
+  case Opcode::ADD_DOCUMENT:
+  case Opcode::REMOVE_DOCUMENT:
+    break;
+  }
+  reader.ExpectEnd();
+  return response;
+}
+
+uint32_t PeekResponseId(string_view payload) {
+  return WireReader{payload}.GetU32();
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "document.h"
+
+using namespace std;
+
+// Every message is a frame: little-endian uint32 payload length followed by
+// the payload. Requests and responses start with a client-chosen request id,
+// so a client may pipeline many requests on one connection and match the
+// responses, which can arrive out of order.
+//
+// Request payload:  u32 id, u8 opcode, opcode-specific body
+//   FIND_TOP_DOCUMENTS  u8 status, str query
+//   MATCH_DOCUMENT      i32 document id, str query
+//   ADD_DOCUMENT        i32 document id, u8 status, u32 n, n x i32 rating,
+//                       str text
+//   REMOVE_DOCUMENT     i32 document id
+// Response payload: u32 id, u8 result, result-specific body
+//   OK for FIND_TOP_DOCUMENTS  u32 n, n x (i32 id, f64 relevance, i32 rating)
+//   OK for MATCH_DOCUMENT      u8 status, u32 n, n x str word
+//   OK for ADD/REMOVE          empty
+//   ERROR                      str message
+// where str is a u32 length followed by the bytes.
+
+const size_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+enum class Opcode : uint8_t {
+  FIND_TOP_DOCUMENTS = 1,
+  MATCH_DOCUMENT = 2,
+  ADD_DOCUMENT = 3,
+  REMOVE_DOCUMENT = 4
+};
+
+enum class ResponseResult : uint8_t { OK = 0, ERROR = 1 };
+
+class ProtocolError : public runtime_error {
+public:
+  using runtime_error::runtime_error;
+};
+
+struct Request {
+  uint32_t id = 0;
+  Opcode opcode = Opcode::FIND_TOP_DOCUMENTS;
+  int document_id = 0;
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  vector<int> ratings{};
+  string text{};
+
+  bool IsReadOnly() const {
+    return opcode == Opcode::FIND_TOP_DOCUMENTS ||
+           opcode == Opcode::MATCH_DOCUMENT;
+  }
+};
+
+struct Response {
+  uint32_t id = 0;
+  Opcode opcode = Opcode::FIND_TOP_DOCUMENTS;
+  ResponseResult result = ResponseResult::OK;
+  vector<Document> documents{};
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  vector<string> words{};
+  string error{};
+};
+
+void AppendFrame(string &out, const string &payload);
+
+// Returns the payload of the first complete frame in buffer and sets
+// consumed to its full size, or nullopt if more bytes are needed
+optional<string_view> ExtractFrame(string_view buffer, size_t &consumed);
+
+string EncodeRequest(const Request &request);
+
+Request DecodeRequest(string_view payload);
+
+// The opcode is not sent back, the client knows what it asked for
+string EncodeResponse(const Response &response);
+
+Response DecodeResponse(string_view payload, Opcode opcode);
+
+// Only the request id, for clients that need to look up the opcode first
+uint32_t PeekResponseId(string_view payload);
@@ -0,0 +1,200 @@
+#include "query_client.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+QueryClient QueryClient::ConnectTcp(const string &host, uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw system_error(errno, generic_category(), "socket");
+  }
+  QueryClient client{fd};
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    throw invalid_argument("Invalid IPv4 address: " + host);
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+      0) {
+    throw system_error(errno, generic_category(), "connect " + host);
+  }
+  const int enable = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return client;
+}
+
+QueryClient QueryClient::ConnectUnix(const string &path) {
+  sockaddr_un address{};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw invalid_argument("Unix socket path is too long");
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw system_error(errno, generic_category(), "socket");
+  }
+  QueryClient client{fd};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+      0) {
+    throw system_error(errno, generic_category(), "connect " + path);
+  }
+  return client;
+}
+
+QueryClient::QueryClient(QueryClient &&other) noexcept
+    : fd_{other.fd_}, next_request_id_{other.next_request_id_},
+      output_{move(other.output_)}, input_{move(other.input_)},
+      pending_{move(other.pending_)} {
+  other.fd_ = -1;
+}
+
+QueryClient::~QueryClient() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+uint32_t QueryClient::SendFindTopDocuments(const string &raw_query,
+                                           DocumentStatus status) {
+  Request request;
+  request.opcode = Opcode::FIND_TOP_DOCUMENTS;
+  request.status = status;
+  request.text = raw_query;
+  return Send(move(request));
+}
+
+uint32_t QueryClient::SendMatchDocument(const string &raw_query,
+                                        int document_id) {
+  Request request;
+  request.opcode = Opcode::MATCH_DOCUMENT;
+  request.document_id = document_id;
+  request.text = raw_query;
+  return Send(move(request));
+}
+
+uint32_t QueryClient::SendAddDocument(int document_id, const string &document,
+                                      DocumentStatus status,
+                                      const vector<int> &ratings) {
+  Request request;
+  request.opcode = Opcode::ADD_DOCUMENT;
+  request.document_id = document_id;
+  request.status = status;
+  request.ratings = ratings;
+  request.text = document;
+  return Send(move(request));
+}
+
+uint32_t QueryClient::SendRemoveDocument(int document_id) {
+  Request request;
+  request.opcode = Opcode::REMOVE_DOCUMENT;
+  request.document_id = document_id;
+  return Send(move(request));
+}
+
+void QueryClient::Flush() {
+  size_t offset = 0;
+  while (offset < output_.size()) {
+    const ssize_t sent = send(fd_, output_.data() + offset,
+                              output_.size() - offset, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw system_error(errno, generic_category(), "send");
+    }
+    offset += sent;
+  }
+  output_.clear();
+}
+
+void QueryClient::CloseWrite() {
+  Flush();
+  if (shutdown(fd_, SHUT_WR) < 0) {
+    throw system_error(errno, generic_category(), "shutdown");
+  }
+}
+
+Response QueryClient::ReceiveResponse() {
+  Flush();
+  char buffer[64 * 1024];
+  while (true) {
+    size_t consumed = 0;
+    if (const auto payload = ExtractFrame(input_, consumed)) {
+      const auto it = pending_.find(PeekResponseId(*payload));
+      if (it == pending_.end()) {
+        throw ProtocolError("Response to an unknown request");
+      }
+      Response response = DecodeResponse(*payload, it->second);
+      pending_.erase(it);
+      input_.erase(0, consumed);
+      return response;
+    }
+    const ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      throw runtime_error("Connection closed by the server");
+    }
+    input_.append(buffer, received);
+  }
+}
+
+vector<Document> QueryClient::FindTopDocuments(const string &raw_query,
+                                               DocumentStatus status) {
+  CheckNothingPending();
+  SendFindTopDocuments(raw_query, status);
+  return ReceiveResult().documents;
+}
+
+tuple<vector<string>, DocumentStatus>
+QueryClient::MatchDocument(const string &raw_query, int document_id) {
+  CheckNothingPending();
+  SendMatchDocument(raw_query, document_id);
+  Response response = ReceiveResult();
+  return {move(response.words), response.status};
+}
+
+void QueryClient::AddDocument(int document_id, const string &document,
+                              DocumentStatus status,
+                              const vector<int> &ratings) {
+  CheckNothingPending();
+  SendAddDocument(document_id, document, status, ratings);
+  ReceiveResult();
+}
+
+void QueryClient::RemoveDocument(int document_id) {
+  CheckNothingPending();
+  SendRemoveDocument(document_id);
+  ReceiveResult();
+}
+
+uint32_t QueryClient::Send(Request request) {
+  request.id = next_request_id_++;
+  pending_[request.id] = request.opcode;
+  AppendFrame(output_, EncodeRequest(request));
+  return request.id;
+}
+
+void QueryClient::CheckNothingPending() const {
+  if (!pending_.empty()) {
+    throw logic_error("Synchronous call with pipelined requests in flight");
+  }
+}
+
+Response QueryClient::ReceiveResult() {
+  Response response = ReceiveResponse();
+  if (response.result == ResponseResult::ERROR) {
+    throw runtime_error(response.error);
+  }
+  return response;
+}
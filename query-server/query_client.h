@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+
+using namespace std;
+
+// Blocking client for QueryServer. Send* calls only queue the request and
+// return its id, so several requests can be pipelined before the responses
+// are collected with ReceiveResponse(); the synchronous helpers do both.
+class QueryClient {
+public:
+  static QueryClient ConnectTcp(const string &host, uint16_t port);
+
+  static QueryClient ConnectUnix(const string &path);
+
+  QueryClient(QueryClient &&other) noexcept;
+
+  QueryClient &operator=(QueryClient &&) = delete;
+
+  ~QueryClient();
+
+  uint32_t SendFindTopDocuments(const string &raw_query,
+                                DocumentStatus status = DocumentStatus::ACTUAL);
+
+  uint32_t SendMatchDocument(const string &raw_query, int document_id);
+
+  uint32_t SendAddDocument(int document_id, const string &document,
+                           DocumentStatus status, const vector<int> &ratings);
+
+  uint32_t SendRemoveDocument(int document_id);
+
+  // Writes out every queued request
+  void Flush();
+
+  // Flushes and shuts down the sending side; responses to the requests
+  // already sent can still be received
+  void CloseWrite();
+
+  // Flushes and blocks until the next response arrives
+  Response ReceiveResponse();
+
+  vector<Document>
+  FindTopDocuments(const string &raw_query,
+                   DocumentStatus status = DocumentStatus::ACTUAL);
+
+  tuple<vector<string>, DocumentStatus> MatchDocument(const string &raw_query,
+                                                      int document_id);
+
+  void AddDocument(int document_id, const string &document,
+                   DocumentStatus status, const vector<int> &ratings);
+
+  void RemoveDocument(int document_id);
+
+private:
+  explicit QueryClient(int fd) : fd_{fd} {}
+
+  int fd_;
+  uint32_t next_request_id_ = 0;
+  string output_;
+  string input_;
+  unordered_map<uint32_t, Opcode> pending_;
+
+  uint32_t Send(Request request);
+
+  void CheckNothingPending() const;
+
+  // Throws runtime_error built from an ERROR response
+  Response ReceiveResult();
+};
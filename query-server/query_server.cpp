@@ -0,0 +1,484 @@
+#include "query_server.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+void ThrowSystemError(const string &what) {
+  throw system_error(errno, generic_category(), what);
+}
+
+// Listening sockets and the wakeup descriptor are told apart from
+// connections by the high bit of the epoll user data
+const uint64_t SPECIAL_FD_TAG = uint64_t{1} << 63;
+
+// A connection past any of these limits is not read from until it drains.
+// The input limit leaves room for one frame of the maximum size.
+const size_t MAX_CONNECTION_INPUT = MAX_FRAME_SIZE + 64 * 1024;
+const size_t MAX_CONNECTION_PENDING_JOBS = 1024;
+const size_t MAX_CONNECTION_OUTPUT = 4 * 1024 * 1024;
+
+} // namespace
+
+QueryServer::QueryServer(SearchServer &search_server, QueryServerConfig config)
+    : search_server_{search_server}, config_{config} {
+  if (config_.worker_count == 0) {
+    config_.worker_count = 1;
+  }
+  if (config_.max_batch_size == 0) {
+    config_.max_batch_size = 1;
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    ThrowSystemError("epoll_create1");
+  }
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeup_fd_ < 0) {
+    ThrowSystemError("eventfd");
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = SPECIAL_FD_TAG | static_cast<uint64_t>(wakeup_fd_);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event);
+}
+
+QueryServer::~QueryServer() {
+  Stop();
+  {
+    lock_guard lock(jobs_mutex_);
+    jobs_cv_.notify_all();
+  }
+  for (thread &worker : workers_) {
+    worker.join();
+  }
+  for (auto &[_, connection] : connections_) {
+    close(connection.fd);
+  }
+  for (int fd : listen_fds_) {
+    close(fd);
+  }
+  for (const string &path : unix_paths_) {
+    unlink(path.c_str());
+  }
+  close(wakeup_fd_);
+  close(epoll_fd_);
+}
+
+uint16_t QueryServer::ListenTcp(const string &host, uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    ThrowSystemError("socket");
+  }
+  const int enable = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+    close(fd);
+    throw invalid_argument("Invalid IPv4 address: " + host);
+  }
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    ThrowSystemError("bind/listen " + host);
+  }
+  socklen_t length = sizeof(address);
+  getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length);
+  AddListener(fd);
+  return ntohs(address.sin_port);
+}
+
+void QueryServer::ListenUnix(const string &path) {
+  sockaddr_un address{};
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw invalid_argument("Unix socket path is too long");
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    ThrowSystemError("socket");
+  }
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  unlink(path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+      listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    ThrowSystemError("bind/listen " + path);
+  }
+  unix_paths_.push_back(path);
+  AddListener(fd);
+}
+
+void QueryServer::Run() {
+  for (size_t i = workers_.size(); i < config_.worker_count; ++i) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+  vector<epoll_event> events(256);
+  while (!stopping_) {
+    const int count = epoll_wait(epoll_fd_, events.data(), events.size(), -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ThrowSystemError("epoll_wait");
+    }
+    for (int i = 0; i < count; ++i) {
+      const uint64_t data = events[i].data.u64;
+      if (data & SPECIAL_FD_TAG) {
+        const int fd = static_cast<int>(data & ~SPECIAL_FD_TAG);
+        if (fd == wakeup_fd_) {
+          uint64_t value;
+          while (read(wakeup_fd_, &value, sizeof(value)) > 0) {
+          }
+          DeliverResponses();
+        } else {
+          AcceptConnections(fd);
+        }
+        continue;
+      }
+      if (!connections_.count(data)) {
+        continue;
+      }
+      // A hung-up peer cannot receive responses anymore, while a half-closed
+      // one only shows up as EOF on read
+      if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+        CloseConnection(data);
+        continue;
+      }
+      if (events[i].events & EPOLLIN) {
+        ReadFromConnection(data);
+      }
+      if (connections_.count(data) && (events[i].events & EPOLLOUT)) {
+        WriteToConnection(data);
+      }
+    }
+  }
+  lock_guard lock(jobs_mutex_);
+  jobs_cv_.notify_all();
+}
+
+void QueryServer::Stop() {
+  stopping_ = true;
+  const uint64_t one = 1;
+  [[maybe_unused]] auto written = write(wakeup_fd_, &one, sizeof(one));
+}
+
+void QueryServer::AddListener(int fd) {
+  listen_fds_.push_back(fd);
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = SPECIAL_FD_TAG | static_cast<uint64_t>(fd);
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+    ThrowSystemError("epoll_ctl");
+  }
+}
+
+void QueryServer::Watch(int fd, uint32_t events, int operation) {
+  epoll_event event{};
+  event.events = events;
+  event.data.u64 = fd_to_connection_.at(fd);
+  epoll_ctl(epoll_fd_, operation, fd, &event);
+}
+
+void QueryServer::AcceptConnections(int listen_fd) {
+  while (true) {
+    const int fd = accept4(listen_fd, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    const int enable = 1;
+    // Fails harmlessly on Unix sockets
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    const uint64_t connection_id = next_connection_id_++;
+    fd_to_connection_[fd] = connection_id;
+    Connection &connection = connections_[connection_id];
+    connection.fd = fd;
+    connection.events = EPOLLIN;
+    Watch(fd, connection.events, EPOLL_CTL_ADD);
+  }
+}
+
+void QueryServer::ReadFromConnection(uint64_t connection_id) {
+  Connection &connection = connections_.at(connection_id);
+  char buffer[64 * 1024];
+  while (connection.input.size() < MAX_CONNECTION_INPUT) {
+    const ssize_t received = read(connection.fd, buffer, sizeof(buffer));
+    if (received > 0) {
+      connection.input.append(buffer, received);
+      continue;
+    }
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received == 0) {
+      connection.read_closed = true;
+      break;
+    }
+    CloseConnection(connection_id);
+    return;
+  }
+  ProcessInput(connection_id);
+}
+
+void QueryServer::ProcessInput(uint64_t connection_id) {
+  Connection &connection = connections_.at(connection_id);
+  // Every complete frame is queued at once, so pipelined requests from one
+  // connection can be batched together
+  vector<Job> jobs;
+  bool invalid = false;
+  try {
+    size_t offset = 0, consumed = 0;
+    while (connection.pending_jobs + jobs.size() <
+           MAX_CONNECTION_PENDING_JOBS) {
+      const auto payload = ExtractFrame(
+          string_view{connection.input}.substr(offset), consumed);
+      if (!payload) {
+        break;
+      }
+      jobs.push_back({connection_id, DecodeRequest(*payload)});
+      offset += consumed;
+    }
+    connection.input.erase(0, offset);
+  } catch (const ProtocolError &) {
+    invalid = true;
+  }
+  connection.pending_jobs += jobs.size();
+  if (!jobs.empty()) {
+    lock_guard lock(jobs_mutex_);
+    move(jobs.begin(), jobs.end(), back_inserter(jobs_));
+    jobs_cv_.notify_all();
+  }
+  if (invalid) {
+    CloseConnection(connection_id);
+    return;
+  }
+  UpdateConnection(connection_id);
+}
+
+void QueryServer::WriteToConnection(uint64_t connection_id) {
+  Connection &connection = connections_.at(connection_id);
+  size_t offset = 0;
+  while (offset < connection.output.size()) {
+    const ssize_t sent =
+        send(connection.fd, connection.output.data() + offset,
+             connection.output.size() - offset, MSG_NOSIGNAL);
+    if (sent > 0) {
+      offset += sent;
+      continue;
+    }
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    CloseConnection(connection_id);
+    return;
+  }
+  connection.output.erase(0, offset);
+  UpdateConnection(connection_id);
+}
+
+void QueryServer::UpdateConnection(uint64_t connection_id) {
+  Connection &connection = connections_.at(connection_id);
+  if (connection.read_closed && connection.pending_jobs == 0 &&
+      connection.output.empty()) {
+    CloseConnection(connection_id);
+    return;
+  }
+  uint32_t events = 0;
+  if (!connection.read_closed &&
+      connection.input.size() < MAX_CONNECTION_INPUT &&
+      connection.pending_jobs < MAX_CONNECTION_PENDING_JOBS &&
+      connection.output.size() < MAX_CONNECTION_OUTPUT) {
+    events |= EPOLLIN;
+  }
+  if (!connection.output.empty()) {
+    events |= EPOLLOUT;
+  }
+  if (events != connection.events) {
+    connection.events = events;
+    Watch(connection.fd, events, EPOLL_CTL_MOD);
+  }
+}
+
+void QueryServer::CloseConnection(uint64_t connection_id) {
+  const auto it = connections_.find(connection_id);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+  close(it->second.fd);
+  fd_to_connection_.erase(it->second.fd);
+  connections_.erase(it);
+}
+
+void QueryServer::DeliverResponses() {
+  vector<Reply> responses;
+  {
+    lock_guard lock(responses_mutex_);
+    responses.swap(responses_);
+  }
+  vector<uint64_t> touched;
+  for (Reply &reply : responses) {
+    const auto it = connections_.find(reply.connection_id);
+    if (it == connections_.end()) {
+      continue; // the client went away
+    }
+    if (touched.empty() || touched.back() != reply.connection_id) {
+      touched.push_back(reply.connection_id);
+    }
+    it->second.output += reply.frames;
+    it->second.pending_jobs -= reply.count;
+  }
+  for (uint64_t connection_id : touched) {
+    // Frames held back by the pending jobs limit are queued first, so a
+    // read-closed connection is not closed before they are answered
+    if (connections_.count(connection_id)) {
+      ProcessInput(connection_id);
+    }
+    if (connections_.count(connection_id)) {
+      WriteToConnection(connection_id);
+    }
+  }
+}
+
+void QueryServer::WorkerLoop() {
+  while (true) {
+    vector<Job> batch;
+    {
+      unique_lock lock(jobs_mutex_);
+      jobs_cv_.wait(lock, [this] {
+        if (stopping_) {
+          return true;
+        }
+        if (jobs_.empty() || active_write_) {
+          return false;
+        }
+        return jobs_.front().request.IsReadOnly() || active_reads_ == 0;
+      });
+      if (stopping_) {
+        return;
+      }
+      if (!jobs_.front().request.IsReadOnly()) {
+        active_write_ = true;
+        batch.push_back(move(jobs_.front()));
+        jobs_.pop_front();
+      } else {
+        if (config_.batch_window.count() > 0 &&
+            jobs_.size() < config_.max_batch_size) {
+          jobs_cv_.wait_for(lock, config_.batch_window, [this] {
+            return stopping_ || jobs_.size() >= config_.max_batch_size;
+          });
+        }
+        // Another worker may have drained the queue or hit a write meanwhile
+        while (!jobs_.empty() && !active_write_ &&
+               jobs_.front().request.IsReadOnly() &&
+               batch.size() < config_.max_batch_size) {
+          batch.push_back(move(jobs_.front()));
+          jobs_.pop_front();
+        }
+        active_reads_ += batch.size();
+      }
+    }
+    if (batch.empty()) {
+      continue;
+    }
+    if (batch.front().request.IsReadOnly()) {
+      ExecuteReadBatch(batch);
+    } else {
+      ExecuteWrite(batch.front());
+    }
+    {
+      lock_guard lock(jobs_mutex_);
+      if (batch.front().request.IsReadOnly()) {
+        active_reads_ -= batch.size();
+      } else {
+        active_write_ = false;
+      }
+    }
+    jobs_cv_.notify_all();
+  }
+}
+
+void QueryServer::ExecuteReadBatch(vector<Job> &batch) {
+  vector<string> frames(batch.size());
+  search_server_.GetTaskScheduler().ParallelFor(
+      0, batch.size(), [&](size_t index) {
+        AppendFrame(frames[index],
+                    EncodeResponse(Execute(batch[index].request)));
+      });
+  // Frames of one connection stay together and in request order
+  vector<Reply> responses;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (responses.empty() ||
+        responses.back().connection_id != batch[i].connection_id) {
+      responses.push_back({batch[i].connection_id, string{}});
+    }
+    responses.back().frames += frames[i];
+    ++responses.back().count;
+  }
+  PostResponses(move(responses));
+}
+
+void QueryServer::ExecuteWrite(Job &job) {
+  string frame;
+  AppendFrame(frame, EncodeResponse(Execute(job.request)));
+  vector<Reply> responses;
+  responses.push_back({job.connection_id, move(frame), 1});
+  PostResponses(move(responses));
+}
+
+Response QueryServer::Execute(const Request &request) {
+  Response response;
+  response.id = request.id;
+  response.opcode = request.opcode;
+  try {
+    switch (request.opcode) {
+    case Opcode::FIND_TOP_DOCUMENTS:
+      response.documents =
+          search_server_.FindTopDocuments(request.text, request.status);
+      break;
+    case Opcode::MATCH_DOCUMENT: {
+      const auto [words, status] =
+          search_server_.MatchDocument(request.text, request.document_id);
+      response.words.assign(words.begin(), words.end());
+      response.status = status;
+      break;
+    }
+    case Opcode::ADD_DOCUMENT:
+      search_server_.AddDocument(request.document_id, request.text,
+                                 request.status, request.ratings);
+      break;
+    case Opcode::REMOVE_DOCUMENT:
+      search_server_.RemoveDocument(request.document_id);
+      break;
+    }
+  } catch (const exception &e) {
+    response.result = ResponseResult::ERROR;
+    response.error = e.what();
+  }
+  return response;
+}
+
+void QueryServer::PostResponses(vector<Reply> responses) {
+  {
+    lock_guard lock(responses_mutex_);
+    move(responses.begin(), responses.end(), back_inserter(responses_));
+  }
+  const uint64_t one = 1;
+  [[maybe_unused]] auto written = write(wakeup_fd_, &one, sizeof(one));
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+#include "search_server.h"
+
+using namespace std;
+
+struct QueryServerConfig {
+  size_t worker_count = thread::hardware_concurrency();
+  // Read-only requests waiting in the queue are executed together, in
+  // parallel and under one index snapshot, up to this many at a time
+  size_t max_batch_size = 64;
+  // How long a worker may wait for a batch to fill up
+  chrono::microseconds batch_window{0};
+};
+
+// Serves a SearchServer over TCP and/or Unix stream sockets using the
+// protocol from protocol.h. One thread runs the epoll loop and owns all
+// connections; a pool of workers executes requests. Requests are executed
+// in arrival order with respect to modifications: consecutive read-only
+// requests run concurrently, AddDocument/RemoveDocument run alone.
+class QueryServer {
+public:
+  QueryServer(SearchServer &search_server, QueryServerConfig config = {});
+
+  QueryServer(const QueryServer &) = delete;
+  QueryServer &operator=(const QueryServer &) = delete;
+
+  ~QueryServer();
+
+  // Returns the bound port, useful with port 0
+  uint16_t ListenTcp(const string &host, uint16_t port);
+
+  void ListenUnix(const string &path);
+
+  // Blocks until Stop() is called
+  void Run();
+
+  // Safe to call from any thread and from signal handlers
+  void Stop();
+
+private:
+  struct Connection {
+    int fd;
+    string input;
+    string output;
+    // Requests queued or executing whose responses are not in output yet
+    size_t pending_jobs = 0;
+    // The client shut down its sending side but may still read responses
+    bool read_closed = false;
+    uint32_t events = 0;
+  };
+
+  struct Job {
+    uint64_t connection_id;
+    Request request;
+  };
+
+  // Response frames for one connection and how many responses they hold
+  struct Reply {
+    uint64_t connection_id;
+    string frames;
+    size_t count = 0;
+  };
+
+  SearchServer &search_server_;
+  QueryServerConfig config_;
+  int epoll_fd_ = -1;
+  int wakeup_fd_ = -1;
+  vector<int> listen_fds_;
+  vector<string> unix_paths_;
+  atomic<bool> stopping_{false};
+
+  // Owned by the event loop thread
+  unordered_map<int, uint64_t> fd_to_connection_;
+  unordered_map<uint64_t, Connection> connections_;
+  uint64_t next_connection_id_ = 0;
+
+  mutex jobs_mutex_;
+  condition_variable jobs_cv_;
+  deque<Job> jobs_;
+  size_t active_reads_ = 0;
+  bool active_write_ = false;
+  vector<thread> workers_;
+
+  mutex responses_mutex_;
+  vector<Reply> responses_;
+
+  void AddListener(int fd);
+
+  void Watch(int fd, uint32_t events, int operation);
+
+  void AcceptConnections(int listen_fd);
+
+  void ReadFromConnection(uint64_t connection_id);
+
+  // Queues the complete frames of the input buffer as jobs
+  void ProcessInput(uint64_t connection_id);
+
+  void WriteToConnection(uint64_t connection_id);
+
+  // Picks the epoll events from the buffer sizes, or closes the connection
+  // once it is read-closed and everything it sent has been answered
+  void UpdateConnection(uint64_t connection_id);
+
+  void CloseConnection(uint64_t connection_id);
+
+  void DeliverResponses();
+
+  void WorkerLoop();
+
+  void ExecuteReadBatch(vector<Job> &batch);
+
+  void ExecuteWrite(Job &job);
+
+  Response Execute(const Request &request);
+
+  void PostResponses(vector<Reply> responses);
+};
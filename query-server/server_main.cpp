@@ -0,0 +1,83 @@
+#include <csignal>
+#include <iostream>
+#include <string>
+
+#include "query_server.h"
+
+using namespace std;
+
+namespace {
+
+QueryServer *running_server = nullptr;
+
+void HandleSignal(int) {
+  if (running_server != nullptr) {
+    running_server->Stop();
+  }
+}
+
+void PrintUsage() {
+  cerr << "Usage: search_query_server [--tcp HOST:PORT] [--unix PATH] "
+          "[--workers N] [--batch N] [--batch-window-us N] "
+          "[--stop-words \"WORDS\"]"s
+       << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  string tcp_address, unix_path, stop_words;
+  QueryServerConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (i + 1 == argc) {
+      PrintUsage();
+      return 1;
+    }
+    const string value = argv[++i];
+    if (arg == "--tcp"s) {
+      tcp_address = value;
+    } else if (arg == "--unix"s) {
+      unix_path = value;
+    } else if (arg == "--workers"s) {
+      config.worker_count = stoul(value);
+    } else if (arg == "--batch"s) {
+      config.max_batch_size = stoul(value);
+    } else if (arg == "--batch-window-us"s) {
+      config.batch_window = chrono::microseconds{stol(value)};
+    } else if (arg == "--stop-words"s) {
+      stop_words = value;
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (tcp_address.empty() && unix_path.empty()) {
+    tcp_address = "127.0.0.1:7700"s;
+  }
+
+  SearchServer search_server{stop_words};
+  QueryServer server{search_server, config};
+  if (!tcp_address.empty()) {
+    const auto colon = tcp_address.rfind(':');
+    if (colon == string::npos) {
+      PrintUsage();
+      return 1;
+    }
+    const uint16_t port =
+        server.ListenTcp(tcp_address.substr(0, colon),
+                         stoi(tcp_address.substr(colon + 1)));
+    cerr << "Listening on "s << tcp_address.substr(0, colon) << ':' << port
+         << endl;
+  }
+  if (!unix_path.empty()) {
+    server.ListenUnix(unix_path);
+    cerr << "Listening on "s << unix_path << endl;
+  }
+  running_server = &server;
+  signal(SIGINT, HandleSignal);
+  signal(SIGTERM, HandleSignal);
+  server.Run();
+  running_server = nullptr;
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include "allocation_counter.h"
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local size_t thread_allocations = 0;
+
+void *CountedAllocate(size_t size) {
+  ++thread_allocations;
+  if (void *p = malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *CountedAllocate(size_t size, std::align_val_t alignment) {
+  ++thread_allocations;
+  const size_t align = static_cast<size_t>(alignment);
+  size = (size + align - 1) / align * align;
+  if (void *p = aligned_alloc(align, size == 0 ? align : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+} // namespace
+
+size_t GetThreadAllocationCount() { return thread_allocations; }
+
+void *operator new(size_t size) { return CountedAllocate(size); }
+
+void *operator new[](size_t size) { return CountedAllocate(size); }
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  return CountedAllocate(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return CountedAllocate(size, alignment);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete[](void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+
+void operator delete[](void *p, std::align_val_t) noexcept { free(p); }
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { free(p); }
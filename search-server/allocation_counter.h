@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+
+// Global operator new is replaced to count allocations made by the calling
+// thread, so benchmarks can report allocations per query. Only the
+// cpp_search_server benchmark and tests link it.
+size_t GetThreadAllocationCount();
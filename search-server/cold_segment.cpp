@@ -0,0 +1,181 @@
+#include "cold_segment.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <system_error>
+
+namespace {
+
+const char SEGMENT_MAGIC[8] = {'S', 'S', 'C', 'O', 'L', 'D', '0', '1'};
+
+struct SegmentHeader {
+  char magic[8];
+  uint64_t document_count;
+  uint64_t word_count;
+  uint64_t posting_count;
+  uint64_t text_size;
+  // From the start of the file, multiples of 8
+  uint64_t documents_offset;
+  uint64_t words_offset;
+  uint64_t posting_ids_offset;
+  uint64_t posting_term_freqs_offset;
+  uint64_t texts_offset;
+};
+
+uint64_t AlignUp(uint64_t offset) { return (offset + 7) / 8 * 8; }
+
+template <typename T>
+void WriteArray(ofstream &out, uint64_t offset, const vector<T> &values) {
+  out.seekp(offset);
+  out.write(reinterpret_cast<const char *>(values.data()),
+            values.size() * sizeof(T));
+}
+
+} // namespace
+
+void ColdSegment::Write(const string &path,
+                        const vector<DocumentWords> &documents) {
+  vector<DocumentEntry> entries;
+  entries.reserve(documents.size());
+  // Postings come out sorted by id when documents are visited in that order
+  vector<const DocumentWords *> by_id;
+  for (const DocumentWords &document : documents) {
+    by_id.push_back(&document);
+  }
+  sort(by_id.begin(), by_id.end(),
+       [](const auto *lhs, const auto *rhs) { return lhs->id < rhs->id; });
+  map<string_view, vector<pair<int32_t, double>>> postings;
+  for (const DocumentWords *document : by_id) {
+    entries.push_back({document->id, document->rating,
+                       static_cast<int32_t>(document->status)});
+    for (const auto &[word, term_freq] : document->word_freqs) {
+      postings[word].emplace_back(document->id, term_freq);
+    }
+  }
+
+  vector<WordEntry> words;
+  vector<int32_t> posting_ids;
+  vector<double> posting_term_freqs;
+  string texts;
+  for (const auto &[word, docs] : postings) {
+    words.push_back({static_cast<uint32_t>(texts.size()),
+                     static_cast<uint32_t>(word.size()),
+                     static_cast<uint32_t>(posting_ids.size()),
+                     static_cast<uint32_t>(docs.size())});
+    texts += word;
+    for (const auto &[id, term_freq] : docs) {
+      posting_ids.push_back(id);
+      posting_term_freqs.push_back(term_freq);
+    }
+  }
+
+  SegmentHeader header{};
+  memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+  header.document_count = entries.size();
+  header.word_count = words.size();
+  header.posting_count = posting_ids.size();
+  header.text_size = texts.size();
+  header.documents_offset = AlignUp(sizeof(SegmentHeader));
+  header.words_offset = AlignUp(header.documents_offset +
+                                entries.size() * sizeof(DocumentEntry));
+  header.posting_ids_offset =
+      AlignUp(header.words_offset + words.size() * sizeof(WordEntry));
+  header.posting_term_freqs_offset = AlignUp(
+      header.posting_ids_offset + posting_ids.size() * sizeof(int32_t));
+  header.texts_offset = AlignUp(header.posting_term_freqs_offset +
+                                posting_term_freqs.size() * sizeof(double));
+
+  ofstream out(path, ios::binary | ios::trunc);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  WriteArray(out, header.documents_offset, entries);
+  WriteArray(out, header.words_offset, words);
+  WriteArray(out, header.posting_ids_offset, posting_ids);
+  WriteArray(out, header.posting_term_freqs_offset, posting_term_freqs);
+  out.seekp(header.texts_offset);
+  out.write(texts.data(), texts.size());
+  out.close();
+  if (!out) {
+    throw system_error(errno, generic_category(), "write " + path);
+  }
+}
+
+ColdSegment::ColdSegment(const string &path)
+    : file_(path, FileAccess::RANDOM) {
+  const string_view contents = file_.GetContents();
+  auto fits = [&contents](uint64_t offset, uint64_t count, size_t size) {
+    return offset % 8 == 0 && offset <= contents.size() &&
+           count <= (contents.size() - offset) / size;
+  };
+  SegmentHeader header{};
+  if (contents.size() < sizeof(header)) {
+    throw invalid_argument("Not a cold segment: "s + path);
+  }
+  memcpy(&header, contents.data(), sizeof(header));
+  if (memcmp(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 ||
+      !fits(header.documents_offset, header.document_count,
+            sizeof(DocumentEntry)) ||
+      !fits(header.words_offset, header.word_count, sizeof(WordEntry)) ||
+      !fits(header.posting_ids_offset, header.posting_count,
+            sizeof(int32_t)) ||
+      !fits(header.posting_term_freqs_offset, header.posting_count,
+            sizeof(double)) ||
+      !fits(header.texts_offset, header.text_size, 1)) {
+    throw invalid_argument("Not a cold segment: "s + path);
+  }
+  document_count_ = header.document_count;
+  word_count_ = header.word_count;
+  documents_ = reinterpret_cast<const DocumentEntry *>(
+      contents.data() + header.documents_offset);
+  words_ = reinterpret_cast<const WordEntry *>(contents.data() +
+                                               header.words_offset);
+  posting_ids_ = reinterpret_cast<const int32_t *>(contents.data() +
+                                                   header.posting_ids_offset);
+  posting_term_freqs_ = reinterpret_cast<const double *>(
+      contents.data() + header.posting_term_freqs_offset);
+  texts_ = contents.data() + header.texts_offset;
+  for (size_t i = 0; i < word_count_; ++i) {
+    const WordEntry &word = words_[i];
+    if (uint64_t{word.text_offset} + word.text_size > header.text_size ||
+        uint64_t{word.first_posting} + word.posting_count >
+            header.posting_count) {
+      throw invalid_argument("Not a cold segment: "s + path);
+    }
+  }
+}
+
+const ColdSegment::DocumentEntry *
+ColdSegment::FindDocument(int document_id) const {
+  const DocumentEntry *it =
+      lower_bound(begin(), end(), document_id,
+                  [](const DocumentEntry &entry, int id) {
+                    return entry.id < id;
+                  });
+  return it != end() && it->id == document_id ? it : nullptr;
+}
+
+ColdSegment::Postings ColdSegment::FindPostings(string_view word) const {
+  const WordEntry *first = words_;
+  const WordEntry *last = words_ + word_count_;
+  const WordEntry *it = lower_bound(
+      first, last, word, [this](const WordEntry &entry, string_view word) {
+        return GetWord(entry) < word;
+      });
+  if (it == last || GetWord(*it) != word) {
+    return {};
+  }
+  return {posting_ids_ + it->first_posting,
+          posting_term_freqs_ + it->first_posting, it->posting_count};
+}
+
+void ColdSegment::Prefetch(const Postings &postings) const {
+  if (postings.size == 0) {
+    return;
+  }
+  const char *base = file_.GetContents().data();
+  file_.Prefetch(reinterpret_cast<const char *>(postings.ids) - base,
+                 postings.size * sizeof(int32_t));
+  file_.Prefetch(reinterpret_cast<const char *>(postings.term_freqs) - base,
+                 postings.size * sizeof(double));
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "document.h"
+#include "read_input_functions.h"
+
+using namespace std;
+
+// Immutable file of documents' attributes and postings, read through a
+// memory mapping so only the pages queries touch are loaded. Integers are
+// stored in the native byte order, so a segment is only read on the kind of
+// machine that wrote it.
+class ColdSegment {
+public:
+  struct DocumentEntry {
+    int32_t id;
+    int32_t rating;
+    int32_t status;
+  };
+
+  struct Postings {
+    const int32_t *ids = nullptr;
+    const double *term_freqs = nullptr;
+    size_t size = 0;
+  };
+
+  struct DocumentWords {
+    int id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    int rating = 0;
+    vector<pair<string_view, double>> word_freqs;
+  };
+
+  // Throws system_error if the file cannot be written
+  static void Write(const string &path, const vector<DocumentWords> &documents);
+
+  // Throws system_error if the file cannot be read and invalid_argument if it
+  // is not a segment
+  explicit ColdSegment(const string &path);
+
+  [[nodiscard]] size_t GetDocumentCount() const { return document_count_; }
+
+  // Sorted by id
+  [[nodiscard]] const DocumentEntry *begin() const { return documents_; }
+  [[nodiscard]] const DocumentEntry *end() const {
+    return documents_ + document_count_;
+  }
+
+  // nullptr if the segment does not have the document
+  [[nodiscard]] const DocumentEntry *FindDocument(int document_id) const;
+
+  // Sorted by id, empty if no document has the word
+  [[nodiscard]] Postings FindPostings(string_view word) const;
+
+  // Asks the kernel to read the postings ahead of a scan
+  void Prefetch(const Postings &postings) const;
+
+private:
+  struct WordEntry {
+    uint32_t text_offset;
+    uint32_t text_size;
+    uint32_t first_posting;
+    uint32_t posting_count;
+  };
+
+  MappedFile file_;
+  size_t document_count_ = 0;
+  size_t word_count_ = 0;
+  const DocumentEntry *documents_ = nullptr;
+  const WordEntry *words_ = nullptr;
+  const int32_t *posting_ids_ = nullptr;
+  const double *posting_term_freqs_ = nullptr;
+  const char *texts_ = nullptr;
+
+  [[nodiscard]] string_view GetWord(const WordEntry &entry) const {
+    return {texts_ + entry.text_offset, entry.text_size};
+  }
+};
@@ -1,47 +1,384 @@
 #pragma once
 
-#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
-#include <string>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "task_scheduler.h"
+
 using namespace std;
 
-template <typename Key, typename Value> class ConcurrentMap {
+// Hash map for many threads at once. Keys are spread over shards, each an
+// open addressing table with linear probing. Lookups never lock, inserting a
+// key locks its shard. A full table is not rehashed: a table twice as large
+// is put in front of it and lookups probe the tables newest first, so
+// elements never move and references to values stay valid until the map is
+// destroyed. Keys cannot be erased.
+//
+// Arithmetic values are atomic and changed in place with Add and Store,
+// which take no lock. Any value can also be reached through Access, which
+// locks the shard; for arithmetic values its ref_to_value is a proxy that
+// changes the atomic, so it stays safe beside Add and Store.
+template <typename Key, typename Value, typename Hash = hash<Key>>
+class ConcurrentMap {
+public:
+  static constexpr bool IS_ATOMIC = is_arithmetic_v<Value>;
+
+  class AtomicRef {
+  public:
+    explicit AtomicRef(atomic<Value> &value) : value_(value) {}
+
+    operator Value() const { return value_.load(memory_order_relaxed); }
+
+    AtomicRef &operator=(Value value) {
+      value_.store(value, memory_order_relaxed);
+      return *this;
+    }
+
+    AtomicRef &operator+=(Value delta) {
+      AddTo(value_, delta);
+      return *this;
+    }
+
+    AtomicRef &operator-=(Value delta) {
+      AddTo(value_, -delta);
+      return *this;
+    }
+
+  private:
+    atomic<Value> &value_;
+  };
+
+  struct Access {
+    unique_lock<mutex> guard;
+    conditional_t<IS_ATOMIC, AtomicRef, Value &> ref_to_value;
+  };
+
+  // expected_size only sizes the first tables, the map grows past it
+  explicit ConcurrentMap(size_t expected_size = 0, size_t shard_count = 0);
+
+  void Add(const Key &key, Value delta);
+
+  void Store(const Key &key, Value value);
+
+  Access operator[](const Key &key);
+
+  [[nodiscard]] optional<Value> Find(const Key &key) const;
+
+  [[nodiscard]] size_t GetSize() const;
+
+  map<Key, Value> BuildOrdinaryMap() const;
+
+  // Shards are copied in parallel on scheduler, items come in no particular
+  // order
+  vector<pair<Key, Value>> BuildItems(TaskScheduler &scheduler) const;
+
 private:
-  struct Bucket {
-    mutex mut;
-    map<Key, Value> dict;
+  struct Slot {
+    // Set once key and value are written, never cleared
+    atomic<bool> ready{false};
+    size_t hash = 0;
+    Key key{};
+    conditional_t<IS_ATOMIC, atomic<Value>, Value> value{};
   };
 
-public:
-  static_assert(is_integral_v<Key>, "ConcurrentMap supports only integer keys");
+  struct Table {
+    Table(size_t capacity, unique_ptr<Table> older_table)
+        : slots(make_unique<Slot[]>(capacity)), mask(capacity - 1),
+          older(move(older_table)) {}
 
-  struct Access {
-    lock_guard<mutex> guard;
-    Value &ref_to_value;
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    size_t size = 0;
+    unique_ptr<Table> older;
+  };
 
-    Access(const Key &key, Bucket &bucket)
-        : guard(bucket.mut), ref_to_value(bucket.dict[key]) {}
+  // Own cache line, so threads on different shards do not share one
+  struct alignas(64) Shard {
+    mutable mutex mut;
+    // Guarded by mut
+    unique_ptr<Table> newest;
+    // Same table for lock free readers
+    atomic<Table *> published{nullptr};
   };
 
-  explicit ConcurrentMap(size_t bucket_count) : buckets_(bucket_count) {}
+  unique_ptr<Shard[]> shards_;
+  size_t shard_mask_;
+
+  static size_t RoundUpToPowerOfTwo(size_t n);
+
+  static size_t Mix(size_t hash);
+
+  const Shard &GetShard(size_t hash) const {
+    return shards_[(hash >> 32) & shard_mask_];
+  }
 
-  Access operator[](const Key &key) {
-    auto &bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
-    return {key, bucket};
+  Shard &GetShard(size_t hash) {
+    return shards_[(hash >> 32) & shard_mask_];
   }
 
-  map<Key, Value> BuildOrdinaryMap() {
-    map<Key, Value> result;
-    for (auto &[mut, dict] : buckets_) {
-      lock_guard g(mut);
-      result.insert(dict.begin(), dict.end());
+  static Slot *FindInTable(const Table &table, size_t hash, const Key &key);
+
+  static Slot *FindInShard(const Shard &shard, size_t hash, const Key &key);
+
+  // Under shard.mut
+  static Slot &FindOrInsert(Shard &shard, size_t hash, const Key &key);
+
+  Slot &GetSlot(const Key &key);
+
+  static size_t GetShardSize(const Shard &shard);
+
+  template <typename Function>
+  static void ForEachSlot(const Shard &shard, Function function);
+
+  static void AddTo(atomic<Value> &value, Value delta);
+
+  static Value LoadValue(const Slot &slot) {
+    if constexpr (IS_ATOMIC) {
+      return slot.value.load(memory_order_relaxed);
+    } else {
+      return slot.value;
     }
-    return result;
   }
+};
 
-private:
-  vector<Bucket> buckets_;
-};
\ No newline at end of file
+template <typename Key, typename Value, typename Hash>
+ConcurrentMap<Key, Value, Hash>::ConcurrentMap(size_t expected_size,
+                                               size_t shard_count) {
+  if (shard_count == 0) {
+    shard_count = 4 * max(1u, thread::hardware_concurrency());
+  }
+  shard_count = RoundUpToPowerOfTwo(shard_count);
+  shards_ = make_unique<Shard[]>(shard_count);
+  shard_mask_ = shard_count - 1;
+  // Tables are kept at most half full
+  const size_t capacity =
+      RoundUpToPowerOfTwo(max<size_t>(8, 2 * expected_size / shard_count + 1));
+  for (size_t i = 0; i < shard_count; ++i) {
+    shards_[i].newest = make_unique<Table>(capacity, nullptr);
+    shards_[i].published.store(shards_[i].newest.get(),
+                               memory_order_release);
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentMap<Key, Value, Hash>::Add(const Key &key, Value delta) {
+  static_assert(IS_ATOMIC, "Add needs an arithmetic value");
+  AddTo(GetSlot(key).value, delta);
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentMap<Key, Value, Hash>::Store(const Key &key, Value value) {
+  static_assert(IS_ATOMIC, "Store needs an arithmetic value");
+  GetSlot(key).value.store(value, memory_order_relaxed);
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentMap<Key, Value, Hash>::Access
+ConcurrentMap<Key, Value, Hash>::operator[](const Key &key) {
+  const size_t hash = Mix(Hash{}(key));
+  Shard &shard = GetShard(hash);
+  unique_lock lock(shard.mut);
+  Slot &slot = FindOrInsert(shard, hash, key);
+  if constexpr (IS_ATOMIC) {
+    return {move(lock), AtomicRef{slot.value}};
+  } else {
+    return {move(lock), slot.value};
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+optional<Value> ConcurrentMap<Key, Value, Hash>::Find(const Key &key) const {
+  const size_t hash = Mix(Hash{}(key));
+  const Shard &shard = GetShard(hash);
+  if constexpr (IS_ATOMIC) {
+    if (const Slot *slot = FindInShard(shard, hash, key)) {
+      return LoadValue(*slot);
+    }
+  } else {
+    lock_guard lock(shard.mut);
+    if (const Slot *slot = FindInShard(shard, hash, key)) {
+      return slot->value;
+    }
+  }
+  return nullopt;
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentMap<Key, Value, Hash>::GetSize() const {
+  size_t size = 0;
+  for (size_t i = 0; i <= shard_mask_; ++i) {
+    size += GetShardSize(shards_[i]);
+  }
+  return size;
+}
+
+template <typename Key, typename Value, typename Hash>
+map<Key, Value> ConcurrentMap<Key, Value, Hash>::BuildOrdinaryMap() const {
+  map<Key, Value> result;
+  for (size_t i = 0; i <= shard_mask_; ++i) {
+    ForEachSlot(shards_[i], [&result](const Slot &slot) {
+      result.emplace(slot.key, LoadValue(slot));
+    });
+  }
+  return result;
+}
+
+template <typename Key, typename Value, typename Hash>
+vector<pair<Key, Value>>
+ConcurrentMap<Key, Value, Hash>::BuildItems(TaskScheduler &scheduler) const {
+  // Each shard is copied to its place, found from the sizes beforehand
+  vector<size_t> offsets(shard_mask_ + 2);
+  for (size_t i = 0; i <= shard_mask_; ++i) {
+    offsets[i + 1] = offsets[i] + GetShardSize(shards_[i]);
+  }
+
+  vector<pair<Key, Value>> items(offsets.back());
+  scheduler.ParallelFor(0, shard_mask_ + 1, [&](size_t i) {
+    size_t offset = offsets[i];
+    ForEachSlot(shards_[i], [&](const Slot &slot) {
+      // Keys inserted since the sizes were taken are left out
+      if (offset < offsets[i + 1]) {
+        items[offset++] = {slot.key, LoadValue(slot)};
+      }
+    });
+  });
+  return items;
+}
+
+template <typename Key, typename Value, typename Hash>
+void ConcurrentMap<Key, Value, Hash>::AddTo(atomic<Value> &value,
+                                            Value delta) {
+  if constexpr (is_integral_v<Value> && !is_same_v<Value, bool>) {
+    value.fetch_add(delta, memory_order_relaxed);
+  } else {
+    // No fetch_add for floating point atomics before C++20
+    Value expected = value.load(memory_order_relaxed);
+    while (!value.compare_exchange_weak(expected, expected + delta,
+                                        memory_order_relaxed)) {
+    }
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentMap<Key, Value, Hash>::RoundUpToPowerOfTwo(size_t n) {
+  size_t power = 1;
+  while (power < n) {
+    power <<= 1;
+  }
+  return power;
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentMap<Key, Value, Hash>::Mix(size_t hash) {
+  // Finalizer of MurmurHash3, std::hash of integers is the identity
+  uint64_t h = hash;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return static_cast<size_t>(h);
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentMap<Key, Value, Hash>::Slot *
+ConcurrentMap<Key, Value, Hash>::FindInTable(const Table &table, size_t hash,
+                                             const Key &key) {
+  for (size_t i = hash & table.mask;; i = (i + 1) & table.mask) {
+    Slot &slot = table.slots[i];
+    // Keys are never erased, so the first free slot ends the probe
+    if (!slot.ready.load(memory_order_acquire)) {
+      return nullptr;
+    }
+    if (slot.hash == hash && slot.key == key) {
+      return &slot;
+    }
+  }
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentMap<Key, Value, Hash>::Slot *
+ConcurrentMap<Key, Value, Hash>::FindInShard(const Shard &shard, size_t hash,
+                                             const Key &key) {
+  for (const Table *table = shard.published.load(memory_order_acquire); table;
+       table = table->older.get()) {
+    if (Slot *slot = FindInTable(*table, hash, key)) {
+      return slot;
+    }
+  }
+  return nullptr;
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentMap<Key, Value, Hash>::Slot &
+ConcurrentMap<Key, Value, Hash>::FindOrInsert(Shard &shard, size_t hash,
+                                              const Key &key) {
+  if (Slot *slot = FindInShard(shard, hash, key)) {
+    return *slot;
+  }
+  Table *table = shard.newest.get();
+  if (2 * (table->size + 1) > table->mask + 1) {
+    shard.newest =
+        make_unique<Table>(2 * (table->mask + 1), move(shard.newest));
+    table = shard.newest.get();
+    shard.published.store(table, memory_order_release);
+  }
+  size_t i = hash & table->mask;
+  while (table->slots[i].ready.load(memory_order_relaxed)) {
+    i = (i + 1) & table->mask;
+  }
+  Slot &slot = table->slots[i];
+  slot.hash = hash;
+  slot.key = key;
+  slot.ready.store(true, memory_order_release);
+  ++table->size;
+  return slot;
+}
+
+template <typename Key, typename Value, typename Hash>
+typename ConcurrentMap<Key, Value, Hash>::Slot &
+ConcurrentMap<Key, Value, Hash>::GetSlot(const Key &key) {
+  const size_t hash = Mix(Hash{}(key));
+  Shard &shard = GetShard(hash);
+  if (Slot *slot = FindInShard(shard, hash, key)) {
+    return *slot;
+  }
+  lock_guard lock(shard.mut);
+  return FindOrInsert(shard, hash, key);
+}
+
+template <typename Key, typename Value, typename Hash>
+size_t ConcurrentMap<Key, Value, Hash>::GetShardSize(const Shard &shard) {
+  lock_guard lock(shard.mut);
+  size_t size = 0;
+  for (const Table *table = shard.newest.get(); table;
+       table = table->older.get()) {
+    size += table->size;
+  }
+  return size;
+}
+
+template <typename Key, typename Value, typename Hash>
+template <typename Function>
+void ConcurrentMap<Key, Value, Hash>::ForEachSlot(const Shard &shard,
+                                                  Function function) {
+  lock_guard lock(shard.mut);
+  for (const Table *table = shard.newest.get(); table;
+       table = table->older.get()) {
+    for (size_t i = 0; i <= table->mask; ++i) {
+      if (table->slots[i].ready.load(memory_order_acquire)) {
+        function(table->slots[i]);
+      }
+    }
+  }
+}
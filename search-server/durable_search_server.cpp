@@ -0,0 +1,112 @@
+#include "durable_search_server.h"
+#include <filesystem>
+
+DurableSearchServer::DurableSearchServer(const string &directory,
+                                         string_view stop_words,
+                                         const DurabilityOptions &options)
+    : snapshot_path_(directory + "/snapshot"s),
+      log_path_(directory + "/wal"s), options_(options), server_(stop_words) {
+  filesystem::create_directories(directory);
+  uint64_t last_sequence = 0;
+  if (filesystem::exists(snapshot_path_)) {
+    size_t valid_size = 0;
+    vector<WalRecord> snapshot =
+        WriteAheadLog::Read(snapshot_path_, &valid_size);
+    // Written in one go, so unlike the log it is never cut short
+    if (snapshot.empty() || snapshot.front().type != WalRecordType::CHECKPOINT ||
+        valid_size != filesystem::file_size(snapshot_path_)) {
+      throw invalid_argument("Damaged snapshot: "s + snapshot_path_);
+    }
+    last_sequence = snapshot.front().sequence;
+    Replay(snapshot);
+  }
+  vector<WalRecord> records = WriteAheadLog::Recover(log_path_);
+  // Left over if a checkpoint stopped before emptying the log
+  const auto first_new = find_if(
+      records.begin(), records.end(),
+      [last_sequence](const WalRecord &record) {
+        return record.sequence > last_sequence;
+      });
+  records.erase(records.begin(), first_new);
+  Replay(records);
+  replayed_records_ = records.size();
+  if (!records.empty()) {
+    last_sequence = records.back().sequence;
+  }
+  log_ = make_unique<WriteAheadLog>(log_path_, last_sequence + 1,
+                                    options_.log);
+}
+
+void DurableSearchServer::AddDocument(int document_id, string_view document,
+                                      DocumentStatus status,
+                                      const vector<int> &ratings) {
+  uint64_t sequence = 0;
+  {
+    lock_guard lock(mutex_);
+    server_.AddDocument(document_id, document, status, ratings);
+    // Logged once the index accepted it, with the averaged rating
+    sequence = log_->Append({0, WalRecordType::ADD, document_id, status,
+                             server_.documents_.at(document_id).rating,
+                             string{document}});
+  }
+  WaitDurable(sequence);
+}
+
+void DurableSearchServer::RemoveDocument(int document_id) {
+  uint64_t sequence = 0;
+  {
+    lock_guard lock(mutex_);
+    if (server_.documents_.count(document_id) == 0) {
+      return;
+    }
+    server_.RemoveDocument(document_id);
+    WalRecord record;
+    record.type = WalRecordType::REMOVE;
+    record.document_id = document_id;
+    sequence = log_->Append(move(record));
+  }
+  WaitDurable(sequence);
+}
+
+void DurableSearchServer::Sync() { log_->Sync(); }
+
+void DurableSearchServer::Checkpoint() {
+  lock_guard lock(mutex_);
+  const uint64_t sequence = log_->GetLastSequence();
+  string contents;
+  WalRecord checkpoint;
+  checkpoint.sequence = sequence;
+  checkpoint.type = WalRecordType::CHECKPOINT;
+  WriteAheadLog::Encode(checkpoint, contents);
+  for (const auto &[id, data] : server_.documents_) {
+    WriteAheadLog::Encode({sequence, WalRecordType::ADD, id, data.status,
+                           data.rating, string{data.text}},
+                          contents);
+  }
+  WriteAheadLog::WriteFileAtomically(snapshot_path_, contents);
+  log_->Reset();
+}
+
+void DurableSearchServer::Replay(const vector<WalRecord> &records) {
+  vector<DocumentRecord> additions;
+  auto add_all = [this, &additions] {
+    server_.AddDocuments(execution::par, additions);
+    additions.clear();
+  };
+  for (const WalRecord &record : records) {
+    if (record.type == WalRecordType::ADD) {
+      additions.push_back(
+          {record.document_id, record.text, record.status, record.rating});
+    } else if (record.type == WalRecordType::REMOVE) {
+      add_all();
+      server_.RemoveDocument(record.document_id);
+    }
+  }
+  add_all();
+}
+
+void DurableSearchServer::WaitDurable(uint64_t sequence) {
+  if (options_.wait_for_durability) {
+    log_->WaitDurable(sequence);
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "search_server.h"
+#include "write_ahead_log.h"
+
+struct DurabilityOptions {
+  WalOptions log;
+  // Changes return only once they are on disk. Otherwise a crash loses at
+  // most the last commit_interval of them.
+  bool wait_for_durability = false;
+};
+
+// SearchServer whose changes survive a restart: every change is applied to
+// the index and appended to a write-ahead log in directory. Checkpoint
+// writes the whole index to a snapshot and empties the log; opening the
+// directory loads the snapshot and replays the log on top, splitting the
+// documents' words in parallel.
+//
+// Changes may come from several threads at once, and then share log syncs.
+// Queries must not run while the index changes.
+class DurableSearchServer {
+public:
+  // Creates directory if needed. Throws system_error if it cannot be read
+  // or written and invalid_argument if its snapshot is damaged.
+  explicit DurableSearchServer(const string &directory,
+                               string_view stop_words = {},
+                               const DurabilityOptions &options = {});
+
+  void AddDocument(int document_id, string_view document, DocumentStatus status,
+                   const vector<int> &ratings);
+
+  // Unknown ids are ignored
+  void RemoveDocument(int document_id);
+
+  // Blocks until every change so far is on disk
+  void Sync();
+
+  // Holds the lock of the changes while it writes and syncs the snapshot,
+  // so AddDocument and RemoveDocument wait for it, since the log may only be
+  // emptied of what the snapshot holds. Its cost grows with the index.
+  void Checkpoint();
+
+  [[nodiscard]] const SearchServer &GetServer() const { return server_; }
+
+  [[nodiscard]] WalStats GetWalStats() const { return log_->GetStats(); }
+
+  // Log records applied when the directory was opened
+  [[nodiscard]] size_t GetReplayedRecordCount() const {
+    return replayed_records_;
+  }
+
+private:
+  string snapshot_path_;
+  string log_path_;
+  DurabilityOptions options_;
+  SearchServer server_;
+  unique_ptr<WriteAheadLog> log_;
+  // Changes reach the index and the log in the same order
+  mutex mutex_;
+  size_t replayed_records_ = 0;
+
+  // Applies consecutive additions as one parallel batch
+  void Replay(const vector<WalRecord> &records);
+
+  void WaitDurable(uint64_t sequence);
+};
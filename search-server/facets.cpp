@@ -0,0 +1,39 @@
+#include "facets.h"
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+FacetCounts::FacetCounts(int rating_bucket_width)
+    : rating_bucket_width(rating_bucket_width) {
+  if (rating_bucket_width <= 0) {
+    throw invalid_argument("Rating bucket width must be positive"s);
+  }
+}
+
+void FacetCounts::Add(DocumentStatus status, int rating) {
+  ++by_status[static_cast<size_t>(status)];
+  // Rounded down, also for negative ratings
+  int bound = rating / rating_bucket_width * rating_bucket_width;
+  if (bound > rating) {
+    bound -= rating_bucket_width;
+  }
+  ++by_rating[bound];
+}
+
+size_t FacetCounts::GetTotalCount() const {
+  return accumulate(by_status.begin(), by_status.end(), size_t{0});
+}
+
+ostream &operator<<(ostream &os, const FacetCounts &facets) {
+  os << "{ actual = "s << facets.GetStatusCount(DocumentStatus::ACTUAL)
+     << ", irrelevant = "s << facets.GetStatusCount(DocumentStatus::IRRELEVANT)
+     << ", banned = "s << facets.GetStatusCount(DocumentStatus::BANNED)
+     << ", removed = "s << facets.GetStatusCount(DocumentStatus::REMOVED)
+     << ", ratings = ["s;
+  bool first = true;
+  for (const auto &[bound, count] : facets.by_rating) {
+    os << (first ? ""s : " "s) << bound << ':' << count;
+    first = false;
+  }
+  return os << "] }"s;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "document.h"
+
+using namespace std;
+
+// Documents matching a query per attribute value, whatever the filter
+struct FacetCounts {
+  explicit FacetCounts(int rating_bucket_width = 1);
+
+  // Indexed by DocumentStatus
+  array<size_t, 4> by_status{};
+  // Lower bound of each rating bucket to its count, buckets are
+  // [bound, bound + rating_bucket_width)
+  map<int, size_t> by_rating;
+  int rating_bucket_width;
+
+  void Add(DocumentStatus status, int rating);
+
+  [[nodiscard]] size_t GetStatusCount(DocumentStatus status) const {
+    return by_status[static_cast<size_t>(status)];
+  }
+
+  [[nodiscard]] size_t GetTotalCount() const;
+};
+
+struct FacetedResults {
+  vector<Document> documents;
+  FacetCounts facets;
+};
+
+ostream &operator<<(ostream &os, const FacetCounts &facets);
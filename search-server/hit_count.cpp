@@ -0,0 +1,53 @@
+#include "hit_count.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Finalizer of SplitMix64, spreads consecutive ids over all bits
+uint64_t MixBits(uint64_t value) {
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+  return value ^ (value >> 31);
+}
+
+} // namespace
+
+void HyperLogLog::Add(uint64_t value) {
+  const uint64_t hash = MixBits(value);
+  const size_t index = hash >> (64 - PRECISION);
+  // The rest of the hash with a stop bit, so a zero rest still ends
+  const uint64_t rest = (hash << PRECISION) | (uint64_t{1} << (PRECISION - 1));
+  uint8_t rank = 1;
+  for (uint64_t bit = uint64_t{1} << 63; (rest & bit) == 0; bit >>= 1) {
+    ++rank;
+  }
+  registers_[index] = max(registers_[index], rank);
+}
+
+void HyperLogLog::Merge(const HyperLogLog &other) {
+  for (size_t i = 0; i < REGISTER_COUNT; ++i) {
+    registers_[i] = max(registers_[i], other.registers_[i]);
+  }
+}
+
+double HyperLogLog::Estimate() const {
+  const double m = REGISTER_COUNT;
+  double sum = 0;
+  size_t zeros = 0;
+  for (const uint8_t rank : registers_) {
+    sum += ldexp(1.0, -rank);
+    zeros += rank == 0;
+  }
+  const double alpha = 0.7213 / (1 + 1.079 / m);
+  const double estimate = alpha * m * m / sum;
+  // Linear counting is more accurate while many registers are empty
+  if (estimate <= 2.5 * m && zeros > 0) {
+    return m * log(m / zeros);
+  }
+  return estimate;
+}
+
+double HyperLogLog::GetRelativeError() {
+  return 1.04 / sqrt(static_cast<double>(REGISTER_COUNT));
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+using namespace std;
+
+enum class HitCountMode { EXACT, APPROXIMATE };
+
+struct HitCount {
+  size_t count = 0;
+  // Standard error of count in documents, 0 if it is exact
+  double standard_error = 0;
+
+  [[nodiscard]] bool IsExact() const { return standard_error == 0; }
+};
+
+// Estimates how many distinct values were added in constant memory, with a
+// relative standard error of GetRelativeError(). Sketches of two sets merge
+// into the sketch of their union.
+class HyperLogLog {
+public:
+  static constexpr int PRECISION = 10;
+  static constexpr size_t REGISTER_COUNT = size_t{1} << PRECISION;
+
+  void Add(uint64_t value);
+
+  void Merge(const HyperLogLog &other);
+
+  [[nodiscard]] double Estimate() const;
+
+  [[nodiscard]] static double GetRelativeError();
+
+private:
+  // Highest position of the first set bit seen per bucket of hashes
+  array<uint8_t, REGISTER_COUNT> registers_{};
+};
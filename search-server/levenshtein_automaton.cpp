@@ -0,0 +1,43 @@
+#include "levenshtein_automaton.h"
+#include <algorithm>
+#include <stdexcept>
+
+LevenshteinAutomaton::LevenshteinAutomaton(string_view pattern, int max_edits)
+    : pattern_{pattern}, max_edits_{max_edits} {
+  if (max_edits < 0) {
+    throw invalid_argument("Edit distance must not be negative");
+  }
+}
+
+LevenshteinAutomaton::State LevenshteinAutomaton::Start() const {
+  State state(pattern_.size() + 1);
+  for (size_t i = 0; i < state.size(); ++i) {
+    state[i] = min(static_cast<int>(i), max_edits_ + 1);
+  }
+  return state;
+}
+
+LevenshteinAutomaton::State LevenshteinAutomaton::Step(const State &state,
+                                                       char ch) const {
+  State next(state.size());
+  next[0] = min(state[0] + 1, max_edits_ + 1);
+  for (size_t i = 1; i < state.size(); ++i) {
+    const int replace = state[i - 1] + (pattern_[i - 1] == ch ? 0 : 1);
+    const int insert = state[i] + 1;
+    const int remove = next[i - 1] + 1;
+    next[i] = min({replace, insert, remove, max_edits_ + 1});
+  }
+  return next;
+}
+
+bool LevenshteinAutomaton::IsMatch(const State &state) const {
+  return state.back() <= max_edits_;
+}
+
+bool LevenshteinAutomaton::CanMatch(const State &state) const {
+  return *min_element(state.begin(), state.end()) <= max_edits_;
+}
+
+int LevenshteinAutomaton::Distance(const State &state) const {
+  return state.back();
+}
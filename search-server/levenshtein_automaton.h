@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Deterministic Levenshtein automaton for a fixed pattern word. A state is
+// the current row of the edit-distance table, with values clamped to
+// max_edits + 1, so it can be advanced one character at a time while walking
+// a sorted term dictionary and abandoned as soon as no extension can match.
+class LevenshteinAutomaton {
+public:
+  using State = vector<int>;
+
+  LevenshteinAutomaton(string_view pattern, int max_edits);
+
+  [[nodiscard]] State Start() const;
+
+  [[nodiscard]] State Step(const State &state, char ch) const;
+
+  [[nodiscard]] bool IsMatch(const State &state) const;
+
+  [[nodiscard]] bool CanMatch(const State &state) const;
+
+  [[nodiscard]] int Distance(const State &state) const;
+
+  [[nodiscard]] int GetMaxEdits() const { return max_edits_; }
+
+private:
+  string pattern_;
+  int max_edits_;
+};
@@ -1,3 +1,4 @@
+#include "allocation_counter.h"
 #include "document.h"
 #include "log_duration.h"
 #include "process_queries.h"
@@ -60,12 +61,29 @@ void Test(string_view mark, const SearchServer &search_server,
           const vector<string> &queries, ExecutionPolicy &&policy) {
   LOG_DURATION(mark);
   double total_relevance = 0;
-  vector<Document> test;
+  const size_t allocations_before = GetThreadAllocationCount();
   for (const string_view query : queries) {
     for (const auto &document : search_server.FindTopDocuments(policy, query)) {
       total_relevance += document.relevance;
     }
   }
+  const size_t allocations = GetThreadAllocationCount() - allocations_before;
+  cout << "Total relevance: " << total_relevance << endl;
+  cout << "Allocations per query (calling thread): "
+       << static_cast<double>(allocations) / queries.size() << endl;
+}
+
+// Runs the whole batch at once, as run(search_server, queries, results)
+template <typename BatchRunner>
+void TestBatch(string_view mark, const SearchServer &search_server,
+               const vector<string> &queries, BatchRunner run) {
+  LOG_DURATION(mark);
+  QueryBatchResults results;
+  run(search_server, queries, results);
+  double total_relevance = 0;
+  for (const Document &document : results.documents) {
+    total_relevance += document.relevance;
+  }
   cout << "Total relevance: " << total_relevance << endl;
 }
 
@@ -129,6 +147,9 @@ int main() {
     PrintDocument(document);
   }
 
+  cout << "Plan:"s << endl
+       << search_server1.ExplainQuery("curly nasty cat -dog"s) << endl;
+
   mt19937 generator;
 
   const auto dictionary = GenerateDictionary(generator, 1000, 10);
@@ -144,6 +165,20 @@ int main() {
 
   TEST(seq);
   TEST(par);
+  TestBatch("batch"sv, search_server, queries,
+            [](const SearchServer &server, const vector<string> &queries,
+               QueryBatchResults &results) {
+              ProcessQueries(server, queries, results);
+            });
+  TestBatch("shared scan batch"sv, search_server, queries,
+            [](const SearchServer &server, const vector<string> &queries,
+               QueryBatchResults &results) {
+              ProcessQueriesSharedScan(server, queries, results);
+            });
+
+  search_server.Freeze();
+  Test("frozen seq"sv, search_server, queries, execution::seq);
+  cout << "Memory: "s << search_server.GetMemoryStats() << endl;
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "memory_stats.h"
+#include <string>
+
+void *CountingResource::do_allocate(size_t bytes, size_t alignment) {
+  void *p = upstream_->allocate(bytes, alignment);
+  bytes_.fetch_add(bytes, memory_order_relaxed);
+  blocks_.fetch_add(1, memory_order_relaxed);
+  return p;
+}
+
+void CountingResource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+  upstream_->deallocate(p, bytes, alignment);
+  bytes_.fetch_sub(bytes, memory_order_relaxed);
+  blocks_.fetch_sub(1, memory_order_relaxed);
+}
+
+MemoryUsage &MemoryUsage::operator+=(const MemoryUsage &other) {
+  bytes += other.bytes;
+  elements += other.elements;
+  return *this;
+}
+
+size_t MemoryStats::GetTotalBytes() const {
+  return vocabulary.bytes + postings.bytes + forward_index.bytes +
+         document_text.bytes + attributes.bytes + stop_words.bytes +
+         caches.bytes;
+}
+
+MemoryStats &MemoryStats::operator+=(const MemoryStats &other) {
+  vocabulary += other.vocabulary;
+  postings += other.postings;
+  forward_index += other.forward_index;
+  document_text += other.document_text;
+  attributes += other.attributes;
+  stop_words += other.stop_words;
+  caches += other.caches;
+  if (posting_list_lengths.size() < other.posting_list_lengths.size()) {
+    posting_list_lengths.resize(other.posting_list_lengths.size());
+  }
+  for (size_t i = 0; i < other.posting_list_lengths.size(); ++i) {
+    posting_list_lengths[i] += other.posting_list_lengths[i];
+  }
+  return *this;
+}
+
+ostream &operator<<(ostream &os, const MemoryUsage &usage) {
+  return os << usage.bytes << " B / "s << usage.elements;
+}
+
+ostream &operator<<(ostream &os, const MemoryStats &stats) {
+  os << "{ "s
+     << "vocabulary = "s << stats.vocabulary << ", "s
+     << "postings = "s << stats.postings << ", "s
+     << "forward_index = "s << stats.forward_index << ", "s
+     << "document_text = "s << stats.document_text << ", "s
+     << "attributes = "s << stats.attributes << ", "s
+     << "stop_words = "s << stats.stop_words << ", "s
+     << "caches = "s << stats.caches << ", "s
+     << "total = "s << stats.GetTotalBytes() << " B, "s
+     << "posting_list_lengths = ["s;
+  for (size_t i = 0; i < stats.posting_list_lengths.size(); ++i) {
+    os << (i > 0 ? " "s : ""s) << (size_t{1} << i) << ':'
+       << stats.posting_list_lengths[i];
+  }
+  return os << "] }"s;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <memory_resource>
+#include <vector>
+
+using namespace std;
+
+// Forwards to an upstream resource and keeps count of what is outstanding.
+// Counters are atomic, so containers on it may free memory from several
+// threads at once.
+class CountingResource : public pmr::memory_resource {
+public:
+  explicit CountingResource(pmr::memory_resource *upstream)
+      : upstream_(upstream) {}
+
+  [[nodiscard]] size_t GetBytes() const {
+    return bytes_.load(memory_order_relaxed);
+  }
+
+  [[nodiscard]] size_t GetBlocks() const {
+    return blocks_.load(memory_order_relaxed);
+  }
+
+private:
+  pmr::memory_resource *upstream_;
+  atomic<size_t> bytes_{0};
+  atomic<size_t> blocks_{0};
+
+  void *do_allocate(size_t bytes, size_t alignment) override;
+
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override;
+
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+struct MemoryUsage {
+  size_t bytes = 0;
+  size_t elements = 0;
+
+  MemoryUsage &operator+=(const MemoryUsage &other);
+};
+
+// Bytes requested by the index containers, so allocator overhead is not
+// included. Elements are words for the vocabulary and stop words, (word,
+// document) pairs for the postings and the forward index, documents for
+// attributes, separately allocated texts for document text and postings or
+// documents for caches.
+struct MemoryStats {
+  MemoryUsage vocabulary;
+  MemoryUsage postings;
+  MemoryUsage forward_index;
+  MemoryUsage document_text;
+  MemoryUsage attributes;
+  MemoryUsage stop_words;
+  MemoryUsage caches;
+  // posting_list_lengths[i] words are in [2^i, 2^(i+1)) documents
+  vector<size_t> posting_list_lengths;
+
+  [[nodiscard]] size_t GetTotalBytes() const;
+
+  MemoryStats &operator+=(const MemoryStats &other);
+};
+
+ostream &operator<<(ostream &os, const MemoryUsage &usage);
+
+ostream &operator<<(ostream &os, const MemoryStats &stats);
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Read-only map over a fixed set of strings that takes one hash of the key
+// and one entry read per lookup. Keys are split into buckets of a few, and
+// each bucket gets a pilot, found while building, that sends its keys to
+// slots no other key took (hash and displace); single key buckets take the
+// slots left over directly. So n keys fill exactly n entries. Each entry
+// keeps its key's full hash, which absent keys almost never match, so their
+// text is compared only for a likely hit.
+template <typename Value> class MinimalPerfectHash {
+public:
+  struct Entry {
+    uint64_t hash = 0;
+    // Views the caller's key, which must outlive the map
+    string_view key;
+    Value value{};
+  };
+
+  MinimalPerfectHash() = default;
+
+  // Throws invalid_argument if a key repeats
+  explicit MinimalPerfectHash(vector<pair<string_view, Value>> items);
+
+  // nullptr if key is not in the map
+  [[nodiscard]] const Entry *Find(string_view key) const;
+
+  [[nodiscard]] size_t GetSize() const { return entries_.size(); }
+
+  [[nodiscard]] size_t GetMemoryUsage() const {
+    return entries_.size() * sizeof(Entry) +
+           pilots_.size() * sizeof(uint32_t);
+  }
+
+private:
+  // Marks a pilot that holds the slot of its single key itself
+  static constexpr uint32_t DIRECT_SLOT = uint32_t{1} << 31;
+  static constexpr size_t KEYS_PER_BUCKET = 2;
+  static constexpr uint32_t MAX_PILOT = uint32_t{1} << 20;
+
+  vector<Entry> entries_;
+  vector<uint32_t> pilots_;
+  uint64_t seed_ = 0;
+
+  static uint64_t Mix(uint64_t hash) {
+    // Finalizer of SplitMix64
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+  }
+
+  uint64_t Hash(string_view key) const {
+    return Mix(hash<string_view>{}(key) ^ seed_);
+  }
+
+  size_t GetBucket(uint64_t hash) const {
+    return static_cast<size_t>(hash >> 32) % pilots_.size();
+  }
+
+  static size_t GetSlot(uint64_t hash, uint32_t pilot, size_t slot_count) {
+    if (pilot & DIRECT_SLOT) {
+      return pilot & ~DIRECT_SLOT;
+    }
+    return Mix(hash ^ (pilot * 0x9e3779b97f4a7c15ULL)) % slot_count;
+  }
+
+  // Fills hashes and the slot of every item, false if some bucket found no
+  // pilot
+  bool TryBuild(const vector<pair<string_view, Value>> &items,
+                vector<uint64_t> &hashes, vector<size_t> &slots);
+};
+
+template <typename Value>
+MinimalPerfectHash<Value>::MinimalPerfectHash(
+    vector<pair<string_view, Value>> items) {
+  if (items.size() >= DIRECT_SLOT) {
+    throw invalid_argument("Too many keys for a perfect hash");
+  }
+  sort(items.begin(), items.end(),
+       [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+  if (adjacent_find(items.begin(), items.end(),
+                    [](const auto &lhs, const auto &rhs) {
+                      return lhs.first == rhs.first;
+                    }) != items.end()) {
+    throw invalid_argument("Keys of a perfect hash must be distinct");
+  }
+  vector<uint64_t> hashes(items.size());
+  vector<size_t> slots(items.size());
+  // Distinct keys whose full hashes collide need another seed
+  while (!TryBuild(items, hashes, slots)) {
+    ++seed_;
+  }
+  entries_.resize(items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    entries_[slots[i]] = {hashes[i], items[i].first, move(items[i].second)};
+  }
+}
+
+template <typename Value>
+bool MinimalPerfectHash<Value>::TryBuild(
+    const vector<pair<string_view, Value>> &items, vector<uint64_t> &hashes,
+    vector<size_t> &slots) {
+  const size_t n = items.size();
+  pilots_.assign(max<size_t>(1, n / KEYS_PER_BUCKET), 0);
+  vector<vector<size_t>> buckets(pilots_.size());
+  for (size_t i = 0; i < n; ++i) {
+    hashes[i] = Hash(items[i].first);
+    buckets[GetBucket(hashes[i])].push_back(i);
+  }
+  // Largest buckets go first, while most slots are free
+  vector<size_t> order(buckets.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  stable_sort(order.begin(), order.end(), [&buckets](size_t lhs, size_t rhs) {
+    return buckets[lhs].size() > buckets[rhs].size();
+  });
+
+  vector<bool> taken(n);
+  size_t next_free = 0;
+  for (const size_t bucket : order) {
+    const vector<size_t> &keys = buckets[bucket];
+    if (keys.empty()) {
+      break;
+    }
+    if (keys.size() == 1) {
+      while (taken[next_free]) {
+        ++next_free;
+      }
+      pilots_[bucket] = DIRECT_SLOT | static_cast<uint32_t>(next_free);
+      taken[next_free] = true;
+      slots[keys[0]] = next_free;
+      continue;
+    }
+    uint32_t pilot = 0;
+    for (; pilot < MAX_PILOT; ++pilot) {
+      size_t placed = 0;
+      for (; placed < keys.size(); ++placed) {
+        const size_t slot = GetSlot(hashes[keys[placed]], pilot, n);
+        if (taken[slot]) {
+          break;
+        }
+        // Taken for now, so the bucket's own keys do not share a slot
+        taken[slot] = true;
+        slots[keys[placed]] = slot;
+      }
+      if (placed == keys.size()) {
+        break;
+      }
+      for (size_t i = 0; i < placed; ++i) {
+        taken[slots[keys[i]]] = false;
+      }
+    }
+    if (pilot == MAX_PILOT) {
+      return false;
+    }
+    pilots_[bucket] = pilot;
+  }
+  return true;
+}
+
+template <typename Value>
+auto MinimalPerfectHash<Value>::Find(string_view key) const -> const Entry * {
+  if (entries_.empty()) {
+    return nullptr;
+  }
+  const uint64_t hash = Hash(key);
+  const Entry &entry =
+      entries_[GetSlot(hash, pilots_[GetBucket(hash)], entries_.size())];
+  return entry.hash == hash && entry.key == key ? &entry : nullptr;
+}
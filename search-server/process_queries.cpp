@@ -1,29 +1,152 @@
 #include "process_queries.h"
-#include <execution>
-#include <numeric>
 
-vector<vector<Document>> ProcessQueries(const SearchServer &search_server,
-                                        const vector<string> &queries) {
+namespace {
+
+template <typename Query, typename Consumer>
+void VisitTopDocuments(const SearchServer &search_server, const Query &query,
+                       Consumer consumer) {
+  search_server.VisitTopDocuments(execution::seq, query,
+                                  DocumentStatus::ACTUAL, consumer);
+}
+
+template <typename Consumer>
+void VisitTopDocuments(const ShardedSearchServer &search_server,
+                       const string &query, Consumer consumer) {
+  const vector<Document> documents = search_server.FindTopDocuments(query);
+  consumer(documents.data(), documents.data() + documents.size());
+}
+
+template <typename Server>
+vector<vector<Document>> ProcessQueriesImpl(const Server &search_server,
+                                            const vector<string> &queries) {
   vector<vector<Document>> result(queries.size());
-  transform(execution::par, queries.begin(), queries.end(), result.begin(),
-            [&search_server](const string &raw_query) {
-              return search_server.FindTopDocuments(raw_query);
-            });
+  search_server.GetTaskScheduler().ParallelFor(
+      0, queries.size(), [&](size_t index) {
+        result[index] = search_server.FindTopDocuments(queries[index]);
+      });
   return result;
 }
 
+template <typename Server, typename Query>
+void ProcessQueriesFlatImpl(const Server &search_server,
+                            const vector<Query> &queries,
+                            QueryBatchResults &results) {
+  // Every query gets a slot of the largest possible size, then the slots
+  // are packed
+  results.documents.resize(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+  results.offsets.assign(queries.size() + 1, 0);
+  search_server.GetTaskScheduler().ParallelFor(
+      0, queries.size(), [&](size_t index) {
+        VisitTopDocuments(
+            search_server, queries[index],
+            [&](const Document *first, const Document *last) {
+              copy(first, last,
+                   results.documents.begin() +
+                       index * MAX_RESULT_DOCUMENT_COUNT);
+              results.offsets[index + 1] = last - first;
+            });
+      });
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const auto slot =
+        results.documents.begin() + i * MAX_RESULT_DOCUMENT_COUNT;
+    const size_t count = results.offsets[i + 1];
+    results.offsets[i + 1] = results.offsets[i] + count;
+    copy(slot, slot + count, results.documents.begin() + results.offsets[i]);
+  }
+  results.documents.resize(results.offsets.back());
+}
+
+template <typename Server, typename Query>
+void ProcessQueriesStreamingImpl(const Server &search_server,
+                                 const vector<Query> &queries,
+                                 const QueryResultsConsumer &consumer) {
+  search_server.GetTaskScheduler().ParallelFor(
+      0, queries.size(), [&](size_t index) {
+        VisitTopDocuments(search_server, queries[index],
+                          [&](const Document *first, const Document *last) {
+                            consumer(index, DocumentRange{first, last});
+                          });
+      });
+}
+
+template <typename Server>
+list<Document> ProcessQueriesJoinedImpl(const Server &search_server,
+                                        const vector<string> &queries) {
+  QueryBatchResults results;
+  ProcessQueriesFlatImpl(search_server, queries, results);
+  return {results.documents.begin(), results.documents.end()};
+}
+
+} // namespace
+
+DocumentRange QueryBatchResults::GetDocuments(size_t query_index) const {
+  return DocumentRange{documents.data() + offsets.at(query_index),
+                       documents.data() + offsets.at(query_index + 1)};
+}
+
+vector<vector<Document>> ProcessQueries(const SearchServer &search_server,
+                                        const vector<string> &queries) {
+  return ProcessQueriesImpl(search_server, queries);
+}
+
+vector<vector<Document>>
+ProcessQueries(const ShardedSearchServer &search_server,
+               const vector<string> &queries) {
+  return ProcessQueriesImpl(search_server, queries);
+}
+
+void ProcessQueries(const SearchServer &search_server,
+                    const vector<string> &queries, QueryBatchResults &results) {
+  ProcessQueriesFlatImpl(search_server, queries, results);
+}
+
+void ProcessQueries(const ShardedSearchServer &search_server,
+                    const vector<string> &queries, QueryBatchResults &results) {
+  ProcessQueriesFlatImpl(search_server, queries, results);
+}
+
+void ProcessQueries(const SearchServer &search_server,
+                    const vector<PreparedQuery> &queries,
+                    QueryBatchResults &results) {
+  ProcessQueriesFlatImpl(search_server, queries, results);
+}
+
+void ProcessQueriesSharedScan(const SearchServer &search_server,
+                              const vector<string> &queries,
+                              QueryBatchResults &results) {
+  results.documents.clear();
+  results.offsets.assign(1, 0);
+  search_server.VisitTopDocumentsBatch(
+      queries, [&results](size_t, const Document *first, const Document *last) {
+        results.documents.insert(results.documents.end(), first, last);
+        results.offsets.push_back(results.documents.size());
+      });
+}
+
+void ProcessQueriesStreaming(const SearchServer &search_server,
+                             const vector<string> &queries,
+                             const QueryResultsConsumer &consumer) {
+  ProcessQueriesStreamingImpl(search_server, queries, consumer);
+}
+
+void ProcessQueriesStreaming(const ShardedSearchServer &search_server,
+                             const vector<string> &queries,
+                             const QueryResultsConsumer &consumer) {
+  ProcessQueriesStreamingImpl(search_server, queries, consumer);
+}
+
+void ProcessQueriesStreaming(const SearchServer &search_server,
+                             const vector<PreparedQuery> &queries,
+                             const QueryResultsConsumer &consumer) {
+  ProcessQueriesStreamingImpl(search_server, queries, consumer);
+}
+
 list<Document> ProcessQueriesJoined(const SearchServer &search_server,
                                     const std::vector<std::string> &queries) {
+  return ProcessQueriesJoinedImpl(search_server, queries);
+}
 
-  return transform_reduce(
-      execution::par, queries.begin(), queries.end(), list<Document>{},
-      [](list<Document> list1, list<Document> list2) {
-        list1.splice(list1.end(), list2);
-        return list1;
-      },
-      [&search_server](const string &raw_query) {
-        auto doc_vec = search_server.FindTopDocuments(raw_query);
-        return list<Document>{make_move_iterator(doc_vec.begin()),
-                              make_move_iterator(doc_vec.end())};
-      });
-}
\ No newline at end of file
+list<Document> ProcessQueriesJoined(const ShardedSearchServer &search_server,
+                                    const std::vector<std::string> &queries) {
+  return ProcessQueriesJoinedImpl(search_server, queries);
+}
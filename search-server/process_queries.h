@@ -1,14 +1,74 @@
 #pragma once
 #include "document.h"
+#include "paginator.h"
 #include "search_server.h"
+#include "sharded_search_server.h"
+#include <functional>
 #include <list>
 #include <string>
 #include <vector>
 
 using namespace std;
 
+using DocumentRange = IteratorRange<const Document *>;
+
+// Results of a batch of queries back to back in one buffer: query i found
+// documents[offsets[i]] .. documents[offsets[i + 1]]. Passing the same
+// object to the next batch reuses its memory.
+struct QueryBatchResults {
+  vector<Document> documents;
+  vector<size_t> offsets;
+
+  [[nodiscard]] size_t GetQueryCount() const {
+    return offsets.empty() ? 0 : offsets.size() - 1;
+  }
+
+  [[nodiscard]] DocumentRange GetDocuments(size_t query_index) const;
+};
+
+// Called with the index of a query and its results, which are only valid
+// during the call
+using QueryResultsConsumer = function<void(size_t, DocumentRange)>;
+
 vector<vector<Document>> ProcessQueries(const SearchServer &search_server,
                                         const vector<string> &queries);
 
+vector<vector<Document>>
+ProcessQueries(const ShardedSearchServer &search_server,
+               const vector<string> &queries);
+
+void ProcessQueries(const SearchServer &search_server,
+                    const vector<string> &queries, QueryBatchResults &results);
+
+void ProcessQueries(const ShardedSearchServer &search_server,
+                    const vector<string> &queries, QueryBatchResults &results);
+
+void ProcessQueries(const SearchServer &search_server,
+                    const vector<PreparedQuery> &queries,
+                    QueryBatchResults &results);
+
+// Same results as ProcessQueries with every posting list the batch needs
+// read once, see SearchServer::VisitTopDocumentsBatch
+void ProcessQueriesSharedScan(const SearchServer &search_server,
+                              const vector<string> &queries,
+                              QueryBatchResults &results);
+
+// Hands each query's results to consumer as soon as they are ready, on the
+// thread that ran the query; calls for different queries may overlap
+void ProcessQueriesStreaming(const SearchServer &search_server,
+                             const vector<string> &queries,
+                             const QueryResultsConsumer &consumer);
+
+void ProcessQueriesStreaming(const ShardedSearchServer &search_server,
+                             const vector<string> &queries,
+                             const QueryResultsConsumer &consumer);
+
+void ProcessQueriesStreaming(const SearchServer &search_server,
+                             const vector<PreparedQuery> &queries,
+                             const QueryResultsConsumer &consumer);
+
 list<Document> ProcessQueriesJoined(const SearchServer &search_server,
                                     const std::vector<std::string> &queries);
+
+list<Document> ProcessQueriesJoined(const ShardedSearchServer &search_server,
+                                    const std::vector<std::string> &queries);
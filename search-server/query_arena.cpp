@@ -0,0 +1,75 @@
+#include "query_arena.h"
+#include <optional>
+#include <vector>
+
+namespace {
+
+const size_t INITIAL_ARENA_SIZE = 64 * 1024;
+
+// Counts what the arena had to take from the heap beyond its buffer
+class OverflowCountingResource : public pmr::memory_resource {
+public:
+  size_t overflow_bytes = 0;
+
+private:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    overflow_bytes += bytes;
+    return pmr::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+    pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+};
+
+struct ThreadArena {
+  vector<byte> buffer;
+  OverflowCountingResource upstream;
+  optional<pmr::monotonic_buffer_resource> resource;
+  int depth = 0;
+
+  void Reset(size_t size) {
+    resource.reset();
+    buffer.assign(size, byte{});
+    resource.emplace(buffer.data(), buffer.size(), &upstream);
+    upstream.overflow_bytes = 0;
+  }
+};
+
+ThreadArena &GetThreadArena() {
+  thread_local ThreadArena arena;
+  return arena;
+}
+
+} // namespace
+
+QueryArenaScope::QueryArenaScope() {
+  ThreadArena &arena = GetThreadArena();
+  if (arena.depth++ > 0) {
+    return;
+  }
+  if (!arena.resource) {
+    arena.Reset(INITIAL_ARENA_SIZE);
+  } else if (arena.upstream.overflow_bytes > 0) {
+    arena.Reset(2 * (arena.buffer.size() + arena.upstream.overflow_bytes));
+  }
+}
+
+QueryArenaScope::~QueryArenaScope() {
+  ThreadArena &arena = GetThreadArena();
+  if (--arena.depth == 0) {
+    arena.resource->release();
+  }
+}
+
+pmr::memory_resource *QueryArenaScope::GetResource() const {
+  return &*GetThreadArena().resource;
+}
+
+size_t QueryArenaScope::GetBufferSize() {
+  return GetThreadArena().buffer.size();
+}
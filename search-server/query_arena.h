@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory_resource>
+
+using namespace std;
+
+// Scratch memory for the temporaries of one query on the current thread.
+// Scopes may nest, e.g. when a thread waiting inside a parallel query runs
+// another query; everything is released when the outermost scope ends. If a
+// query did not fit into the preallocated buffer, the buffer grows before
+// the next one, so in steady state queries do not touch the heap.
+//
+// The resource is not thread-safe: only the thread that opened the scope
+// may allocate from it.
+class QueryArenaScope {
+public:
+  QueryArenaScope();
+
+  QueryArenaScope(const QueryArenaScope &) = delete;
+  QueryArenaScope &operator=(const QueryArenaScope &) = delete;
+
+  ~QueryArenaScope();
+
+  [[nodiscard]] pmr::memory_resource *GetResource() const;
+
+  // Size of the calling thread's preallocated buffer
+  [[nodiscard]] static size_t GetBufferSize();
+};
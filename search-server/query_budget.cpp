@@ -0,0 +1,23 @@
+#include "query_budget.h"
+
+size_t QueryBudgetTracker::Reserve(size_t postings) {
+  if (IsExhausted()) {
+    return 0;
+  }
+  if (budget_.cancellation.IsCancelled() ||
+      (budget_.deadline && chrono::steady_clock::now() >= *budget_.deadline)) {
+    exhausted_.store(true, memory_order_relaxed);
+    return 0;
+  }
+  size_t charged = postings_.load(memory_order_relaxed);
+  size_t granted = 0;
+  do {
+    granted = min(postings, budget_.max_postings - charged);
+  } while (granted > 0 &&
+           !postings_.compare_exchange_weak(charged, charged + granted,
+                                            memory_order_relaxed));
+  if (granted == 0) {
+    exhausted_.store(true, memory_order_relaxed);
+  }
+  return granted;
+}
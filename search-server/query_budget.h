@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "document.h"
+
+using namespace std;
+
+// Shared flag to stop queries from another thread; copies trip the same flag
+class CancellationToken {
+public:
+  CancellationToken() : cancelled_(make_shared<atomic<bool>>(false)) {}
+
+  void Cancel() const { cancelled_->store(true, memory_order_relaxed); }
+
+  [[nodiscard]] bool IsCancelled() const {
+    return cancelled_->load(memory_order_relaxed);
+  }
+
+private:
+  shared_ptr<atomic<bool>> cancelled_;
+};
+
+// Limits of one query. They are checked between blocks of postings, so a
+// query may overrun its deadline by one block; it never scans more than
+// max_postings plus-word postings. Minus words are always applied in full.
+struct QueryBudget {
+  optional<chrono::steady_clock::time_point> deadline;
+  size_t max_postings = numeric_limits<size_t>::max();
+  CancellationToken cancellation;
+};
+
+struct QueryResults {
+  vector<Document> documents;
+  // The budget ran out or the query was cancelled, so documents are the best
+  // of those scored so far and their relevance may be partial
+  bool truncated = false;
+};
+
+// Postings scanned between checks of the deadline and the token
+const size_t BUDGET_CHECK_POSTINGS = 1024;
+
+// Work of one query measured against its budget, shared by all threads
+// running the query
+class QueryBudgetTracker {
+public:
+  explicit QueryBudgetTracker(const QueryBudget &budget) : budget_(budget) {}
+
+  // Reserves up to postings about to be scanned and returns how many may
+  // be, fewer once max_postings is near. Returns 0 once the query must stop,
+  // which marks it exhausted.
+  size_t Reserve(size_t postings);
+
+  [[nodiscard]] bool IsExhausted() const {
+    return exhausted_.load(memory_order_relaxed);
+  }
+
+private:
+  const QueryBudget &budget_;
+  atomic<size_t> postings_{0};
+  atomic<bool> exhausted_{false};
+};
+
+// Per-thread view of a tracker, reserves a block of postings at a time but
+// never more than the expected_postings its scan can take, so meters of one
+// query do not hold budget they leave unused. Without a tracker every
+// posting is allowed.
+class BudgetMeter {
+public:
+  explicit BudgetMeter(QueryBudgetTracker *tracker,
+                       size_t expected_postings = numeric_limits<size_t>::max())
+      : tracker_(tracker), unreserved_(expected_postings) {}
+
+  bool Advance(size_t postings = 1) {
+    if (!tracker_) {
+      return true;
+    }
+    while (left_ < postings) {
+      const size_t wanted =
+          max(postings - left_, min(BUDGET_CHECK_POSTINGS, unreserved_));
+      const size_t granted = tracker_->Reserve(wanted);
+      if (granted == 0) {
+        return false;
+      }
+      left_ += granted;
+      unreserved_ -= min(unreserved_, granted);
+    }
+    left_ -= postings;
+    return true;
+  }
+
+private:
+  QueryBudgetTracker *tracker_;
+  size_t unreserved_;
+  size_t left_ = 0;
+};
@@ -0,0 +1,63 @@
+#include "query_plan.h"
+
+namespace {
+
+void PrintTerms(ostream &os, const vector<QueryPlanTerm> &terms) {
+  os << '[';
+  for (size_t i = 0; i < terms.size(); ++i) {
+    os << (i > 0 ? " "s : ""s) << terms[i].word << ':'
+       << terms[i].document_frequency;
+  }
+  os << ']';
+}
+
+void PrintWords(ostream &os, const vector<string> &words) {
+  os << '[';
+  for (size_t i = 0; i < words.size(); ++i) {
+    os << (i > 0 ? " "s : ""s) << words[i];
+  }
+  os << ']';
+}
+
+} // namespace
+
+ostream &operator<<(ostream &os, QueryStrategy strategy) {
+  switch (strategy) {
+  case QueryStrategy::TERM_AT_A_TIME:
+    return os << "TERM_AT_A_TIME"s;
+  case QueryStrategy::DOCUMENT_AT_A_TIME:
+    return os << "DOCUMENT_AT_A_TIME"s;
+  case QueryStrategy::PARALLEL:
+    return os << "PARALLEL"s;
+  }
+  return os;
+}
+
+ostream &operator<<(ostream &os, MinusWordsStrategy strategy) {
+  switch (strategy) {
+  case MinusWordsStrategy::NONE:
+    return os << "NONE"s;
+  case MinusWordsStrategy::PROBE_POSTINGS:
+    return os << "PROBE_POSTINGS"s;
+  case MinusWordsStrategy::COLLECT_DOCUMENTS:
+    return os << "COLLECT_DOCUMENTS"s;
+  }
+  return os;
+}
+
+ostream &operator<<(ostream &os, const QueryPlan &plan) {
+  os << "{ "s
+     << "strategy = "s << plan.strategy << ", "s
+     << "minus_words = "s << plan.minus_words_strategy << ", "s
+     << "plus_postings = "s << plan.plus_postings << ", "s
+     << "minus_postings = "s << plan.minus_postings << ", "s
+     << "plus = "s;
+  PrintTerms(os, plan.plus_terms);
+  os << ", minus = "s;
+  PrintTerms(os, plan.minus_terms);
+  os << ", missing = "s;
+  PrintWords(os, plan.missing_words);
+  os << ", demoted = "s;
+  PrintWords(os, plan.demoted_words);
+  return os << " }"s;
+}
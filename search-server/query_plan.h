@@ -0,0 +1,52 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class QueryStrategy {
+  // Accumulates relevance term by term, rarest term first
+  TERM_AT_A_TIME,
+  // Merges the postings of a few terms in document id order
+  DOCUMENT_AT_A_TIME,
+  // Fans plus and minus words out to the task scheduler
+  PARALLEL
+};
+
+enum class MinusWordsStrategy {
+  NONE,
+  // Looks every candidate up in the postings of the minus words
+  PROBE_POSTINGS,
+  // Collects the documents of all minus words up front
+  COLLECT_DOCUMENTS
+};
+
+struct QueryPlanTerm {
+  string word;
+  size_t document_frequency = 0;
+};
+
+// How SearchServer would run a query, see SearchServer::ExplainQuery
+struct QueryPlan {
+  QueryStrategy strategy = QueryStrategy::TERM_AT_A_TIME;
+  MinusWordsStrategy minus_words_strategy = MinusWordsStrategy::NONE;
+  // Words found in the index, in evaluation order
+  vector<QueryPlanTerm> plus_terms;
+  vector<QueryPlanTerm> minus_terms;
+  // Plus words no document contains, they cost nothing
+  vector<string> missing_words;
+  // Plus words left out because they are demoted, see
+  // SearchServer::PruneFrequentWords
+  vector<string> demoted_words;
+  // Postings an exhaustive evaluation reads
+  size_t plus_postings = 0;
+  size_t minus_postings = 0;
+};
+
+ostream &operator<<(ostream &os, QueryStrategy strategy);
+
+ostream &operator<<(ostream &os, MinusWordsStrategy strategy);
+
+ostream &operator<<(ostream &os, const QueryPlan &plan);
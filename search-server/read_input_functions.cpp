@@ -1 +1,182 @@
 #include "read_input_functions.h"
+#include <cerrno>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+size_t PageAlignDown(size_t offset) {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  return offset / page_size * page_size;
+}
+
+int ParseInt(string_view text) {
+  int value = 0;
+  const auto [end, error] =
+      from_chars(text.data(), text.data() + text.size(), value);
+  if (error != errc{} || end != text.data() + text.size()) {
+    throw invalid_argument("Not a number: "s + string{text});
+  }
+  return value;
+}
+
+DocumentStatus ParseStatus(string_view text) {
+  static const pair<string_view, DocumentStatus> names[] = {
+      {"ACTUAL"sv, DocumentStatus::ACTUAL},
+      {"IRRELEVANT"sv, DocumentStatus::IRRELEVANT},
+      {"BANNED"sv, DocumentStatus::BANNED},
+      {"REMOVED"sv, DocumentStatus::REMOVED}};
+  for (const auto &[name, status] : names) {
+    if (text == name) {
+      return status;
+    }
+  }
+  const int value = ParseInt(text);
+  if (value < 0 || value > static_cast<int>(DocumentStatus::REMOVED)) {
+    throw invalid_argument("Unknown document status: "s + string{text});
+  }
+  return static_cast<DocumentStatus>(value);
+}
+
+string_view NextField(string_view &line) {
+  const size_t tab = line.find('\t');
+  if (tab == string_view::npos) {
+    throw invalid_argument("Record must have 4 tab-separated fields");
+  }
+  const string_view field = line.substr(0, tab);
+  line.remove_prefix(tab + 1);
+  return field;
+}
+
+} // namespace
+
+MappedFile::MappedFile(const string &path, FileAccess access) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw system_error(errno, generic_category(), "open " + path);
+  }
+  struct stat info {};
+  if (fstat(fd, &info) < 0) {
+    const int error = errno;
+    close(fd);
+    throw system_error(error, generic_category(), "fstat " + path);
+  }
+  size_ = info.st_size;
+  if (size_ > 0) {
+    void *data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      const int error = errno;
+      close(fd);
+      throw system_error(error, generic_category(), "mmap " + path);
+    }
+    data_ = static_cast<const char *>(data);
+    madvise(data, size_,
+            access == FileAccess::SEQUENTIAL ? MADV_SEQUENTIAL : MADV_RANDOM);
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) {
+    munmap(const_cast<char *>(data_), size_);
+  }
+}
+
+void MappedFile::Prefetch(size_t offset, size_t length) const {
+  if (offset >= size_) {
+    return;
+  }
+  const size_t start = PageAlignDown(offset);
+  length = min(length + offset - start, size_ - start);
+  madvise(const_cast<char *>(data_) + start, length, MADV_WILLNEED);
+}
+
+void MappedFile::Release(size_t offset, size_t length) const {
+  if (offset >= size_) {
+    return;
+  }
+  const size_t start = PageAlignDown(offset);
+  length = min(length + offset - start, size_ - start);
+  madvise(const_cast<char *>(data_) + start, length, MADV_DONTNEED);
+}
+
+DocumentRecord ParseDocumentRecord(string_view line) {
+  DocumentRecord record;
+  record.id = ParseInt(NextField(line));
+  record.status = ParseStatus(NextField(line));
+  string_view ratings = NextField(line);
+  long long sum = 0;
+  int count = 0;
+  while (!ratings.empty()) {
+    const size_t end = ratings.find_first_of(" ,");
+    const string_view rating = ratings.substr(0, end);
+    if (!rating.empty()) {
+      sum += ParseInt(rating);
+      ++count;
+    }
+    ratings.remove_prefix(end == string_view::npos ? ratings.size() : end + 1);
+  }
+  record.rating = count == 0 ? 0 : static_cast<int>(sum / count);
+  record.text = line;
+  return record;
+}
+
+size_t LoadCorpus(SearchServer &search_server, const string &path,
+                  const CorpusLoadOptions &options) {
+  auto file = make_shared<MappedFile>(path);
+  const string_view contents = file->GetContents();
+  if (options.storage == TextStorage::REFERENCE) {
+    search_server.RetainExternalStorage(file);
+  }
+
+  size_t loaded = 0, line_number = 0;
+  size_t chunk_begin = 0;
+  vector<DocumentRecord> records;
+  while (chunk_begin < contents.size()) {
+    size_t chunk_end = min(contents.size(),
+                           chunk_begin + max<size_t>(options.chunk_size, 1));
+    chunk_end = contents.find('\n', chunk_end == 0 ? 0 : chunk_end - 1);
+    chunk_end = chunk_end == string_view::npos ? contents.size() : chunk_end + 1;
+    file->Prefetch(chunk_end, options.chunk_size);
+
+    records.clear();
+    string_view chunk = contents.substr(chunk_begin, chunk_end - chunk_begin);
+    while (!chunk.empty()) {
+      const size_t newline = chunk.find('\n');
+      string_view line = chunk.substr(0, newline);
+      chunk.remove_prefix(newline == string_view::npos ? chunk.size()
+                                                       : newline + 1);
+      ++line_number;
+      if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+      }
+      if (line.empty()) {
+        continue;
+      }
+      if (options.format == CorpusFormat::LINES) {
+        records.push_back({options.first_id + static_cast<int>(loaded +
+                                                               records.size()),
+                           line, DocumentStatus::ACTUAL, 0});
+        continue;
+      }
+      try {
+        records.push_back(ParseDocumentRecord(line));
+      } catch (const invalid_argument &e) {
+        throw invalid_argument(path + ":"s + to_string(line_number) + ": "s +
+                               e.what());
+      }
+    }
+    search_server.AddDocuments(execution::par, records, options.storage);
+    loaded += records.size();
+    // Copied text is no longer needed in memory
+    if (options.storage == TextStorage::COPY) {
+      file->Release(chunk_begin, chunk_end - chunk_begin);
+    }
+    chunk_begin = chunk_end;
+  }
+  return loaded;
+}
@@ -7,3 +7,55 @@
 
 using namespace std;
 
+enum class FileAccess { SEQUENTIAL, RANDOM };
+
+// Read-only memory mapping of a whole file, access tells the kernel how far
+// to read ahead
+class MappedFile {
+public:
+  explicit MappedFile(const string &path,
+                      FileAccess access = FileAccess::SEQUENTIAL);
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile();
+
+  [[nodiscard]] string_view GetContents() const { return {data_, size_}; }
+
+  // Asks the kernel to start reading the range in the background
+  void Prefetch(size_t offset, size_t length) const;
+
+  // Tells the kernel the range may be dropped from the page cache
+  void Release(size_t offset, size_t length) const;
+
+private:
+  const char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+enum class CorpusFormat {
+  // One document text per line, ids are assigned consecutively
+  LINES,
+  // id<TAB>status<TAB>ratings<TAB>text per line, status is a number or a
+  // name such as ACTUAL, ratings are separated by spaces or commas
+  RECORDS
+};
+
+struct CorpusLoadOptions {
+  CorpusFormat format = CorpusFormat::LINES;
+  int first_id = 0;
+  // Bytes parsed and indexed at once, the next chunk is prefetched meanwhile
+  size_t chunk_size = 64 << 20;
+  TextStorage storage = TextStorage::REFERENCE;
+};
+
+// Maps the file and adds every document in it, returns how many were added.
+// With TextStorage::REFERENCE the documents keep pointing into the mapping,
+// which the server retains. Loading is not atomic: each chunk is added as a
+// whole or not at all, but a malformed or rejected record throws after the
+// chunks before its own were added, and their documents stay.
+size_t LoadCorpus(SearchServer &search_server, const string &path,
+                  const CorpusLoadOptions &options = {});
+
+DocumentRecord ParseDocumentRecord(string_view line);
@@ -1,24 +1,10 @@
 #include "request_queue.h"
 
-RequestQueue::RequestQueue(const SearchServer &search_server)
-    : search_server_{search_server}, empty_requests_{0}, current_time_{0} {}
+RequestStatistics::RequestStatistics() : empty_requests_{0}, current_time_{0} {}
 
-vector<Document> RequestQueue::AddFindRequest(const string &raw_query,
-                                              DocumentStatus status) {
-  const auto result = search_server_.FindTopDocuments(raw_query, status);
-  AddRequest(result.size());
-  return result;
-}
-
-vector<Document> RequestQueue::AddFindRequest(const string &raw_query) {
-  const auto result = search_server_.FindTopDocuments(raw_query);
-  AddRequest(result.size());
-  return result;
-}
-
-int RequestQueue::GetNoResultRequests() const { return empty_requests_; }
+int RequestStatistics::GetNoResultRequests() const { return empty_requests_; }
 
-void RequestQueue::AddRequest(int results_num) {
+void RequestStatistics::AddRequest(int results_num) {
   ++current_time_;
   while (!requests_.empty() &&
          min_in_day_ <= current_time_ - requests_.front().timestamp) {
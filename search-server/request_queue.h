@@ -4,23 +4,17 @@
 #include "search_server.h"
 #include <deque>
 
-class RequestQueue {
+// Counts requests without results over the last day of requests
+class RequestStatistics {
 public:
-  explicit RequestQueue(const SearchServer &search_server);
-
-  template <typename DocumentFilter>
-  vector<Document> AddFindRequest(const string &raw_query,
-                                  DocumentFilter doc_filter);
-
-  vector<Document> AddFindRequest(const string &raw_query,
-                                  DocumentStatus status);
+  int GetNoResultRequests() const;
 
-  vector<Document> AddFindRequest(const string &raw_query);
+protected:
+  RequestStatistics();
 
-  int GetNoResultRequests() const;
+  void AddRequest(int results_num);
 
 private:
-  const SearchServer &search_server_;
   struct QueryResult {
     int result_size;
     uint64_t timestamp;
@@ -29,14 +23,38 @@ private:
   int empty_requests_;
   uint64_t current_time_;
   const static int min_in_day_ = 1440;
+};
 
-  void AddRequest(int results_num);
+// Works with any server exposing FindTopDocuments, e.g. ShardedSearchServer
+template <typename Server = SearchServer>
+class RequestQueue : public RequestStatistics {
+public:
+  explicit RequestQueue(const Server &search_server)
+      : search_server_{search_server} {}
+
+  template <typename DocumentFilter>
+  vector<Document> AddFindRequest(const string &raw_query,
+                                  DocumentFilter doc_filter);
+
+  vector<Document> AddFindRequest(const string &raw_query);
+
+private:
+  const Server &search_server_;
 };
 
+template <typename Server>
 template <typename DocumentFilter>
-vector<Document> RequestQueue::AddFindRequest(const string &raw_query,
-                                              DocumentFilter doc_filter) {
+vector<Document>
+RequestQueue<Server>::AddFindRequest(const string &raw_query,
+                                     DocumentFilter doc_filter) {
   const auto result = search_server_.FindTopDocuments(raw_query, doc_filter);
   AddRequest(result.size());
   return result;
-}
\ No newline at end of file
+}
+
+template <typename Server>
+vector<Document> RequestQueue<Server>::AddFindRequest(const string &raw_query) {
+  const auto result = search_server_.FindTopDocuments(raw_query);
+  AddRequest(result.size());
+  return result;
+}
@@ -1,59 +1,622 @@
 #include "search_server.h"
+#include "levenshtein_automaton.h"
 #include "string_processing.h"
+#include <bitset>
 #include <list>
 #include <numeric>
 
-SearchServer::SearchServer(const string &stopwords) {
-  for (auto word : SplitIntoWords(stopwords)) {
-    if (!word.empty()) {
-      if (ContainsSpecialChars(word)) {
-        throw invalid_argument(
-            "Special characters are not allowed in stop-words");
-      } else {
-        stop_words_.insert(string{word});
-      }
-    }
-  };
+namespace {
+
+// Merging more cursors per document costs more than accumulating
+const size_t DOCUMENT_AT_A_TIME_MAX_TERMS = 4;
+// Fanning out smaller queries costs more than it saves
+const size_t PARALLEL_MIN_POSTINGS = 1 << 15;
+// Lighter words of a document add candidates more than they change scores
+const size_t SIMILAR_DOCUMENT_MAX_TERMS = 24;
+// Shorter posting lists are cheaper to read than a sketch is to merge
+const size_t HIT_COUNT_SKETCH_MIN_POSTINGS = 1 << 10;
+// Bits per document a hit count bitmap may take before ids are sorted instead
+const size_t HIT_COUNT_BITMAP_MAX_BITS_PER_DOCUMENT = 64;
+// Bitmap words per posting beyond which sorting a query's few postings costs
+// less than clearing and counting the bitmap
+const size_t HIT_COUNT_BITMAP_MAX_WORDS_PER_POSTING = 16;
+
+// Posting list of a batch and the queries adding from it
+struct SharedTerm {
+  const pmr::map<int, double> *postings;
+  string_view word;
+  // Index of the query and its factor for the word
+  vector<pair<size_t, double>> users;
+};
+
+// Bucket of MemoryStats::posting_list_lengths, length must not be 0
+size_t GetLengthBucket(size_t length) {
+  size_t bucket = 0;
+  while ((length >> (bucket + 1)) > 0) {
+    ++bucket;
+  }
+  return bucket;
 }
 
-SearchServer::SearchServer(string_view stopwords) {
+// A node per entry and a bucket array
+template <typename HashMap>
+MemoryUsage EstimateHashMapUsage(const HashMap &map) {
+  return {map.size() * (sizeof(*map.begin()) + 2 * sizeof(void *)) +
+              map.bucket_count() * sizeof(void *),
+          map.size()};
+}
+
+} // namespace
+
+SearchServer::SearchServer(const SearchServerOptions &options)
+    : resources_(make_unique<ComponentResources>(options.memory_resource)),
+      storage_profile_(options.storage_profile),
+      dictionary_(&resources_->vocabulary),
+      word_to_docs_freq_(&resources_->postings),
+      doc_to_words_freq_(&resources_->forward_index),
+      documents_(&resources_->attributes),
+      stop_words_(&resources_->stop_words),
+      documents_ids_(&resources_->attributes),
+      demoted_words_(&resources_->vocabulary) {}
+
+SearchServer::SearchServer(const string &stopwords,
+                           const SearchServerOptions &options)
+    : SearchServer(string_view{stopwords}, options) {}
+
+SearchServer::SearchServer(string_view stopwords,
+                           const SearchServerOptions &options)
+    : SearchServer(options) {
   for (auto word : SplitIntoWords(stopwords)) {
     if (!word.empty()) {
       if (ContainsSpecialChars(word)) {
         throw invalid_argument(
             "Special characters are not allowed in stop-words");
       } else {
-        stop_words_.insert(string{word});
+        stop_words_.emplace(word);
       }
     }
   };
 }
 
 bool SearchServer::SetStopWords(string_view text) {
+  frozen_terms_.reset();
+  vector<string_view> indexed_words;
   for (auto word : SplitIntoWords(text)) {
-    stop_words_.insert(string{word});
+    stop_words_.emplace(word);
+    if (const auto it = word_to_docs_freq_.find(word);
+        it != word_to_docs_freq_.end()) {
+      indexed_words.push_back(it->first);
+    }
   }
+  sort(indexed_words.begin(), indexed_words.end());
+  indexed_words.erase(unique(indexed_words.begin(), indexed_words.end()),
+                      indexed_words.end());
+  RemoveWordsFromIndex(indexed_words);
   return true;
 }
 
+size_t SearchServer::PruneFrequentWords(double max_document_ratio,
+                                        PruningMode mode) {
+  if (!(max_document_ratio > 0 && max_document_ratio <= 1)) {
+    throw invalid_argument("Document ratio must be within (0, 1]");
+  }
+  const double max_documents = max_document_ratio * documents_.size();
+  vector<string_view> frequent_words;
+  for (const auto &[word, docs] : word_to_docs_freq_) {
+    if (docs.size() > max_documents) {
+      frequent_words.push_back(word);
+    }
+  }
+  if (mode == PruningMode::DEMOTE) {
+    demoted_words_.insert(frequent_words.begin(), frequent_words.end());
+    ++generation_;
+  } else {
+    for (string_view word : frequent_words) {
+      stop_words_.emplace(word);
+    }
+    RemoveWordsFromIndex(frequent_words);
+  }
+  return frequent_words.size();
+}
+
+void SearchServer::EnableFuzzySearch(const FuzzySearchParams &params) {
+  CheckFuzzySearchParams(params);
+  fuzzy_params_ = params;
+}
+
+void SearchServer::CheckFuzzySearchParams(const FuzzySearchParams &params) {
+  if (params.max_edits < 0 || params.max_edits > 2) {
+    throw invalid_argument("Fuzzy search supports from 0 to 2 edits");
+  }
+  if (params.edit_penalty <= 0 || params.edit_penalty > 1) {
+    throw invalid_argument("Edit penalty must be within (0, 1]");
+  }
+}
+
+void SearchServer::SetTaskScheduler(shared_ptr<TaskScheduler> scheduler) {
+  if (!scheduler) {
+    throw invalid_argument("Task scheduler is required");
+  }
+  scheduler_ = move(scheduler);
+}
+
 void SearchServer::AddDocument(int document_id, string_view document,
                                DocumentStatus status,
                                const vector<int> &ratings) {
+  CheckNewDocument(document_id, document);
+  IndexDocument(document_id,
+                {document_id, document, status, ComputeAverageRating(ratings)},
+                TextStorage::COPY, ComputeWordFrequencies(document));
+}
+
+void SearchServer::AddDocument(int document_id,
+                               const vector<DocumentField> &fields,
+                               DocumentStatus status,
+                               const vector<int> &ratings) {
+  string text;
+  for (const DocumentField &field : fields) {
+    if (&field != &fields.front()) {
+      text += ' ';
+    }
+    text += field.text;
+  }
+  CheckNewDocument(document_id, text);
+  IndexDocument(document_id,
+                {document_id, text, status, ComputeAverageRating(ratings)},
+                TextStorage::COPY, ComputeWordFrequencies(text));
+
+  vector<vector<string_view>> field_words;
+  size_t word_count = 0;
+  for (const DocumentField &field : fields) {
+    field_words.push_back(SplitIntoWordsNoStop(field.text));
+    word_count += field_words.back().size();
+  }
+  const double inv_freq = 1.0 / word_count;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    auto &word_to_docs_freq = fields_[FindOrAddField(fields[i].name)]
+                                  .word_to_docs_freq;
+    for (string_view word : field_words[i]) {
+      // Interned when the document was indexed
+      auto &docs = word_to_docs_freq[*dictionary_.find(word)];
+      const auto [it, inserted] = docs.try_emplace(document_id, 0.0);
+      it->second += inv_freq;
+      field_posting_count_ += inserted;
+    }
+  }
+}
+
+void SearchServer::UpdateDocument(int document_id, string_view document,
+                                  DocumentStatus status,
+                                  const vector<int> &ratings) {
+  DocumentData &data = documents_.at(document_id);
+  if (ContainsSpecialChars(document)) {
+    throw invalid_argument("Either document ID or content is incorrect");
+  }
+  if (!fields_.empty()) {
+    // The new text has no fields
+    RemoveFieldPostings(document_id, CollectDocumentWords(document_id));
+  }
+  // Words view document, which may be the stored text being replaced
+  if (UpdatePostings(document_id, ComputeWordFrequencies(document))) {
+    OnIndexChanged();
+  }
+  if (storage_profile_ == StorageProfile::FULL) {
+    data.stored_text = document;
+    data.text = data.stored_text;
+  } else {
+    data.text = {};
+  }
+  data.status = status;
+  data.rating = ComputeAverageRating(ratings);
+}
+
+void SearchServer::SetDocumentStatus(int document_id, DocumentStatus status) {
+  documents_.at(document_id).status = status;
+}
+
+void SearchServer::SetDocumentRating(int document_id,
+                                     const vector<int> &ratings) {
+  documents_.at(document_id).rating = ComputeAverageRating(ratings);
+}
+
+void SearchServer::AddDocuments(const vector<DocumentRecord> &records,
+                                TextStorage storage) {
+  AddDocuments(execution::seq, records, storage);
+}
+
+void SearchServer::AddDocuments(const execution::sequenced_policy &,
+                                const vector<DocumentRecord> &records,
+                                TextStorage storage) {
+  set<int> batch_ids;
+  for (const DocumentRecord &record : records) {
+    CheckNewDocument(record.id, record.text);
+    if (!batch_ids.insert(record.id).second) {
+      throw invalid_argument("Either document ID or content is incorrect");
+    }
+  }
+  for (const DocumentRecord &record : records) {
+    IndexDocument(record.id, record, storage,
+                  ComputeWordFrequencies(record.text));
+  }
+}
+
+void SearchServer::AddDocuments(const execution::parallel_policy &,
+                                const vector<DocumentRecord> &records,
+                                TextStorage storage) {
+  vector<WordFrequencies> words(records.size());
+  scheduler_->ParallelFor(0, records.size(), [&](size_t index) {
+    CheckNewDocument(records[index].id, records[index].text);
+    words[index] = ComputeWordFrequencies(records[index].text);
+  });
+  set<int> batch_ids;
+  for (const DocumentRecord &record : records) {
+    if (!batch_ids.insert(record.id).second) {
+      throw invalid_argument("Either document ID or content is incorrect");
+    }
+  }
+  for (size_t i = 0; i < records.size(); ++i) {
+    IndexDocument(records[i].id, records[i], storage, words[i]);
+  }
+}
+
+void SearchServer::RetainExternalStorage(shared_ptr<const void> storage) {
+  external_storage_.push_back(move(storage));
+}
+
+void SearchServer::BuildSimilarityIndex() {
+  unordered_map<int, double> norms;
+  norms.reserve(documents_.size());
+  for (const auto &[word, docs] : word_to_docs_freq_) {
+    const double inv_doc_freq = ComputeWordInvDocFreq(word);
+    for (const auto &[id, term_freq] : docs) {
+      norms[id] += term_freq * inv_doc_freq * term_freq * inv_doc_freq;
+    }
+  }
+  for (auto &[id, norm] : norms) {
+    norm = sqrt(norm);
+  }
+  document_norms_ = move(norms);
+}
+
+vector<Document> SearchServer::FindSimilarDocuments(int document_id,
+                                                    size_t count) const {
+  return FindSimilarDocuments(document_id, DocumentStatus::ACTUAL, count);
+}
+
+double SearchServer::GetDocumentNormBound(int document_id,
+                                          const SimilarityCandidate &candidate,
+                                          double min_inv_doc_freq) const {
+  const double other_squared_term_freqs = max(
+      0.0, documents_.at(document_id).squared_term_freqs -
+               candidate.squared_term_freqs);
+  return sqrt(candidate.squared_weights + other_squared_term_freqs *
+                                              min_inv_doc_freq *
+                                              min_inv_doc_freq);
+}
+
+double SearchServer::GetMinInvDocFreq() const {
+  size_t bucket_count = posting_list_lengths_.size();
+  while (bucket_count > 0 && posting_list_lengths_[bucket_count - 1] == 0) {
+    --bucket_count;
+  }
+  if (bucket_count == 0) {
+    return 0;
+  }
+  // Lists of a bucket are shorter than twice its smallest length
+  const size_t max_length = min((size_t{2} << (bucket_count - 1)) - 1,
+                                documents_.size());
+  return log(documents_.size() / static_cast<double>(max_length));
+}
+
+double SearchServer::SelectSimilarityTerms(
+    int document_id, pmr::vector<SimilarityTerm> &terms) const {
+  if (documents_.count(document_id) == 0) {
+    throw out_of_range("No document with id "s + to_string(document_id));
+  }
+  double norm = 0;
+  for (const auto &[word, term_freq] : CollectDocumentWords(document_id)) {
+    const double inv_doc_freq = ComputeWordInvDocFreq(word);
+    const double weight = term_freq * inv_doc_freq;
+    norm += weight * weight;
+    // Demoted words are in most documents, see PruneFrequentWords
+    if (weight > 0 && demoted_words_.count(word) == 0) {
+      terms.push_back({FindPostings(word), weight, inv_doc_freq});
+    }
+  }
+  if (terms.size() > SIMILAR_DOCUMENT_MAX_TERMS) {
+    nth_element(terms.begin(), terms.begin() + SIMILAR_DOCUMENT_MAX_TERMS,
+                terms.end(), [](const auto &lhs, const auto &rhs) {
+                  return lhs.weight > rhs.weight;
+                });
+    terms.resize(SIMILAR_DOCUMENT_MAX_TERMS);
+  }
+  return sqrt(norm);
+}
+
+double SearchServer::GetDocumentNorm(int document_id) const {
+  if (document_norms_) {
+    return document_norms_->at(document_id);
+  }
+  double norm = 0;
+  for (const auto &[word, term_freq] : CollectDocumentWords(document_id)) {
+    const double weight = term_freq * ComputeWordInvDocFreq(word);
+    norm += weight * weight;
+  }
+  return sqrt(norm);
+}
+
+HitCount SearchServer::CountMatchingDocuments(string_view raw_query,
+                                              HitCountMode mode) const {
+  QueryArenaScope scratch;
+  const Query query = ParseQuery(raw_query, scratch.GetResource());
+  // The same words as a search, demoted ones included only when alone
+  const ExecutionPlan plan = PlanQuery(query, false, scratch.GetResource());
+  if (plan.plus_terms.empty()) {
+    return {};
+  }
+  if (mode == HitCountMode::APPROXIMATE && hit_count_sketches_) {
+    return EstimateMatches(plan);
+  }
+  return {CountExactMatches(plan, scratch.GetResource()), 0};
+}
+
+void SearchServer::BuildHitCountSketches() {
+  unordered_map<const pmr::map<int, double> *, HyperLogLog> sketches;
+  for (const auto &[word, docs] : word_to_docs_freq_) {
+    if (docs.size() >= HIT_COUNT_SKETCH_MIN_POSTINGS) {
+      HyperLogLog &sketch = sketches[&docs];
+      for (const auto &[id, _] : docs) {
+        sketch.Add(id);
+      }
+    }
+  }
+  hit_count_sketches_ = move(sketches);
+}
+
+void SearchServer::Freeze() {
+  vector<pair<string_view, FrozenTerm>> terms;
+  terms.reserve(word_to_docs_freq_.size());
+  for (const auto &[word, docs] : word_to_docs_freq_) {
+    terms.push_back({word, {&docs}});
+  }
+  frozen_terms_.emplace(move(terms));
+}
+
+size_t SearchServer::CountExactMatches(const ExecutionPlan &plan,
+                                       pmr::memory_resource *resource) const {
+  const int first_id = documents_.begin()->first;
+  const size_t id_range =
+      static_cast<size_t>(documents_.rbegin()->first - first_id) + 1;
+  const size_t bitmap_words = (id_range + 63) / 64;
+  // Ids are too sparse for a bitmap, or the query has too few postings
+  if (id_range > HIT_COUNT_BITMAP_MAX_BITS_PER_DOCUMENT * documents_.size() ||
+      (plan.plus_postings + plan.minus_postings) *
+              HIT_COUNT_BITMAP_MAX_WORDS_PER_POSTING <
+          bitmap_words) {
+    pmr::vector<int> plus_ids{resource};
+    pmr::vector<int> minus_ids{resource};
+    for (const PlannedTerm &term : plan.plus_terms) {
+      for (const auto &[id, _] : *term.postings) {
+        plus_ids.push_back(id);
+      }
+    }
+    for (const PlannedTerm &term : plan.minus_terms) {
+      for (const auto &[id, _] : *term.postings) {
+        minus_ids.push_back(id);
+      }
+    }
+    for (pmr::vector<int> *ids : {&plus_ids, &minus_ids}) {
+      sort(ids->begin(), ids->end());
+      ids->erase(unique(ids->begin(), ids->end()), ids->end());
+    }
+    size_t count = 0;
+    for (const int id : plus_ids) {
+      count += !binary_search(minus_ids.begin(), minus_ids.end(), id);
+    }
+    return count;
+  }
+
+  pmr::vector<uint64_t> bitmap(bitmap_words, 0, resource);
+  for (const PlannedTerm &term : plan.plus_terms) {
+    for (const auto &[id, _] : *term.postings) {
+      const size_t bit = id - first_id;
+      bitmap[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+  }
+  for (const PlannedTerm &term : plan.minus_terms) {
+    for (const auto &[id, _] : *term.postings) {
+      const size_t bit = id - first_id;
+      bitmap[bit / 64] &= ~(uint64_t{1} << (bit % 64));
+    }
+  }
+  size_t count = 0;
+  for (const uint64_t word : bitmap) {
+    count += bitset<64>(word).count();
+  }
+  return count;
+}
+
+HitCount SearchServer::EstimateMatches(const ExecutionPlan &plan) const {
+  auto add_terms = [this](const pmr::vector<PlannedTerm> &terms,
+                          HyperLogLog &sketch) {
+    for (const PlannedTerm &term : terms) {
+      const auto it = hit_count_sketches_->find(term.postings);
+      if (it != hit_count_sketches_->end()) {
+        sketch.Merge(it->second);
+      } else {
+        for (const auto &[id, _] : *term.postings) {
+          sketch.Add(id);
+        }
+      }
+    }
+  };
+  const double error = HyperLogLog::GetRelativeError();
+  const double document_count = documents_.size();
+  HyperLogLog plus;
+  add_terms(plan.plus_terms, plus);
+  if (plan.minus_terms.empty()) {
+    const double estimate = min(plus.Estimate(), document_count);
+    return {static_cast<size_t>(llround(estimate)), error * estimate};
+  }
+  // |plus \ minus| = |plus U minus| - |minus|, so the error is that of both
+  HyperLogLog minus;
+  add_terms(plan.minus_terms, minus);
+  HyperLogLog both = plus;
+  both.Merge(minus);
+  const double union_estimate = both.Estimate();
+  const double minus_estimate = minus.Estimate();
+  const double estimate =
+      clamp(union_estimate - minus_estimate, 0.0, document_count);
+  return {static_cast<size_t>(llround(estimate)),
+          error * (union_estimate + minus_estimate)};
+}
+
+void SearchServer::CheckNewDocument(int document_id,
+                                    string_view document) const {
   if (ContainsSpecialChars(document) || document_id < 0 ||
       documents_.count(document_id) > 0) {
     throw invalid_argument("Either document ID or content is incorrect");
   }
-  documents_[document_id] = {ComputeAverageRating(ratings), status,
-                             string{document}};
-  documents_ids_.insert(document_id);
+}
 
-  vector<string_view> words =
-      SplitIntoWordsNoStop(documents_[document_id].document);
+SearchServer::WordFrequencies
+SearchServer::ComputeWordFrequencies(string_view document) const {
+  vector<string_view> words = SplitIntoWordsNoStop(document);
   const double inv_freq = 1.0 / words.size();
-  for (string_view word_view : words) {
-    word_to_docs_freq_[word_view][document_id] += inv_freq;
-    doc_to_words_freq_[document_id][word_view] += inv_freq;
+  sort(words.begin(), words.end());
+  WordFrequencies frequencies;
+  for (string_view word : words) {
+    if (frequencies.empty() || frequencies.back().first != word) {
+      frequencies.emplace_back(word, 0.0);
+    }
+    frequencies.back().second += inv_freq;
+  }
+  return frequencies;
+}
+
+void SearchServer::IndexDocument(int document_id, const DocumentRecord &record,
+                                 TextStorage storage,
+                                 const WordFrequencies &words) {
+  OnIndexChanged();
+  DocumentData &data =
+      documents_.try_emplace(document_id, &resources_->document_text)
+          .first->second;
+  data.rating = record.rating;
+  data.status = record.status;
+  if (storage == TextStorage::REFERENCE) {
+    data.text = record.text;
+  } else if (storage_profile_ == StorageProfile::FULL) {
+    data.stored_text = record.text;
+    data.text = data.stored_text;
+  }
+  documents_ids_.insert(document_id);
+
+  pmr::map<string_view, double> *document_words =
+      HasForwardIndex() ? &doc_to_words_freq_[document_id] : nullptr;
+  data.squared_term_freqs = 0;
+  for (const auto &[word, term_freq] : words) {
+    data.squared_term_freqs += term_freq * term_freq;
+    const string_view term = InternWord(word);
+    auto &docs = word_to_docs_freq_[term];
+    docs[document_id] = term_freq;
+    OnPostingsResized(docs.size() - 1, docs.size());
+    if (document_words) {
+      document_words->emplace_hint(document_words->end(), term, term_freq);
+    }
+  }
+  posting_count_ += words.size();
+}
+
+bool SearchServer::UpdatePostings(int document_id,
+                                  const WordFrequencies &words) {
+  double &squared_term_freqs = documents_.at(document_id).squared_term_freqs;
+  squared_term_freqs = 0;
+  for (const auto &[_, term_freq] : words) {
+    squared_term_freqs += term_freq * term_freq;
+  }
+  // Both are sorted by word, so merge them
+  const WordFrequencies old_words = CollectDocumentWords(document_id);
+  pmr::map<string_view, double> *document_words =
+      HasForwardIndex() ? &doc_to_words_freq_.at(document_id) : nullptr;
+  auto old_it = old_words.begin();
+  auto new_it = words.begin();
+  bool changed = false;
+  while (old_it != old_words.end() || new_it != words.end()) {
+    if (new_it == words.end() ||
+        (old_it != old_words.end() && old_it->first < new_it->first)) {
+      const string_view word = old_it->first;
+      ++old_it;
+      if (document_words) {
+        document_words->erase(word);
+      }
+      auto &docs = word_to_docs_freq_.at(word);
+      docs.erase(document_id);
+      OnPostingsResized(docs.size() + 1, docs.size());
+      EraseWordIfUnused(word);
+      --posting_count_;
+      changed = true;
+    } else if (old_it == old_words.end() || new_it->first < old_it->first) {
+      const string_view term = InternWord(new_it->first);
+      auto &docs = word_to_docs_freq_[term];
+      docs[document_id] = new_it->second;
+      OnPostingsResized(docs.size() - 1, docs.size());
+      if (document_words) {
+        document_words->emplace(term, new_it->second);
+      }
+      ++posting_count_;
+      ++new_it;
+      changed = true;
+    } else {
+      if (old_it->second != new_it->second) {
+        word_to_docs_freq_.at(old_it->first).at(document_id) = new_it->second;
+        if (document_words) {
+          document_words->at(old_it->first) = new_it->second;
+        }
+        changed = true;
+      }
+      ++old_it;
+      ++new_it;
+    }
   }
+  return changed;
+}
+
+SearchServer::WordFrequencies
+SearchServer::CollectDocumentWords(int document_id) const {
+  WordFrequencies words;
+  if (HasForwardIndex()) {
+    const auto it = doc_to_words_freq_.find(document_id);
+    if (it != doc_to_words_freq_.end()) {
+      words.assign(it->second.begin(), it->second.end());
+    }
+    return words;
+  }
+  for (const auto &[word, docs] : word_to_docs_freq_) {
+    if (const auto it = docs.find(document_id); it != docs.end()) {
+      words.emplace_back(word, it->second);
+    }
+  }
+  return words;
+}
+
+string_view SearchServer::FindDocumentWord(int document_id,
+                                           string_view word) const {
+  if (HasForwardIndex()) {
+    // The document's few words are closer at hand than the word's postings
+    const auto &document_words = doc_to_words_freq_.at(document_id);
+    const auto it = document_words.find(word);
+    return it == document_words.end() ? string_view{} : it->first;
+  }
+  if (frozen_terms_) {
+    const auto *term = frozen_terms_->Find(word);
+    return term && term->value.postings->count(document_id) > 0
+               ? term->key
+               : string_view{};
+  }
+  const auto it = word_to_docs_freq_.find(word);
+  return it != word_to_docs_freq_.end() && it->second.count(document_id) > 0
+             ? it->first
+             : string_view{};
 }
 
 int SearchServer::ComputeAverageRating(const vector<int> &ratings) {
@@ -65,11 +628,207 @@ int SearchServer::ComputeAverageRating(const vector<int> &ratings) {
 }
 
 double SearchServer::ComputeWordInvDocFreq(string_view word) const {
-  double docs_with_word = word_to_docs_freq_.at(word).size();
+  const auto *postings = FindPostings(word);
+  if (!postings) {
+    throw out_of_range("Word is not indexed");
+  }
+  double docs_with_word = postings->size();
   return log(documents_.size() / docs_with_word);
 }
 
+const pmr::map<int, double> *
+SearchServer::FindPostings(string_view word) const {
+  if (frozen_terms_) {
+    const auto *term = frozen_terms_->Find(word);
+    return term ? term->value.postings : nullptr;
+  }
+  const auto it = word_to_docs_freq_.find(word);
+  return it == word_to_docs_freq_.end() ? nullptr : &it->second;
+}
+
+double SearchServer::ComputeRelevance(const Query &query,
+                                      const ExecutionPlan &plan,
+                                      int document_id,
+                                      pmr::vector<double> &contributions) const {
+  if (!HasForwardIndex()) {
+    double relevance = 0;
+    for (const PlannedTerm &term : plan.plus_terms) {
+      if (const auto it = term.postings->find(document_id);
+          it != term.postings->end()) {
+        relevance += term.factor * it->second;
+      }
+    }
+    return relevance;
+  }
+  // Both are sorted by word, so merge them
+  const auto &document_words = doc_to_words_freq_.at(document_id);
+  contributions.assign(query.plus_words.size(), 0.0);
+  auto it = document_words.begin();
+  for (size_t i = 0; i < query.plus_words.size(); ++i) {
+    while (it != document_words.end() && it->first < query.plus_words[i]) {
+      ++it;
+    }
+    if (it == document_words.end()) {
+      break;
+    }
+    if (it->first == query.plus_words[i]) {
+      contributions[i] = it->second;
+    }
+  }
+  double relevance = 0;
+  for (const PlannedTerm &term : plan.plus_terms) {
+    relevance += term.factor * contributions[term.index];
+  }
+  return relevance;
+}
+
+double SearchServer::ComputePlusWordFactor(const Query &query,
+                                           size_t index) const {
+  const double inv_doc_freq =
+      query.plus_inv_doc_freqs.empty()
+          ? ComputeWordInvDocFreq(query.plus_words[index])
+          : query.plus_inv_doc_freqs[index];
+  return query.plus_weights.empty() ? inv_doc_freq
+                                    : inv_doc_freq * query.plus_weights[index];
+}
+
+string_view SearchServer::InternWord(string_view word) {
+  auto it = dictionary_.find(word);
+  if (it == dictionary_.end()) {
+    it = dictionary_.emplace(word).first;
+  }
+  return *it;
+}
+
+void SearchServer::OnPostingsResized(size_t old_size, size_t new_size) {
+  if (old_size > 0) {
+    --posting_list_lengths_[GetLengthBucket(old_size)];
+  }
+  if (new_size > 0) {
+    const size_t bucket = GetLengthBucket(new_size);
+    if (posting_list_lengths_.size() <= bucket) {
+      posting_list_lengths_.resize(bucket + 1);
+    }
+    ++posting_list_lengths_[bucket];
+  }
+}
+
+void SearchServer::EraseWordIfUnused(string_view word) {
+  const auto it = word_to_docs_freq_.find(word);
+  if (it != word_to_docs_freq_.end() && it->second.empty()) {
+    demoted_words_.erase(word);
+    word_to_docs_freq_.erase(it);
+    dictionary_.erase(dictionary_.find(word));
+  }
+}
+
+size_t SearchServer::FindOrAddField(string_view name) {
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    if (fields_[i].name == name) {
+      return i;
+    }
+  }
+  fields_.emplace_back(string{name}, &resources_->postings);
+  return fields_.size() - 1;
+}
+
+void SearchServer::RemoveFieldPostings(int document_id,
+                                       const WordFrequencies &words) {
+  for (Field &field : fields_) {
+    for (const auto &[word, _] : words) {
+      const auto it = field.word_to_docs_freq.find(word);
+      if (it != field.word_to_docs_freq.end()) {
+        field_posting_count_ -= it->second.erase(document_id);
+        if (it->second.empty()) {
+          field.word_to_docs_freq.erase(it);
+        }
+      }
+    }
+  }
+}
+
+void SearchServer::SetFieldWeights(Query &query,
+                                   const FieldWeights &field_weights) const {
+  query.field_weights.clear();
+  for (const auto &[name, weight] : field_weights) {
+    if (!(weight >= 0)) {
+      throw invalid_argument("Field weights must not be negative");
+    }
+    for (size_t i = 0; i < fields_.size(); ++i) {
+      if (fields_[i].name == name && weight != 1) {
+        query.field_weights.emplace_back(i, weight);
+      }
+    }
+  }
+}
+
+void SearchServer::RemoveWordsFromIndex(const vector<string_view> &words) {
+  if (words.empty()) {
+    return;
+  }
+  OnIndexChanged();
+  // Field postings go first, while the words are still in the dictionary
+  for (Field &field : fields_) {
+    for (string_view word : words) {
+      const auto it = field.word_to_docs_freq.find(word);
+      if (it != field.word_to_docs_freq.end()) {
+        field_posting_count_ -= it->second.size();
+        field.word_to_docs_freq.erase(it);
+      }
+    }
+  }
+  // Share of each affected document's words that goes away
+  map<int, double> removed_freqs;
+  for (string_view word : words) {
+    auto &docs = word_to_docs_freq_.at(word);
+    for (const auto &[id, term_freq] : docs) {
+      if (HasForwardIndex()) {
+        doc_to_words_freq_.at(id).erase(word);
+      }
+      removed_freqs[id] += term_freq;
+      documents_.at(id).squared_term_freqs -= term_freq * term_freq;
+    }
+    posting_count_ -= docs.size();
+    OnPostingsResized(docs.size(), 0);
+    docs.clear();
+    EraseWordIfUnused(word);
+  }
+  // tf = count / length, so dropping a share r of the length scales every
+  // remaining tf by 1 / (1 - r)
+  for (const auto &[id, removed_freq] : removed_freqs) {
+    const double scale = 1.0 / (1.0 - removed_freq);
+    documents_.at(id).squared_term_freqs *= scale * scale;
+  }
+  for (Field &field : fields_) {
+    for (auto &[word, docs] : field.word_to_docs_freq) {
+      for (auto &[id, term_freq] : docs) {
+        if (const auto it = removed_freqs.find(id); it != removed_freqs.end()) {
+          term_freq *= 1.0 / (1.0 - it->second);
+        }
+      }
+    }
+  }
+  if (!HasForwardIndex()) {
+    for (auto &[word, docs] : word_to_docs_freq_) {
+      for (auto &[id, term_freq] : docs) {
+        if (const auto it = removed_freqs.find(id); it != removed_freqs.end()) {
+          term_freq *= 1.0 / (1.0 - it->second);
+        }
+      }
+    }
+    return;
+  }
+  for (const auto &[id, removed_freq] : removed_freqs) {
+    const double scale = 1.0 / (1.0 - removed_freq);
+    for (auto &[word, term_freq] : doc_to_words_freq_.at(id)) {
+      term_freq *= scale;
+      word_to_docs_freq_.at(word).at(id) = term_freq;
+    }
+  }
+}
+
 bool SearchServer::IsStopWord(string_view word) const {
+  // The few stop words are cheaper to search than the frozen vocabulary
   return stop_words_.count(word) > 0;
 }
 
@@ -101,12 +860,14 @@ SearchServer::QueryWord SearchServer::ParseQueryWord(string_view text) const {
   return {text, is_minus, IsStopWord(text)};
 }
 
-SearchServer::Query SearchServer::ParseQuery(string_view text) const {
+SearchServer::Query
+SearchServer::ParseQuery(string_view text,
+                         pmr::memory_resource *resource) const {
   if (ContainsSpecialChars(text)) {
     throw invalid_argument("Incorrect search query");
   }
-  Query query;
-  for (string_view word : SplitIntoWords(text)) {
+  Query query(resource);
+  for (string_view word : SplitIntoWords(text, resource)) {
     const QueryWord query_word = ParseQueryWord(word);
     if (query_word.data.empty() || query_word.data[0] == '-') {
       throw invalid_argument("Incorrect search query");
@@ -127,23 +888,562 @@ SearchServer::Query SearchServer::ParseQuery(string_view text) const {
   query.plus_words.erase(
       unique(query.plus_words.begin(), query.plus_words.end()),
       query.plus_words.end());
+  if (fuzzy_params_) {
+    ExpandFuzzyWords(query);
+  }
   return query;
 }
 
-const map<string_view, double> &
+vector<pair<string_view, int>>
+SearchServer::FindFuzzyTerms(string_view word, int max_edits) const {
+  const LevenshteinAutomaton automaton(word, max_edits);
+  vector<pair<string_view, int>> terms;
+  // states[i] is the automaton state after the first i chars of prev_term
+  vector<LevenshteinAutomaton::State> states{automaton.Start()};
+  string_view prev_term;
+  auto it = word_to_docs_freq_.begin();
+  while (it != word_to_docs_freq_.end()) {
+    const string_view term = it->first;
+    size_t depth = 0;
+    const size_t max_depth = min(states.size() - 1, term.size());
+    while (depth < max_depth && term[depth] == prev_term[depth]) {
+      ++depth;
+    }
+    states.resize(depth + 1);
+    bool dead_prefix = false;
+    for (; depth < term.size(); ++depth) {
+      auto state = automaton.Step(states.back(), term[depth]);
+      if (!automaton.CanMatch(state)) {
+        dead_prefix = true;
+        break;
+      }
+      states.push_back(move(state));
+    }
+    prev_term = term;
+    if (!dead_prefix) {
+      if (automaton.IsMatch(states.back())) {
+        terms.push_back({term, automaton.Distance(states.back())});
+      }
+      ++it;
+      continue;
+    }
+    // No term starting with term[0..depth] can match: skip the whole subtree
+    string next_prefix{term.substr(0, depth + 1)};
+    while (!next_prefix.empty() &&
+           static_cast<unsigned char>(next_prefix.back()) == 0xFF) {
+      next_prefix.pop_back();
+    }
+    if (next_prefix.empty()) {
+      break;
+    }
+    ++next_prefix.back();
+    it = word_to_docs_freq_.lower_bound(next_prefix);
+  }
+  return terms;
+}
+
+void SearchServer::ExpandFuzzyWords(Query &query) const {
+  ExpandFuzzyWords(
+      query, *fuzzy_params_,
+      [this](string_view word) {
+        return FindFuzzyTerms(word, fuzzy_params_->max_edits);
+      },
+      [this](string_view term) { return word_to_docs_freq_.at(term).size(); });
+}
+
+void SearchServer::ResolveTerms(Query &query) const {
+  query.plus_postings.clear();
+  query.plus_inv_doc_freqs.clear();
+  for (string_view word : query.plus_words) {
+    const auto *postings = FindPostings(word);
+    query.plus_postings.push_back(postings);
+    query.plus_inv_doc_freqs.push_back(
+        postings ? ComputeWordInvDocFreq(word) : 0.0);
+  }
+  query.minus_postings.clear();
+  for (string_view word : query.minus_words) {
+    query.minus_postings.push_back(FindPostings(word));
+  }
+}
+
+PreparedQuery SearchServer::PrepareQuery(string_view raw_query) const {
+  const Query parsed = ParseQuery(raw_query);
+  // Fuzzy expansions view the dictionary, so every word is copied
+  auto words = make_shared<string>();
+  for (const auto *parsed_words : {&parsed.plus_words, &parsed.minus_words}) {
+    for (string_view word : *parsed_words) {
+      *words += word;
+    }
+  }
+  PreparedQuery prepared;
+  prepared.server_ = this;
+  prepared.generation_ = generation_;
+  Query &query = prepared.query_;
+  size_t offset = 0;
+  for (auto [parsed_words, query_words] :
+       {pair{&parsed.plus_words, &query.plus_words},
+        pair{&parsed.minus_words, &query.minus_words}}) {
+    for (string_view word : *parsed_words) {
+      query_words->push_back(string_view{*words}.substr(offset, word.size()));
+      offset += word.size();
+    }
+  }
+  query.plus_weights.assign(parsed.plus_weights.begin(),
+                            parsed.plus_weights.end());
+  ResolveTerms(query);
+  prepared.words_ = move(words);
+  return prepared;
+}
+
+void SearchServer::CheckPreparedHere(const PreparedQuery &prepared) const {
+  if (prepared.server_ != this) {
+    throw invalid_argument("Query was prepared by another server");
+  }
+}
+
+const SearchServer::Query &
+SearchServer::ResolvePreparedQuery(const PreparedQuery &prepared,
+                                   optional<Query> &refreshed,
+                                   pmr::memory_resource *resource) const {
+  CheckPreparedHere(prepared);
+  if (!prepared.IsStale()) {
+    return prepared.query_;
+  }
+  const Query &query = prepared.query_;
+  refreshed.emplace(resource);
+  refreshed->plus_words.assign(query.plus_words.begin(),
+                               query.plus_words.end());
+  refreshed->minus_words.assign(query.minus_words.begin(),
+                                query.minus_words.end());
+  refreshed->plus_weights.assign(query.plus_weights.begin(),
+                                 query.plus_weights.end());
+  ResolveTerms(*refreshed);
+  return *refreshed;
+}
+
+vector<Document>
+SearchServer::FindTopDocuments(const PreparedQuery &query) const {
+  return FindTopDocuments(execution::seq, query, DocumentStatus::ACTUAL);
+}
+
+vector<Document>
+SearchServer::FindTopDocuments(const execution::sequenced_policy &policy,
+                               const PreparedQuery &query) const {
+  return FindTopDocuments(policy, query, DocumentStatus::ACTUAL);
+}
+
+vector<Document>
+SearchServer::FindTopDocuments(const execution::parallel_policy &policy,
+                               const PreparedQuery &query) const {
+  return FindTopDocuments(policy, query, DocumentStatus::ACTUAL);
+}
+
+SearchServer::WordsAndStatus
+SearchServer::MatchDocument(const PreparedQuery &query,
+                            int document_id) const {
+  return MatchDocument(execution::seq, query, document_id);
+}
+
+SearchServer::WordsAndStatus
+SearchServer::MatchDocument(const execution::sequenced_policy &,
+                            const PreparedQuery &query,
+                            int document_id) const {
+  CheckPreparedHere(query);
+  return MatchQuery(query.query_, document_id);
+}
+
+SearchServer::WordsAndStatus
+SearchServer::MatchDocument(const execution::parallel_policy &policy,
+                            const PreparedQuery &query,
+                            int document_id) const {
+  CheckPreparedHere(query);
+  return MatchQuery(policy, query.query_, document_id);
+}
+
+SearchServer::WordsAndStatus SearchServer::MatchQuery(const Query &query,
+                                                      int document_id) const {
+  const DocumentStatus status = documents_.at(document_id).status;
+  for (string_view word : query.minus_words) {
+    if (!FindDocumentWord(document_id, word).empty()) {
+      return {vector<string_view>(), status};
+    }
+  }
+  vector<string_view> words;
+  for (string_view word : query.plus_words) {
+    // Keys view the dictionary, the query text may be gone after return
+    const string_view key = FindDocumentWord(document_id, word);
+    if (!key.empty()) {
+      words.push_back(key);
+    }
+  }
+  return {words, status};
+}
+
+SearchServer::WordsAndStatus
+SearchServer::MatchQuery(const execution::parallel_policy &,
+                         const Query &query, int document_id) const {
+  const DocumentStatus status = documents_.at(document_id).status;
+  atomic<bool> has_minus_word{false};
+  scheduler_->ForEach(query.minus_words.begin(), query.minus_words.end(),
+                      [this, document_id, &has_minus_word](string_view word) {
+                        if (!FindDocumentWord(document_id, word).empty()) {
+                          has_minus_word = true;
+                        }
+                      });
+  if (has_minus_word) {
+    return {vector<string_view>(), status};
+  }
+
+  // Found words are replaced with their dictionary keys, which outlive the
+  // query text
+  QueryArenaScope scratch;
+  pmr::vector<string_view> pwords(query.plus_words.begin(),
+                                  query.plus_words.end(),
+                                  scratch.GetResource());
+  scheduler_->ForEach(pwords.begin(), pwords.end(),
+                      [this, document_id](string_view &word) {
+                        word = FindDocumentWord(document_id, word);
+                      });
+  pwords.erase(remove(pwords.begin(), pwords.end(), string_view{}),
+               pwords.end());
+  return {vector<string_view>(pwords.begin(), pwords.end()), status};
+}
+
+QueryPlan SearchServer::ExplainQuery(string_view raw_query) const {
+  return ExplainQuery(execution::seq, raw_query);
+}
+
+QueryPlan SearchServer::ExplainQuery(const execution::sequenced_policy &,
+                                     string_view raw_query) const {
+  const Query query = ParseQuery(raw_query);
+  return DescribePlan(query, PlanQuery(query, false,
+                                       pmr::get_default_resource()));
+}
+
+QueryPlan SearchServer::ExplainQuery(const execution::parallel_policy &,
+                                     string_view raw_query) const {
+  const Query query = ParseQuery(raw_query);
+  return DescribePlan(query,
+                      PlanQuery(query, true, pmr::get_default_resource()));
+}
+
+void SearchServer::VisitTopDocumentsBatch(
+    const vector<string> &raw_queries,
+    const function<void(size_t, const Document *, const Document *)>
+        &consumer) const {
+  vector<Query> queries;
+  vector<ExecutionPlan> plans;
+  queries.reserve(raw_queries.size());
+  plans.reserve(raw_queries.size());
+  vector<SharedTerm> terms;
+  unordered_map<const pmr::map<int, double> *, size_t> term_indexes;
+  for (const string &raw_query : raw_queries) {
+    queries.push_back(ParseQuery(raw_query));
+    plans.push_back(
+        PlanQuery(queries.back(), false, pmr::get_default_resource()));
+    for (const PlannedTerm &term : plans.back().plus_terms) {
+      if (term_indexes.emplace(term.postings, terms.size()).second) {
+        terms.push_back(
+            {term.postings, queries.back().plus_words[term.index], {}});
+      }
+    }
+  }
+  // Every query adds its words' contributions to a document rarest first,
+  // as its own plan does, so the sums come out bit for bit the same
+  sort(terms.begin(), terms.end(),
+       [](const SharedTerm &lhs, const SharedTerm &rhs) {
+         return pair{lhs.postings->size(), lhs.word} <
+                pair{rhs.postings->size(), rhs.word};
+       });
+  for (size_t i = 0; i < terms.size(); ++i) {
+    term_indexes[terms[i].postings] = i;
+  }
+  // Queries whose plans order equal lengths otherwise, e.g. fuzzy
+  // expansions, run on their own
+  vector<bool> runs_alone(queries.size(), false);
+  for (size_t q = 0; q < plans.size(); ++q) {
+    size_t previous = 0;
+    for (const PlannedTerm &term : plans[q].plus_terms) {
+      const size_t index = term_indexes.at(term.postings);
+      if (&term != &plans[q].plus_terms.front() && index <= previous) {
+        runs_alone[q] = true;
+        break;
+      }
+      previous = index;
+    }
+    if (!runs_alone[q]) {
+      for (const PlannedTerm &term : plans[q].plus_terms) {
+        terms[term_indexes.at(term.postings)].users.emplace_back(q,
+                                                                 term.factor);
+      }
+    }
+  }
+
+  // Every range of document ids is scanned by one task, so a document's
+  // relevance is summed by one thread
+  const size_t range_count =
+      max<size_t>(1, min(scheduler_->GetThreadCount(), documents_.size()));
+  vector<int> bounds;
+  {
+    auto it = documents_.begin();
+    for (size_t r = 0; r < range_count; ++r) {
+      bounds.push_back(r == 0 ? numeric_limits<int>::min() : it->first);
+      advance(it, documents_.size() / range_count +
+                      (r < documents_.size() % range_count));
+    }
+    bounds.push_back(numeric_limits<int>::max());
+  }
+  vector<vector<unordered_map<int, double>>> doc_to_relev(
+      range_count, vector<unordered_map<int, double>>(queries.size()));
+  scheduler_->ParallelFor(0, range_count, [&](size_t r) {
+    for (const SharedTerm &term : terms) {
+      if (term.users.empty()) {
+        continue;
+      }
+      for (auto it = term.postings->lower_bound(bounds[r]);
+           it != term.postings->end() && it->first < bounds[r + 1]; ++it) {
+        const auto &[id, term_freq] = *it;
+        // The filter of FindTopDocuments(raw_query), read once per posting
+        if (documents_.at(id).status != DocumentStatus::ACTUAL) {
+          continue;
+        }
+        for (const auto &[q, factor] : term.users) {
+          doc_to_relev[r][q][id] += factor * term_freq;
+        }
+      }
+    }
+  });
+
+  vector<Document> documents(queries.size() * MAX_RESULT_DOCUMENT_COUNT);
+  vector<size_t> counts(queries.size());
+  scheduler_->ParallelFor(0, queries.size(), [&](size_t q) {
+    auto store = [&](const Document *first, const Document *last) {
+      copy(first, last, documents.begin() + q * MAX_RESULT_DOCUMENT_COUNT);
+      counts[q] = last - first;
+    };
+    if (runs_alone[q]) {
+      VisitTopDocumentsByQuery(execution::seq, queries[q],
+                               DocumentStatus::ACTUAL, store);
+      return;
+    }
+    ExecutionPlan &plan = plans[q];
+    CollectExcludedDocuments(plan);
+    vector<Document> matched_documents;
+    for (const auto &range : doc_to_relev) {
+      for (const auto &[id, relevance] : range[q]) {
+        if (!IsExcluded(plan, id)) {
+          matched_documents.push_back(
+              {id, relevance, documents_.at(id).rating});
+        }
+      }
+    }
+    SortAndTrimDocuments(matched_documents);
+    store(matched_documents.data(),
+          matched_documents.data() + matched_documents.size());
+  });
+  for (size_t q = 0; q < queries.size(); ++q) {
+    const Document *first = documents.data() + q * MAX_RESULT_DOCUMENT_COUNT;
+    consumer(q, first, first + counts[q]);
+  }
+}
+
+SearchServer::ExecutionPlan
+SearchServer::PlanQuery(const Query &query, bool allow_parallel,
+                        pmr::memory_resource *resource) const {
+  ExecutionPlan plan(resource);
+  // Demoted words only count when nothing else can match
+  for (const bool demoted : {false, true}) {
+    for (size_t i = 0; i < query.plus_words.size(); ++i) {
+      const auto *postings = query.plus_postings.empty()
+                                 ? FindPostings(query.plus_words[i])
+                                 : query.plus_postings[i];
+      if (postings &&
+          (demoted_words_.count(query.plus_words[i]) > 0) == demoted) {
+        const double factor = ComputePlusWordFactor(query, i);
+        plan.plus_terms.push_back({i, postings, factor});
+        plan.plus_postings += postings->size();
+        // The whole document counts once already, so a field weighing w adds
+        // w - 1 times its own share
+        for (const auto &[field, weight] : query.field_weights) {
+          const auto &word_to_docs_freq = fields_[field].word_to_docs_freq;
+          const auto it = word_to_docs_freq.find(query.plus_words[i]);
+          if (it != word_to_docs_freq.end()) {
+            plan.plus_terms.push_back({i, &it->second, factor * (weight - 1)});
+            plan.plus_postings += it->second.size();
+          }
+        }
+      }
+    }
+    if (!plan.plus_terms.empty() || demoted_words_.empty()) {
+      break;
+    }
+  }
+  for (size_t i = 0; i < query.minus_words.size(); ++i) {
+    if (const auto *postings = query.minus_postings.empty()
+                                   ? FindPostings(query.minus_words[i])
+                                   : query.minus_postings[i]) {
+      plan.minus_terms.push_back({i, postings, 0.0});
+      plan.minus_postings += postings->size();
+    }
+  }
+  // sort() rather than stable_sort() which takes a buffer from the heap
+  sort(plan.plus_terms.begin(), plan.plus_terms.end(),
+       [](const PlannedTerm &lhs, const PlannedTerm &rhs) {
+         return pair{lhs.postings->size(), lhs.index} <
+                pair{rhs.postings->size(), rhs.index};
+       });
+  // The most frequent minus word rules out the most candidates, ties keep
+  // the query's order
+  sort(plan.minus_terms.begin(), plan.minus_terms.end(),
+       [](const PlannedTerm &lhs, const PlannedTerm &rhs) {
+         if (lhs.postings->size() != rhs.postings->size()) {
+           return lhs.postings->size() > rhs.postings->size();
+         }
+         return lhs.index < rhs.index;
+       });
+
+  if (forced_strategy_) {
+    plan.strategy = *forced_strategy_;
+  } else if (allow_parallel && scheduler_->GetThreadCount() > 1 &&
+             plan.plus_postings >= PARALLEL_MIN_POSTINGS) {
+    plan.strategy = QueryStrategy::PARALLEL;
+  } else if (plan.plus_terms.size() <= DOCUMENT_AT_A_TIME_MAX_TERMS) {
+    plan.strategy = QueryStrategy::DOCUMENT_AT_A_TIME;
+  } else {
+    plan.strategy = QueryStrategy::TERM_AT_A_TIME;
+  }
+
+  if (plan.minus_terms.empty() || plan.plus_terms.empty()) {
+    plan.minus_words_strategy = MinusWordsStrategy::NONE;
+  } else if (plan.strategy == QueryStrategy::PARALLEL) {
+    plan.minus_words_strategy = MinusWordsStrategy::COLLECT_DOCUMENTS;
+  } else {
+    // A probe per candidate and minus word against a pass over the minus
+    // words' postings
+    const size_t candidates = min(plan.plus_postings, documents_.size());
+    plan.minus_words_strategy =
+        candidates * plan.minus_terms.size() < plan.minus_postings
+            ? MinusWordsStrategy::PROBE_POSTINGS
+            : MinusWordsStrategy::COLLECT_DOCUMENTS;
+  }
+  return plan;
+}
+
+QueryPlan SearchServer::DescribePlan(const Query &query,
+                                     const ExecutionPlan &plan) const {
+  QueryPlan description;
+  description.strategy = plan.strategy;
+  description.minus_words_strategy = plan.minus_words_strategy;
+  description.plus_postings = plan.plus_postings;
+  description.minus_postings = plan.minus_postings;
+  for (const PlannedTerm &term : plan.plus_terms) {
+    description.plus_terms.push_back(
+        {string{query.plus_words[term.index]}, term.postings->size()});
+  }
+  for (const PlannedTerm &term : plan.minus_terms) {
+    description.minus_terms.push_back(
+        {string{query.minus_words[term.index]}, term.postings->size()});
+  }
+  for (size_t i = 0; i < query.plus_words.size(); ++i) {
+    const string_view word = query.plus_words[i];
+    if (!FindPostings(word)) {
+      description.missing_words.emplace_back(word);
+    } else if (none_of(plan.plus_terms.begin(), plan.plus_terms.end(),
+                       [i](const PlannedTerm &term) {
+                         return term.index == i;
+                       })) {
+      description.demoted_words.emplace_back(word);
+    }
+  }
+  return description;
+}
+
+void SearchServer::CollectExcludedDocuments(ExecutionPlan &plan) const {
+  if (plan.minus_words_strategy != MinusWordsStrategy::COLLECT_DOCUMENTS) {
+    return;
+  }
+  plan.excluded_ids.reserve(plan.minus_postings);
+  for (const PlannedTerm &term : plan.minus_terms) {
+    for (const auto &[id, _] : *term.postings) {
+      plan.excluded_ids.push_back(id);
+    }
+  }
+  sort(plan.excluded_ids.begin(), plan.excluded_ids.end());
+}
+
+bool SearchServer::IsExcluded(const ExecutionPlan &plan,
+                              int document_id) const {
+  switch (plan.minus_words_strategy) {
+  case MinusWordsStrategy::NONE:
+    return false;
+  case MinusWordsStrategy::PROBE_POSTINGS:
+    return any_of(plan.minus_terms.begin(), plan.minus_terms.end(),
+                  [document_id](const PlannedTerm &term) {
+                    return term.postings->count(document_id) > 0;
+                  });
+  case MinusWordsStrategy::COLLECT_DOCUMENTS:
+    return binary_search(plan.excluded_ids.begin(), plan.excluded_ids.end(),
+                         document_id);
+  }
+  return false;
+}
+
+MemoryStats SearchServer::GetMemoryStats() const {
+  MemoryStats stats;
+  stats.vocabulary = {resources_->vocabulary.GetBytes(), dictionary_.size()};
+  stats.postings = {resources_->postings.GetBytes(),
+                    posting_count_ + field_posting_count_};
+  stats.forward_index = {resources_->forward_index.GetBytes(),
+                         HasForwardIndex() ? posting_count_ : 0};
+  stats.document_text = {resources_->document_text.GetBytes(),
+                         resources_->document_text.GetBlocks()};
+  stats.attributes = {resources_->attributes.GetBytes(), documents_.size()};
+  stats.stop_words = {resources_->stop_words.GetBytes(), stop_words_.size()};
+  if (hit_count_sketches_) {
+    stats.caches += EstimateHashMapUsage(*hit_count_sketches_);
+  }
+  if (document_norms_) {
+    stats.caches += EstimateHashMapUsage(*document_norms_);
+  }
+  if (frozen_terms_) {
+    stats.caches += MemoryUsage{frozen_terms_->GetMemoryUsage(),
+                                frozen_terms_->GetSize()};
+  }
+  size_t bucket_count = posting_list_lengths_.size();
+  while (bucket_count > 0 && posting_list_lengths_[bucket_count - 1] == 0) {
+    --bucket_count;
+  }
+  stats.posting_list_lengths.assign(
+      posting_list_lengths_.begin(),
+      posting_list_lengths_.begin() + bucket_count);
+  return stats;
+}
+
+const pmr::map<string_view, double> &
 SearchServer::GetWordFrequencies(int document_id) const {
+  if (!HasForwardIndex()) {
+    throw logic_error(
+        "Word frequencies are not kept in the SEARCH_ONLY storage profile");
+  }
   const auto result = doc_to_words_freq_.find(document_id);
   if (result == doc_to_words_freq_.end()) {
-    const static map<string_view, double> tmp;
+    const static pmr::map<string_view, double> tmp;
     return tmp;
   }
   return doc_to_words_freq_.at(document_id);
 }
 
 void SearchServer::RemoveDocument(int document_id) {
-  for (auto &[word, _] : doc_to_words_freq_[document_id]) {
-    word_to_docs_freq_[word].erase(document_id);
+  OnIndexChanged();
+  const WordFrequencies document_words = CollectDocumentWords(document_id);
+  RemoveFieldPostings(document_id, document_words);
+  for (auto &[word, _] : document_words) {
+    auto &docs = word_to_docs_freq_.at(word);
+    docs.erase(document_id);
+    OnPostingsResized(docs.size() + 1, docs.size());
+    EraseWordIfUnused(word);
   }
+  posting_count_ -= document_words.size();
   doc_to_words_freq_.erase(document_id);
   documents_.erase(document_id);
   documents_ids_.erase(document_id);
@@ -155,16 +1455,26 @@ void SearchServer::RemoveDocument(execution::sequenced_policy,
 }
 
 void SearchServer::RemoveDocument(execution::parallel_policy, int document_id) {
-  const map<string_view, double> &words_map =
-      doc_to_words_freq_.at(document_id);
+  OnIndexChanged();
+  if (documents_.count(document_id) == 0) {
+    throw out_of_range("No document with such id");
+  }
+  const WordFrequencies document_words = CollectDocumentWords(document_id);
+  RemoveFieldPostings(document_id, document_words);
   vector<string_view> words;
-  for (auto &[word, _] : words_map) {
+  for (auto &[word, _] : document_words) {
     words.push_back(word);
   }
-  for_each(execution::par, words.begin(), words.end(),
-           [this, &document_id](string_view word) {
-             this->word_to_docs_freq_[word].erase(document_id);
-           });
+  scheduler_->ForEach(words.begin(), words.end(),
+                      [this, &document_id](string_view word) {
+                        this->word_to_docs_freq_.at(word).erase(document_id);
+                      });
+  for (string_view word : words) {
+    const size_t size = word_to_docs_freq_.at(word).size();
+    OnPostingsResized(size + 1, size);
+    EraseWordIfUnused(word);
+  }
+  posting_count_ -= words.size();
   doc_to_words_freq_.erase(document_id);
   documents_.erase(document_id);
   documents_ids_.erase(document_id);
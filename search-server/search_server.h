@@ -3,32 +3,129 @@
 #include <algorithm>
 #include <cmath>
 #include <execution>
+#include <functional>
+#include <limits>
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <set>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 
 #include "concurrent_map.h"
 #include "document.h"
+#include "facets.h"
+#include "hit_count.h"
+#include "memory_stats.h"
+#include "perfect_hash.h"
+#include "query_arena.h"
+#include "query_budget.h"
+#include "query_plan.h"
+#include "task_scheduler.h"
 
 using namespace std;
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 const double RELEVANCE_PRECISION = 1e-6;
 
+// How AddDocuments keeps document text: COPY stores its own copy, REFERENCE
+// only views text the caller keeps alive (see RetainExternalStorage)
+enum class TextStorage { COPY, REFERENCE };
+
+struct DocumentRecord {
+  int id = 0;
+  string_view text{};
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  int rating = 0; // already averaged
+};
+
+// Named part of a document such as its title or tags
+struct DocumentField {
+  string_view name;
+  string_view text;
+};
+
+// Relevance multiplier per field name, 1 for fields not listed
+using FieldWeights = map<string, double, less<>>;
+
+// Typo tolerance for plus words: every query word of at least
+// min_word_length characters is expanded to at most max_expansions
+// dictionary terms within max_edits (0..2) edits. A term found with d edits
+// contributes edit_penalty^d of its regular relevance.
+struct FuzzySearchParams {
+  int max_edits = 1;
+  size_t max_expansions = 8;
+  size_t min_word_length = 3;
+  double edit_penalty = 0.5;
+};
+
+// What PruneFrequentWords does with the words it finds
+enum class PruningMode { DROP, DEMOTE };
+
+// What a server keeps besides the inverted index. FULL also stores copied
+// document texts and the per-document word frequencies; SEARCH_AND_MATCH
+// keeps only the latter. SEARCH_ONLY keeps neither: GetWordFrequencies (and
+// so RemoveDuplicates) is unavailable, MatchDocument probes the postings,
+// and removing or updating a document or adding stop words takes a pass
+// over the whole index.
+enum class StorageProfile { SEARCH_ONLY, SEARCH_AND_MATCH, FULL };
+
+struct SearchServerOptions {
+  // Backs every index container and the stored document texts, e.g. a
+  // monotonic arena for an index that is built once. It must outlive the
+  // server and be thread-safe if documents are removed with execution::par.
+  pmr::memory_resource *memory_resource = pmr::get_default_resource();
+  StorageProfile storage_profile = StorageProfile::FULL;
+};
+
+class PreparedQuery;
+
 class SearchServer {
+  friend class ShardedSearchServer;
+  friend class PreparedQuery;
+  friend class TieredSearchServer;
+  friend class DurableSearchServer;
+
 public:
-  SearchServer() = default;
+  SearchServer() : SearchServer(SearchServerOptions{}) {}
+
+  explicit SearchServer(const SearchServerOptions &options);
 
-  explicit SearchServer(string_view stopwords);
+  explicit SearchServer(string_view stopwords,
+                        const SearchServerOptions &options = {});
 
-  explicit SearchServer(const string &stopwords);
+  explicit SearchServer(const string &stopwords,
+                        const SearchServerOptions &options = {});
 
-  template <typename Iterable> explicit SearchServer(Iterable stopwords);
+  template <typename Iterable>
+  explicit SearchServer(Iterable stopwords,
+                        const SearchServerOptions &options = {});
 
+  // Index keys are views into the server's own dictionary. Moving keeps the
+  // memory resource, assigning could copy into another one.
+  SearchServer(const SearchServer &) = delete;
+  SearchServer &operator=(const SearchServer &) = delete;
+  SearchServer(SearchServer &&) = default;
+  SearchServer &operator=(SearchServer &&) = delete;
+
+  // Also removes the new stop words from documents already indexed, as if
+  // they had been stop words all along
   bool SetStopWords(string_view text);
 
+  // Finds words contained in more than max_document_ratio of the documents.
+  // DROP makes them stop words; DEMOTE keeps their postings but scores them
+  // only for queries that have no other indexed plus words. Returns the
+  // number of words pruned.
+  size_t PruneFrequentWords(double max_document_ratio,
+                            PruningMode mode = PruningMode::DROP);
+
+  void EnableFuzzySearch(const FuzzySearchParams &params = {});
+
+  void DisableFuzzySearch() { fuzzy_params_.reset(); }
+
   // -------------------------------------------
 
   template <typename StringAlikeObject>
@@ -38,8 +135,47 @@ public:
   void AddDocument(int document_id, string_view document, DocumentStatus status,
                    const vector<int> &ratings);
 
+  // Indexes the fields' texts as one document and also keeps postings per
+  // field name, which queries with FieldWeights read. Servers whose
+  // documents have no fields keep none.
+  void AddDocument(int document_id, const vector<DocumentField> &fields,
+                   DocumentStatus status, const vector<int> &ratings);
+
+  // Replaces the text, status and ratings of an existing document. Only the
+  // postings of words whose frequency changed are touched.
+  template <typename StringAlikeObject>
+  void UpdateDocument(int document_id, StringAlikeObject document,
+                      DocumentStatus status, const vector<int> &ratings);
+
+  void UpdateDocument(int document_id, string_view document,
+                      DocumentStatus status, const vector<int> &ratings);
+
+  // Attribute updates leave the postings alone
+  void SetDocumentStatus(int document_id, DocumentStatus status);
+
+  void SetDocumentRating(int document_id, const vector<int> &ratings);
+
+  // Adds all records or, if any of them is invalid, none. Documents are
+  // split into words in parallel and then inserted into the index.
+  void AddDocuments(const vector<DocumentRecord> &records,
+                    TextStorage storage = TextStorage::COPY);
+
+  void AddDocuments(const execution::sequenced_policy &,
+                    const vector<DocumentRecord> &records,
+                    TextStorage storage = TextStorage::COPY);
+
+  void AddDocuments(const execution::parallel_policy &,
+                    const vector<DocumentRecord> &records,
+                    TextStorage storage = TextStorage::COPY);
+
+  // Keeps storage alive as long as the server, e.g. a memory-mapped corpus
+  // that documents added with TextStorage::REFERENCE point into
+  void RetainExternalStorage(shared_ptr<const void> storage);
+
   // -------------------------------------------
 
+  // Documents come by relevance, equal within RELEVANCE_PRECISION, then by
+  // rating and then by id, whatever order a strategy finds them in
   template <typename StringAlikeObject>
   [[nodiscard]] vector<Document>
   FindTopDocuments(StringAlikeObject raw_query) const;
@@ -65,6 +201,84 @@ public:
   FindTopDocuments(ExecPolicy &, StringAlikeObject raw_query,
                    DocumentFilter doc_filter) const;
 
+  // Stops scoring once the budget runs out or is cancelled and returns the
+  // best documents found so far
+  template <typename ExecPolicy, typename DocumentFilter>
+  [[nodiscard]] QueryResults
+  FindTopDocuments(ExecPolicy &, string_view raw_query,
+                   DocumentFilter doc_filter, const QueryBudget &budget) const;
+
+  template <typename ExecPolicy, typename DocumentFilter>
+  [[nodiscard]] QueryResults
+  FindTopDocuments(ExecPolicy &, const PreparedQuery &query,
+                   DocumentFilter doc_filter, const QueryBudget &budget) const;
+
+  // Scores the term frequencies of each field times its weight. Throws
+  // invalid_argument if a weight is negative.
+  template <typename ExecPolicy, typename DocumentFilter>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(ExecPolicy &, string_view raw_query,
+                   DocumentFilter doc_filter,
+                   const FieldWeights &field_weights) const;
+
+  // Top documents passing doc_filter and counts of every document matching
+  // the query whatever its status and rating, taken in the same scan
+  template <typename ExecPolicy, typename DocumentFilter>
+  [[nodiscard]] FacetedResults
+  FindTopDocumentsWithFacets(ExecPolicy &policy, string_view raw_query,
+                             DocumentFilter doc_filter,
+                             int rating_bucket_width = 1) const;
+
+  template <typename DocumentFilter>
+  [[nodiscard]] FacetedResults
+  FindTopDocumentsWithFacets(string_view raw_query, DocumentFilter doc_filter,
+                             int rating_bucket_width = 1) const;
+
+  // Calls consumer(first, last) with the top documents while they are still
+  // in the query's scratch memory, so nothing is allocated for them
+  template <typename ExecPolicy, typename DocumentFilter, typename Consumer>
+  void VisitTopDocuments(ExecPolicy &policy, string_view raw_query,
+                         DocumentFilter doc_filter, Consumer consumer) const;
+
+  template <typename ExecPolicy, typename DocumentFilter, typename Consumer>
+  void VisitTopDocuments(ExecPolicy &policy, const PreparedQuery &query,
+                         DocumentFilter doc_filter, Consumer consumer) const;
+
+  // Calls consumer(index, first, last) with the results
+  // FindTopDocuments(raw_queries[index]) would return, in order of index.
+  // Each posting list the batch needs is read once and its contributions go
+  // to every query that has the word, so batches sharing frequent words
+  // read less memory.
+  void VisitTopDocumentsBatch(
+      const vector<string> &raw_queries,
+      const function<void(size_t, const Document *, const Document *)>
+          &consumer) const;
+
+  // ---------------------------------------------
+
+  // Parses raw_query once for repeated execution, see PreparedQuery
+  [[nodiscard]] PreparedQuery PrepareQuery(string_view raw_query) const;
+
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(const PreparedQuery &query) const;
+
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(const execution::sequenced_policy &,
+                   const PreparedQuery &query) const;
+
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(const execution::parallel_policy &,
+                   const PreparedQuery &query) const;
+
+  template <typename DocumentFilter>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(const PreparedQuery &query, DocumentFilter doc_filter) const;
+
+  template <typename ExecPolicy, typename DocumentFilter>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(ExecPolicy &, const PreparedQuery &query,
+                   DocumentFilter doc_filter) const;
+
   // ---------------------------------------------
 
   using WordsAndStatus = tuple<vector<string_view>, DocumentStatus>;
@@ -83,11 +297,112 @@ public:
                                              StringAlikeObject raw_query,
                                              int document_id) const;
 
+  [[nodiscard]] WordsAndStatus MatchDocument(const PreparedQuery &query,
+                                             int document_id) const;
+
+  [[nodiscard]] WordsAndStatus MatchDocument(const execution::sequenced_policy &,
+                                             const PreparedQuery &query,
+                                             int document_id) const;
+
+  [[nodiscard]] WordsAndStatus MatchDocument(const execution::parallel_policy &,
+                                             const PreparedQuery &query,
+                                             int document_id) const;
+
+  // ---------------------------------------------
+
+  // Strategy and term statistics FindTopDocuments would use for the query
+  [[nodiscard]] QueryPlan ExplainQuery(string_view raw_query) const;
+
+  [[nodiscard]] QueryPlan ExplainQuery(const execution::sequenced_policy &,
+                                       string_view raw_query) const;
+
+  [[nodiscard]] QueryPlan ExplainQuery(const execution::parallel_policy &,
+                                       string_view raw_query) const;
+
+  // ---------------------------------------------
+
+  // Runs the query as a task of the server's scheduler, its own parallel
+  // work shares the same threads
+  template <typename StringAlikeObject,
+            typename DocumentFilter = DocumentStatus>
+  [[nodiscard]] future<vector<Document>>
+  FindTopDocumentsAsync(StringAlikeObject raw_query,
+                        DocumentFilter doc_filter = DocumentStatus::ACTUAL,
+                        TaskPriority priority = TaskPriority::NORMAL) const;
+
+  // Every parallel code path runs on this scheduler, the process-wide
+  // TaskScheduler::GetDefault() unless set otherwise
+  void SetTaskScheduler(shared_ptr<TaskScheduler> scheduler);
+
+  [[nodiscard]] TaskScheduler &GetTaskScheduler() const { return *scheduler_; }
+
+  // Runs queries with strategy wherever it applies instead of the planner's
+  // choice, nullopt restores the planner. Meant for tests and benchmarks
+  // comparing strategies.
+  void ForceQueryStrategy(optional<QueryStrategy> strategy) {
+    forced_strategy_ = strategy;
+  }
+
+  // Documents closest to document_id by cosine of TF-IDF vectors, the
+  // document itself left out. Only its heaviest words are looked up, so
+  // documents sharing none of those are not found.
+  template <typename DocumentFilter = DocumentStatus,
+            enable_if_t<!is_integral_v<DocumentFilter>, int> = 0>
+  [[nodiscard]] vector<Document>
+  FindSimilarDocuments(int document_id,
+                       DocumentFilter doc_filter = DocumentStatus::ACTUAL,
+                       size_t count = MAX_RESULT_DOCUMENT_COUNT) const;
+
+  [[nodiscard]] vector<Document> FindSimilarDocuments(int document_id,
+                                                      size_t count) const;
+
+  // Norm of every document's TF-IDF vector. Without them
+  // FindSimilarDocuments computes the norms of the candidates that may make
+  // the top from their words. Adding or removing a document drops them.
+  void BuildSimilarityIndex();
+
+  [[nodiscard]] bool HasSimilarityIndex() const {
+    return document_norms_.has_value();
+  }
+
+  // Documents FindTopDocuments could return for raw_query, whatever their
+  // status, counted without scoring. APPROXIMATE is exact too unless hit
+  // count sketches are built.
+  [[nodiscard]] HitCount
+  CountMatchingDocuments(string_view raw_query,
+                         HitCountMode mode = HitCountMode::EXACT) const;
+
+  // HyperLogLog sketch of each long posting list, so approximate counts
+  // merge sketches instead of reading those lists. Adding or removing a
+  // document drops them.
+  void BuildHitCountSketches();
+
+  [[nodiscard]] bool HasHitCountSketches() const {
+    return hit_count_sketches_.has_value();
+  }
+
+  // Minimal perfect hash over the vocabulary, so query parsing, posting
+  // lookups and MatchDocument resolve a word with one hash instead of a walk
+  // over the sorted dictionary. Stop words stay in their own small set.
+  // Adding or removing a document or a stop word drops it.
+  void Freeze();
+
+  [[nodiscard]] bool IsFrozen() const { return frozen_terms_.has_value(); }
+
   // ---------------------------------------------
 
   [[nodiscard]] int GetDocumentCount() const { return documents_.size(); }
 
-  [[nodiscard]] const map<string_view, double> &
+  [[nodiscard]] StorageProfile GetStorageProfile() const {
+    return storage_profile_;
+  }
+
+  // Read from counters kept up to date by every change; only the posting
+  // list histogram takes a pass over the vocabulary
+  [[nodiscard]] MemoryStats GetMemoryStats() const;
+
+  // Throws logic_error in the SEARCH_ONLY storage profile
+  [[nodiscard]] const pmr::map<string_view, double> &
   GetWordFrequencies(int document_id) const;
 
   void RemoveDocument(int document_id);
@@ -101,9 +416,23 @@ public:
 
 private:
   struct DocumentData {
-    int rating;
-    DocumentStatus status;
-    string document;
+    explicit DocumentData(pmr::memory_resource *text_resource)
+        : stored_text(text_resource) {}
+
+    int rating = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    // Sum of the squared term frequencies, bounds the norm of the document
+    // in FindSimilarDocuments
+    double squared_term_freqs = 0;
+    string_view text;
+    // Empty when text points into external storage
+    pmr::string stored_text;
+  };
+
+  using WordFrequencies = vector<pair<string_view, double>>;
+
+  struct FrozenTerm {
+    const pmr::map<int, double> *postings = nullptr;
   };
 
   struct QueryWord {
@@ -112,21 +441,182 @@ private:
     bool is_stop;
   };
 
+  struct PlannedTerm {
+    // Position in Query::plus_words
+    size_t index;
+    // The word's postings or those of a field the query weighs
+    const pmr::map<int, double> *postings;
+    double factor;
+  };
+
+  struct ExecutionPlan {
+    explicit ExecutionPlan(pmr::memory_resource *resource)
+        : plus_terms(resource), minus_terms(resource), excluded_ids(resource) {}
+
+    QueryStrategy strategy = QueryStrategy::TERM_AT_A_TIME;
+    MinusWordsStrategy minus_words_strategy = MinusWordsStrategy::NONE;
+    // Words found in the index; plus words rarest first, minus words most
+    // frequent first
+    pmr::vector<PlannedTerm> plus_terms;
+    pmr::vector<PlannedTerm> minus_terms;
+    size_t plus_postings = 0;
+    size_t minus_postings = 0;
+    // Sorted, see CollectExcludedDocuments
+    pmr::vector<int> excluded_ids;
+    // Charged for plus-word postings, nullptr if the query is unbounded
+    QueryBudgetTracker *budget = nullptr;
+    // Counts every match, nullptr if not wanted. The filter is then applied
+    // only to matches, see AcceptMatch.
+    FacetCounts *facets = nullptr;
+  };
+
+  // Usually lives in the QueryArenaScope of the thread running the query
   struct Query {
-    vector<string_view> plus_words{};
-    vector<string_view> minus_words{};
+    explicit Query(pmr::memory_resource *resource = pmr::get_default_resource())
+        : plus_words(resource), minus_words(resource), plus_weights(resource),
+          plus_inv_doc_freqs(resource), plus_postings(resource),
+          minus_postings(resource), field_weights(resource) {}
+
+    pmr::vector<string_view> plus_words;
+    pmr::vector<string_view> minus_words;
+    // Relevance multiplier per plus word, empty unless fuzzy search is on
+    pmr::vector<double> plus_weights;
+    // Inverse document frequency per plus word computed by the caller over a
+    // larger corpus (see ShardedSearchServer) or in advance (see
+    // PreparedQuery), empty to use this index
+    pmr::vector<double> plus_inv_doc_freqs;
+    // Postings per word looked up in advance, nullptr if the word is not
+    // indexed; empty to look them up
+    pmr::vector<const pmr::map<int, double> *> plus_postings;
+    pmr::vector<const pmr::map<int, double> *> minus_postings;
+    // Index in fields_ and weight of every field weighed other than 1
+    pmr::vector<pair<size_t, double>> field_weights;
+  };
+
+  // Postings of one field name, with term frequencies as shares of the whole
+  // document, so a word's frequencies over a document's fields add up to
+  // its entry in word_to_docs_freq_
+  struct Field {
+    Field(string name, pmr::memory_resource *resource)
+        : name(move(name)), word_to_docs_freq(resource) {}
+
+    string name;
+    pmr::map<string_view, pmr::map<int, double>> word_to_docs_freq;
+  };
+
+  // One per component of GetMemoryStats(), all over the options' resource.
+  // Held by pointer so the containers' allocators survive a move.
+  struct ComponentResources {
+    explicit ComponentResources(pmr::memory_resource *upstream)
+        : vocabulary(upstream), postings(upstream), forward_index(upstream),
+          document_text(upstream), attributes(upstream),
+          stop_words(upstream) {}
+
+    CountingResource vocabulary;
+    CountingResource postings;
+    CountingResource forward_index;
+    CountingResource document_text;
+    CountingResource attributes;
+    CountingResource stop_words;
   };
 
-  map<string_view, map<int, double>> word_to_docs_freq_;
-  map<int, map<string_view, double>> doc_to_words_freq_;
-  map<int, DocumentData> documents_;
-  set<string, less<>> stop_words_;
-  set<int> documents_ids_;
+  unique_ptr<ComponentResources> resources_;
+  StorageProfile storage_profile_;
+  pmr::set<pmr::string, less<>> dictionary_;
+  pmr::map<string_view, pmr::map<int, double>> word_to_docs_freq_;
+  pmr::map<int, pmr::map<string_view, double>> doc_to_words_freq_;
+  pmr::map<int, DocumentData> documents_;
+  pmr::set<pmr::string, less<>> stop_words_;
+  pmr::set<int> documents_ids_;
+  // Keys of word_to_docs_freq_, see PruneFrequentWords
+  pmr::set<string_view> demoted_words_;
+  optional<FuzzySearchParams> fuzzy_params_;
+  vector<shared_ptr<const void>> external_storage_;
+  shared_ptr<TaskScheduler> scheduler_ = TaskScheduler::GetDefault();
+  optional<QueryStrategy> forced_strategy_;
+  // Entries of word_to_docs_freq_'s inner maps
+  size_t posting_count_ = 0;
+  // Words by the length bucket of their postings, see
+  // MemoryStats::posting_list_lengths; may end with empty buckets
+  vector<size_t> posting_list_lengths_;
+  // Changes whenever prepared queries' terms may have, see OnIndexChanged
+  uint64_t generation_ = 0;
+  optional<unordered_map<int, double>> document_norms_;
+  // Empty unless documents were added with fields
+  vector<Field> fields_;
+  size_t field_posting_count_ = 0;
+  // Keyed by posting list, which stays put until the sketches are dropped
+  optional<unordered_map<const pmr::map<int, double> *, HyperLogLog>>
+      hit_count_sketches_;
+  // Keys view the dictionary, values the postings
+  optional<MinimalPerfectHash<FrozenTerm>> frozen_terms_;
 
   static int ComputeAverageRating(const vector<int> &ratings);
 
+  // Throws invalid_argument
+  static void CheckFuzzySearchParams(const FuzzySearchParams &params);
+
   double ComputeWordInvDocFreq(string_view word) const;
 
+  double ComputePlusWordFactor(const Query &query, size_t index) const;
+
+  string_view InternWord(string_view word);
+
+  void CheckNewDocument(int document_id, string_view document) const;
+
+  // Sorted by word, computed without touching the index
+  WordFrequencies ComputeWordFrequencies(string_view document) const;
+
+  void IndexDocument(int document_id, const DocumentRecord &record,
+                     TextStorage storage, const WordFrequencies &words);
+
+  // Drops what was derived from the postings
+  void OnIndexChanged() {
+    document_norms_.reset();
+    hit_count_sketches_.reset();
+    frozen_terms_.reset();
+    ++generation_;
+  }
+
+  // Brings the document's postings to words, returns whether any changed
+  bool UpdatePostings(int document_id, const WordFrequencies &words);
+
+  bool HasForwardIndex() const {
+    return storage_profile_ != StorageProfile::SEARCH_ONLY;
+  }
+
+  // Sorted by word, from the forward index or else a pass over the postings
+  WordFrequencies CollectDocumentWords(int document_id) const;
+
+  // Dictionary key of word if the document contains it, otherwise empty
+  string_view FindDocumentWord(int document_id, string_view word) const;
+
+  void EraseWordIfUnused(string_view word);
+
+  // Moves a word whose postings went from old_size to new_size entries to
+  // its new bucket of posting_list_lengths_
+  void OnPostingsResized(size_t old_size, size_t new_size);
+
+  size_t FindOrAddField(string_view name);
+
+  // Must run before the document's words leave word_to_docs_freq_
+  void RemoveFieldPostings(int document_id, const WordFrequencies &words);
+
+  // Throws invalid_argument for negative weights
+  void SetFieldWeights(Query &query, const FieldWeights &field_weights) const;
+
+  // Removes the words' postings and rescales the remaining term frequencies
+  // of the documents they were in
+  void RemoveWordsFromIndex(const vector<string_view> &words);
+
+  const pmr::map<int, double> *FindPostings(string_view word) const;
+
+  // Exact relevance with additions in plan order, as the exhaustive
+  // strategies do; contributions is scratch space
+  double ComputeRelevance(const Query &query, const ExecutionPlan &plan,
+                          int document_id,
+                          pmr::vector<double> &contributions) const;
+
   bool IsStopWord(string_view word) const;
 
   static bool ContainsSpecialChars(string_view text);
@@ -135,30 +625,183 @@ private:
 
   QueryWord ParseQueryWord(string_view text) const;
 
-  Query ParseQuery(string_view text) const;
+  Query ParseQuery(string_view text, pmr::memory_resource *resource =
+                                         pmr::get_default_resource()) const;
+
+  // Dictionary words within max_edits of word, with their distances
+  vector<pair<string_view, int>> FindFuzzyTerms(string_view word,
+                                                int max_edits) const;
+
+  void ExpandFuzzyWords(Query &query) const;
+
+  // Adds weighted expansions of the plus words: find_terms(word) lists the
+  // (term, distance) pairs close enough to word, count_documents(term) the
+  // documents a term is in
+  template <typename TermFinder, typename DocumentCounter>
+  static void ExpandFuzzyWords(Query &query, const FuzzySearchParams &params,
+                               TermFinder find_terms,
+                               DocumentCounter count_documents);
+
+  // Fills the query's postings and inverse document frequencies
+  void ResolveTerms(Query &query) const;
+
+  // Throws invalid_argument unless this server prepared the query
+  void CheckPreparedHere(const PreparedQuery &prepared) const;
+
+  // The prepared query itself while the index is unchanged, otherwise a copy
+  // in refreshed with its terms resolved again
+  const Query &ResolvePreparedQuery(const PreparedQuery &prepared,
+                                    optional<Query> &refreshed,
+                                    pmr::memory_resource *resource) const;
+
+  WordsAndStatus MatchQuery(const Query &query, int document_id) const;
+
+  WordsAndStatus MatchQuery(const execution::parallel_policy &,
+                            const Query &query, int document_id) const;
+
+  template <typename Documents>
+  static void
+  SortAndTrimDocuments(Documents &documents,
+                       size_t count = MAX_RESULT_DOCUMENT_COUNT);
+
+  struct SimilarityTerm {
+    const pmr::map<int, double> *postings;
+    // TF-IDF in the source document
+    double weight;
+    double inv_doc_freq;
+  };
+
+  struct SimilarityCandidate {
+    double dot_product = 0;
+    // Of the looked up words
+    double squared_weights = 0;
+    double squared_term_freqs = 0;
+  };
+
+  // Heaviest words of the document by TF-IDF, returns the norm of its whole
+  // vector
+  double SelectSimilarityTerms(int document_id,
+                               pmr::vector<SimilarityTerm> &terms) const;
+
+  double GetDocumentNorm(int document_id) const;
+
+  // At most the norm of the document, from the looked up words and a bound
+  // on the inverse document frequencies of the others
+  double GetDocumentNormBound(int document_id,
+                              const SimilarityCandidate &candidate,
+                              double min_inv_doc_freq) const;
+
+  // Bounded by the longest posting list
+  double GetMinInvDocFreq() const;
+
+  size_t CountExactMatches(const ExecutionPlan &plan,
+                           pmr::memory_resource *resource) const;
+
+  HitCount EstimateMatches(const ExecutionPlan &plan) const;
+
+  template <typename ExecPolicy, typename DocumentFilter>
+  vector<Document> FindTopDocumentsByQuery(ExecPolicy &policy,
+                                           const Query &query,
+                                           DocumentFilter doc_filter) const;
+
+  template <typename ExecPolicy, typename DocumentFilter, typename Consumer>
+  void VisitTopDocumentsByQuery(ExecPolicy &policy, const Query &query,
+                                DocumentFilter doc_filter, Consumer consumer,
+                                QueryBudgetTracker *budget = nullptr,
+                                FacetCounts *facets = nullptr) const;
+
+  template <typename ExecPolicy, typename DocumentFilter>
+  QueryResults FindTopDocumentsWithinBudget(ExecPolicy &policy,
+                                            const Query &query,
+                                            DocumentFilter doc_filter,
+                                            const QueryBudget &budget) const;
+
+  ExecutionPlan PlanQuery(const Query &query, bool allow_parallel,
+                          pmr::memory_resource *resource) const;
+
+  QueryPlan DescribePlan(const Query &query, const ExecutionPlan &plan) const;
+
+  // Fills excluded_ids if the plan collects the minus words' documents
+  void CollectExcludedDocuments(ExecutionPlan &plan) const;
+
+  bool IsExcluded(const ExecutionPlan &plan, int document_id) const;
+
+  // Filter of a scoring loop, which lets everything through when the plan
+  // counts facets
+  template <typename DocumentFilter>
+  static bool PassesFilter(const ExecutionPlan &plan, int document_id,
+                           const DocumentData &data,
+                           DocumentFilter &doc_filter) {
+    return plan.facets || doc_filter(document_id, data.status, data.rating);
+  }
+
+  // Called once per match that is not excluded
+  template <typename DocumentFilter>
+  static bool AcceptMatch(const ExecutionPlan &plan, int document_id,
+                          const DocumentData &data,
+                          DocumentFilter &doc_filter) {
+    if (!plan.facets) {
+      return true;
+    }
+    plan.facets->Add(data.status, data.rating);
+    return doc_filter(document_id, data.status, data.rating);
+  }
 
   template <typename DocumentFilter>
-  vector<Document> FindAllDocuments(const Query &query,
-                                    DocumentFilter doc_filter) const;
+  pmr::vector<Document>
+  FindAllDocumentsByTerm(const ExecutionPlan &plan, DocumentFilter doc_filter,
+                         pmr::memory_resource *resource) const;
 
   template <typename DocumentFilter>
-  vector<Document> FindAllDocuments(const execution::sequenced_policy &,
-                                    const Query &query,
-                                    DocumentFilter doc_filter) const;
+  pmr::vector<Document>
+  FindAllDocumentsByDocument(const ExecutionPlan &plan,
+                             DocumentFilter doc_filter,
+                             pmr::memory_resource *resource) const;
+
+  // Stored by the parallel scan for documents with minus words. Matches are
+  // told apart by value, as field weights below 1 can round a relevance of
+  // zero to just under it.
+  static constexpr double EXCLUDED_RELEVANCE = -10;
 
   template <typename DocumentFilter>
-  vector<Document> FindAllDocuments(const execution::parallel_policy &,
-                                    Query &query,
-                                    DocumentFilter doc_filter) const;
+  pmr::vector<Document> FindAllDocuments(const execution::parallel_policy &,
+                                         const ExecutionPlan &plan,
+                                         DocumentFilter doc_filter,
+                                         pmr::memory_resource *resource) const;
+};
+
+// A query parsed once, with its words looked up in the index and their
+// inverse document frequencies computed. Executing it skips parsing. Once
+// the index changes it is stale: every execution looks its words up again
+// (prepare it anew to cache them). Stop words and fuzzy search apply as they
+// were when it was prepared. Only the server that prepared it may execute
+// it, and only while that server is alive.
+class PreparedQuery {
+public:
+  [[nodiscard]] bool IsStale() const {
+    return server_ && server_->generation_ != generation_;
+  }
+
+private:
+  friend class SearchServer;
+
+  const SearchServer *server_ = nullptr;
+  uint64_t generation_ = 0;
+  // The words of query_ view this buffer, which copies share
+  shared_ptr<const string> words_;
+  SearchServer::Query query_;
 };
 
-template <typename Iterable> SearchServer::SearchServer(Iterable stopwords) {
+template <typename Iterable>
+SearchServer::SearchServer(Iterable stopwords,
+                           const SearchServerOptions &options)
+    : SearchServer(options) {
   for (auto &word : stopwords) {
     if (!word.empty()) {
       if (ContainsSpecialChars(word)) {
         throw invalid_argument("Special characters are not allowed");
       } else {
-        stop_words_.insert(word);
+        stop_words_.emplace(word);
       }
     }
   };
@@ -171,10 +814,17 @@ void SearchServer::AddDocument(int document_id, StringAlikeObject document,
   AddDocument(document_id, string_view{document}, status, ratings);
 }
 
+template <typename StringAlikeObject>
+void SearchServer::UpdateDocument(int document_id, StringAlikeObject document,
+                                  DocumentStatus status,
+                                  const vector<int> &ratings) {
+  UpdateDocument(document_id, string_view{document}, status, ratings);
+}
+
 template <typename StringAlikeObject>
 vector<Document>
 SearchServer::FindTopDocuments(StringAlikeObject raw_query) const {
-  return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+  return FindTopDocuments(string_view{raw_query}, DocumentStatus::ACTUAL);
 }
 
 template <typename StringAlikeObject, typename DocumentFilter>
@@ -196,7 +846,7 @@ template <typename StringAlikeObject>
 [[nodiscard]] vector<Document>
 SearchServer::FindTopDocuments(const execution::sequenced_policy &,
                                StringAlikeObject raw_query) const {
-  return FindTopDocuments(raw_query);
+  return FindTopDocuments(string_view{raw_query});
 }
 
 template <typename StringAlikeObject>
@@ -215,115 +865,425 @@ template <typename ExecPolicy, typename StringAlikeObject,
 vector<Document>
 SearchServer::FindTopDocuments(ExecPolicy &policy, StringAlikeObject raw_query,
                                DocumentFilter doc_filter) const {
-  Query query = ParseQuery(string_view{raw_query});
-  vector<Document> matched_documents{};
+  QueryArenaScope scratch;
+  const Query query = ParseQuery(string_view{raw_query}, scratch.GetResource());
+  return FindTopDocumentsByQuery(policy, query, doc_filter);
+}
+
+template <typename ExecPolicy, typename DocumentFilter, typename Consumer>
+void SearchServer::VisitTopDocuments(ExecPolicy &policy, string_view raw_query,
+                                     DocumentFilter doc_filter,
+                                     Consumer consumer) const {
+  QueryArenaScope scratch;
+  const Query query = ParseQuery(raw_query, scratch.GetResource());
+  VisitTopDocumentsByQuery(policy, query, doc_filter, consumer);
+}
+
+template <typename ExecPolicy, typename DocumentFilter, typename Consumer>
+void SearchServer::VisitTopDocuments(ExecPolicy &policy,
+                                     const PreparedQuery &query,
+                                     DocumentFilter doc_filter,
+                                     Consumer consumer) const {
+  QueryArenaScope scratch;
+  optional<Query> refreshed;
+  VisitTopDocumentsByQuery(
+      policy, ResolvePreparedQuery(query, refreshed, scratch.GetResource()),
+      doc_filter, consumer);
+}
+
+template <typename DocumentFilter>
+vector<Document>
+SearchServer::FindTopDocuments(const PreparedQuery &query,
+                               DocumentFilter doc_filter) const {
+  return FindTopDocuments(execution::seq, query, doc_filter);
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+vector<Document>
+SearchServer::FindTopDocuments(ExecPolicy &policy, const PreparedQuery &query,
+                               DocumentFilter doc_filter) const {
+  QueryArenaScope scratch;
+  optional<Query> refreshed;
+  return FindTopDocumentsByQuery(
+      policy, ResolvePreparedQuery(query, refreshed, scratch.GetResource()),
+      doc_filter);
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+vector<Document>
+SearchServer::FindTopDocuments(ExecPolicy &policy, string_view raw_query,
+                               DocumentFilter doc_filter,
+                               const FieldWeights &field_weights) const {
+  QueryArenaScope scratch;
+  Query query = ParseQuery(raw_query, scratch.GetResource());
+  SetFieldWeights(query, field_weights);
+  return FindTopDocumentsByQuery(policy, query, doc_filter);
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+QueryResults SearchServer::FindTopDocuments(ExecPolicy &policy,
+                                            string_view raw_query,
+                                            DocumentFilter doc_filter,
+                                            const QueryBudget &budget) const {
+  QueryArenaScope scratch;
+  const Query query = ParseQuery(raw_query, scratch.GetResource());
+  return FindTopDocumentsWithinBudget(policy, query, doc_filter, budget);
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+QueryResults SearchServer::FindTopDocuments(ExecPolicy &policy,
+                                            const PreparedQuery &query,
+                                            DocumentFilter doc_filter,
+                                            const QueryBudget &budget) const {
+  QueryArenaScope scratch;
+  optional<Query> refreshed;
+  return FindTopDocumentsWithinBudget(
+      policy, ResolvePreparedQuery(query, refreshed, scratch.GetResource()),
+      doc_filter, budget);
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+FacetedResults SearchServer::FindTopDocumentsWithFacets(
+    ExecPolicy &policy, string_view raw_query, DocumentFilter doc_filter,
+    int rating_bucket_width) const {
+  FacetedResults results{{}, FacetCounts{rating_bucket_width}};
+  QueryArenaScope scratch;
+  const Query query = ParseQuery(raw_query, scratch.GetResource());
+  VisitTopDocumentsByQuery(
+      policy, query, doc_filter,
+      [&results](const Document *first, const Document *last) {
+        results.documents.assign(first, last);
+      },
+      nullptr, &results.facets);
+  return results;
+}
+
+template <typename DocumentFilter>
+FacetedResults SearchServer::FindTopDocumentsWithFacets(
+    string_view raw_query, DocumentFilter doc_filter,
+    int rating_bucket_width) const {
+  return FindTopDocumentsWithFacets(execution::seq, raw_query, doc_filter,
+                                    rating_bucket_width);
+}
+
+template <typename TermFinder, typename DocumentCounter>
+void SearchServer::ExpandFuzzyWords(Query &query,
+                                    const FuzzySearchParams &params,
+                                    TermFinder find_terms,
+                                    DocumentCounter count_documents) {
+  map<string_view, double> weighted_words;
+  for (string_view word : query.plus_words) {
+    weighted_words[word] = 1.0;
+    if (word.size() < params.min_word_length) {
+      continue;
+    }
+    auto terms = find_terms(word);
+    // Closest and then most widespread terms win the expansion budget
+    sort(terms.begin(), terms.end(),
+         [&count_documents](const auto &lhs, const auto &rhs) {
+           if (lhs.second != rhs.second) {
+             return lhs.second < rhs.second;
+           }
+           return count_documents(lhs.first) > count_documents(rhs.first);
+         });
+    if (terms.size() > params.max_expansions) {
+      terms.resize(params.max_expansions);
+    }
+    for (const auto &[term, distance] : terms) {
+      double &weight = weighted_words[term];
+      weight = max(weight, pow(params.edit_penalty, distance));
+    }
+  }
+  query.plus_words.clear();
+  for (const auto &[word, weight] : weighted_words) {
+    query.plus_words.push_back(word);
+    query.plus_weights.push_back(weight);
+  }
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+QueryResults SearchServer::FindTopDocumentsWithinBudget(
+    ExecPolicy &policy, const Query &query, DocumentFilter doc_filter,
+    const QueryBudget &budget) const {
+  QueryBudgetTracker tracker(budget);
+  QueryResults results;
+  VisitTopDocumentsByQuery(
+      policy, query, doc_filter,
+      [&results](const Document *first, const Document *last) {
+        results.documents.assign(first, last);
+      },
+      &tracker);
+  results.truncated = tracker.IsExhausted();
+  return results;
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+vector<Document>
+SearchServer::FindTopDocumentsByQuery(ExecPolicy &policy, const Query &query,
+                                      DocumentFilter doc_filter) const {
+  vector<Document> result;
+  VisitTopDocumentsByQuery(
+      policy, query, doc_filter,
+      [&result](const Document *first, const Document *last) {
+        result.assign(first, last);
+      });
+  return result;
+}
+
+template <typename ExecPolicy, typename DocumentFilter, typename Consumer>
+void SearchServer::VisitTopDocumentsByQuery(ExecPolicy &policy,
+                                            const Query &query,
+                                            DocumentFilter doc_filter,
+                                            Consumer consumer,
+                                            QueryBudgetTracker *budget,
+                                            FacetCounts *facets) const {
   constexpr bool is_status = is_same_v<decay_t<DocumentFilter>, DocumentStatus>;
   if constexpr (is_status) {
-    matched_documents = FindAllDocuments(
+    VisitTopDocumentsByQuery(
         policy, query,
         [doc_filter](int document_id, DocumentStatus status, int rating) {
           return status == doc_filter;
-        });
+        },
+        consumer, budget, facets);
   } else {
-    matched_documents = FindAllDocuments(policy, query, doc_filter);
+    constexpr bool is_par =
+        is_same_v<decay_t<ExecPolicy>, execution::parallel_policy>;
+    QueryArenaScope scratch;
+    ExecutionPlan plan = PlanQuery(query, is_par, scratch.GetResource());
+    plan.budget = budget;
+    plan.facets = facets;
+    pmr::vector<Document> matched_documents{scratch.GetResource()};
+    switch (plan.strategy) {
+    case QueryStrategy::TERM_AT_A_TIME:
+      CollectExcludedDocuments(plan);
+      matched_documents =
+          FindAllDocumentsByTerm(plan, doc_filter, scratch.GetResource());
+      break;
+    case QueryStrategy::DOCUMENT_AT_A_TIME:
+      CollectExcludedDocuments(plan);
+      matched_documents =
+          FindAllDocumentsByDocument(plan, doc_filter, scratch.GetResource());
+      break;
+    case QueryStrategy::PARALLEL:
+      matched_documents = FindAllDocuments(execution::par, plan, doc_filter,
+                                           scratch.GetResource());
+      break;
+    }
+    SortAndTrimDocuments(matched_documents);
+    consumer(matched_documents.data(),
+             matched_documents.data() + matched_documents.size());
   }
+}
 
-  sort(matched_documents.begin(), matched_documents.end(),
+template <typename Documents>
+void SearchServer::SortAndTrimDocuments(Documents &documents, size_t count) {
+  sort(documents.begin(), documents.end(),
        [](const Document &lhs, const Document &rhs) {
          if (abs(rhs.relevance - lhs.relevance) < RELEVANCE_PRECISION) {
-           return lhs.rating > rhs.rating;
+           // Ids make ties independent of the order documents were found in
+           return lhs.rating != rhs.rating ? lhs.rating > rhs.rating
+                                           : lhs.id < rhs.id;
          }
          return lhs.relevance > rhs.relevance;
        });
-
-  if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-    matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+  if (documents.size() > count) {
+    documents.resize(count);
   }
-  return matched_documents;
 }
 
-template <typename DocumentFilter>
+template <typename DocumentFilter,
+          enable_if_t<!is_integral_v<DocumentFilter>, int>>
 vector<Document>
-SearchServer::FindAllDocuments(const SearchServer::Query &query,
-                               DocumentFilter doc_filter) const {
-  return FindAllDocuments(execution::seq, query, doc_filter);
-}
+SearchServer::FindSimilarDocuments(int document_id, DocumentFilter doc_filter,
+                                   size_t count) const {
+  if constexpr (is_same_v<DocumentFilter, DocumentStatus>) {
+    return FindSimilarDocuments(
+        document_id,
+        [doc_filter](int document_id, DocumentStatus status, int rating) {
+          return status == doc_filter;
+        },
+        count);
+  } else {
+    QueryArenaScope scratch;
+    pmr::vector<SimilarityTerm> terms{scratch.GetResource()};
+    const double norm = SelectSimilarityTerms(document_id, terms);
+    pmr::unordered_map<int, SimilarityCandidate> candidates{
+        scratch.GetResource()};
+    for (const SimilarityTerm &term : terms) {
+      const double factor = term.weight * term.inv_doc_freq;
+      for (const auto &[id, term_freq] : *term.postings) {
+        if (id != document_id) {
+          SimilarityCandidate &candidate = candidates[id];
+          const double weight = term_freq * term.inv_doc_freq;
+          candidate.dot_product += factor * term_freq;
+          candidate.squared_weights += weight * weight;
+          candidate.squared_term_freqs += term_freq * term_freq;
+        }
+      }
+    }
 
-template <typename DocumentFilter>
-vector<Document>
-SearchServer::FindAllDocuments(const execution::sequenced_policy &,
-                               const SearchServer::Query &query,
-                               DocumentFilter doc_filter) const {
-  vector<Document> matched_documents;
-  map<int, double> doc_to_relev;
-  set<int> bad_docs;
-  for (const auto &[word, docs] : word_to_docs_freq_) {
-    if (binary_search(query.minus_words.begin(), query.minus_words.end(),
-                      word)) { // Minus word, ignore document
-      for (auto &[id, _] : docs)
-        bad_docs.insert(id);
-      continue;
+    // Upper bounds of the cosines unless the norms are built, then only the
+    // candidates that may make the top have their norms computed
+    const double min_inv_doc_freq = GetMinInvDocFreq();
+    pmr::vector<Document> bounds{scratch.GetResource()};
+    bounds.reserve(candidates.size());
+    for (const auto &[id, candidate] : candidates) {
+      const DocumentData &data = documents_.at(id);
+      if (doc_filter(id, data.status, data.rating)) {
+        const double candidate_norm =
+            document_norms_
+                ? document_norms_->at(id)
+                : GetDocumentNormBound(id, candidate, min_inv_doc_freq);
+        bounds.push_back(
+            {id, candidate.dot_product / (norm * candidate_norm), data.rating});
+      }
     }
-    if (binary_search(query.plus_words.begin(), query.plus_words.end(),
-                      word)) { // Good word, compute relevance
-      double inv_doc_freq = ComputeWordInvDocFreq(word);
-      for (const auto &[id, term_freq] : docs) {
-        if (doc_filter(id, documents_.at(id).status,
-                       documents_.at(id).rating)) {
-          doc_to_relev[id] += inv_doc_freq * term_freq;
-        }
+    sort(bounds.begin(), bounds.end(),
+         [](const Document &lhs, const Document &rhs) {
+           return lhs.relevance > rhs.relevance;
+         });
+
+    pmr::vector<Document> similar_documents{scratch.GetResource()};
+    // The count-th best cosine so far, at the front
+    pmr::vector<double> top{scratch.GetResource()};
+    for (const Document &bound : bounds) {
+      if (top.size() == count &&
+          (count == 0 || top.front() > bound.relevance + RELEVANCE_PRECISION)) {
+        break;
+      }
+      const double relevance =
+          document_norms_ ? bound.relevance
+                          : candidates.at(bound.id).dot_product /
+                                (norm * GetDocumentNorm(bound.id));
+      similar_documents.push_back({bound.id, relevance, bound.rating});
+      top.push_back(relevance);
+      push_heap(top.begin(), top.end(), greater<>());
+      if (top.size() > count) {
+        pop_heap(top.begin(), top.end(), greater<>());
+        top.pop_back();
       }
     }
+    SortAndTrimDocuments(similar_documents, count);
+    return {similar_documents.begin(), similar_documents.end()};
   }
+}
 
-  // Remove documents that have minus words from result
-  for (const auto id : bad_docs)
-    doc_to_relev.erase(id);
+template <typename DocumentFilter>
+pmr::vector<Document>
+SearchServer::FindAllDocumentsByTerm(const ExecutionPlan &plan,
+                                     DocumentFilter doc_filter,
+                                     pmr::memory_resource *resource) const {
+  pmr::unordered_map<int, double> doc_to_relev{resource};
+  doc_to_relev.reserve(min(plan.plus_postings, documents_.size()));
+  BudgetMeter meter(plan.budget, plan.plus_postings);
+  for (const PlannedTerm &term : plan.plus_terms) {
+    for (const auto &[id, term_freq] : *term.postings) {
+      if (!meter.Advance()) {
+        break;
+      }
+      const DocumentData &data = documents_.at(id);
+      if (PassesFilter(plan, id, data, doc_filter)) {
+        doc_to_relev[id] += term.factor * term_freq;
+      }
+    }
+  }
 
+  pmr::vector<Document> matched_documents{resource};
+  matched_documents.reserve(doc_to_relev.size());
   for (const auto &[id, rel] : doc_to_relev) {
-    matched_documents.push_back({id, rel, documents_.at(id).rating});
+    if (IsExcluded(plan, id)) {
+      continue;
+    }
+    const DocumentData &data = documents_.at(id);
+    if (AcceptMatch(plan, id, data, doc_filter)) {
+      matched_documents.push_back({id, rel, data.rating});
+    }
+  }
+  return matched_documents;
+}
+
+template <typename DocumentFilter>
+pmr::vector<Document>
+SearchServer::FindAllDocumentsByDocument(const ExecutionPlan &plan,
+                                         DocumentFilter doc_filter,
+                                         pmr::memory_resource *resource) const {
+  using PostingIterator = pmr::map<int, double>::const_iterator;
+  pmr::vector<pair<PostingIterator, PostingIterator>> cursors{resource};
+  for (const PlannedTerm &term : plan.plus_terms) {
+    cursors.emplace_back(term.postings->begin(), term.postings->end());
   }
 
+  pmr::vector<Document> matched_documents{resource};
+  BudgetMeter meter(plan.budget, plan.plus_postings);
+  while (true) {
+    int id = numeric_limits<int>::max();
+    size_t postings = 0;
+    for (const auto &[it, end] : cursors) {
+      if (it != end && it->first <= id) {
+        postings = it->first < id ? 1 : postings + 1;
+        id = it->first;
+      }
+    }
+    if (postings == 0 || !meter.Advance(postings)) {
+      break;
+    }
+    // Same order of additions as term at a time
+    double relevance = 0;
+    for (size_t i = 0; i < cursors.size(); ++i) {
+      auto &[it, end] = cursors[i];
+      if (it != end && it->first == id) {
+        relevance += plan.plus_terms[i].factor * it->second;
+        ++it;
+      }
+    }
+    const DocumentData &data = documents_.at(id);
+    if (!IsExcluded(plan, id) && PassesFilter(plan, id, data, doc_filter) &&
+        AcceptMatch(plan, id, data, doc_filter)) {
+      matched_documents.push_back({id, relevance, data.rating});
+    }
+  }
   return matched_documents;
 }
 
 template <typename DocumentFilter>
-vector<Document>
-SearchServer::FindAllDocuments(const execution::parallel_policy &policy,
-                               SearchServer::Query &query,
-                               DocumentFilter doc_filter) const {
+pmr::vector<Document>
+SearchServer::FindAllDocuments(const execution::parallel_policy &,
+                               const ExecutionPlan &plan,
+                               DocumentFilter doc_filter,
+                               pmr::memory_resource *resource) const {
+  // Only the calling thread may use resource, tasks allocate from the heap
+  pmr::vector<Document> matched_documents{resource};
+  ConcurrentMap<int, double> doc_to_relev_par{
+      min(plan.plus_postings, documents_.size())};
+
+  scheduler_->ForEach(
+      plan.plus_terms.begin(), plan.plus_terms.end(),
+      [&](const PlannedTerm &term) {
+        BudgetMeter meter(plan.budget, term.postings->size());
+        for (const auto &[id, term_freq] : *term.postings) {
+          if (!meter.Advance()) {
+            break;
+          }
+          if (PassesFilter(plan, id, documents_.at(id), doc_filter)) {
+            doc_to_relev_par.Add(id, term.factor * term_freq);
+          }
+        }
+      });
+
+  scheduler_->ForEach(plan.minus_terms.begin(), plan.minus_terms.end(),
+                      [&](const PlannedTerm &term) {
+                        for (const auto &[id, _] : *term.postings) {
+                          doc_to_relev_par.Store(id, EXCLUDED_RELEVANCE);
+                        }
+                      });
 
-  vector<Document> matched_documents;
-  ConcurrentMap<int, double> doc_to_relev_par{100};
-
-  for_each(policy, query.plus_words.begin(), query.plus_words.end(),
-           [&](const auto word) {
-             const auto it = word_to_docs_freq_.find(word);
-             if (it != word_to_docs_freq_.end()) {
-               double inv_doc_freq = ComputeWordInvDocFreq(word);
-               for (const auto &[id, term_freq] : it->second) {
-                 if (doc_filter(id, documents_.at(id).status,
-                                documents_.at(id).rating)) {
-                   doc_to_relev_par[id].ref_to_value +=
-                       inv_doc_freq * term_freq;
-                 }
-               }
-             }
-           });
-
-  for_each(policy, query.minus_words.begin(), query.minus_words.end(),
-           [&](const auto word) {
-             const auto it = word_to_docs_freq_.find(word);
-             if (it != word_to_docs_freq_.end()) {
-               for (const auto &[id, _] : it->second) {
-                 doc_to_relev_par[id].ref_to_value = -10;
-               }
-             }
-           });
-
-  for (const auto &[id, rel] : doc_to_relev_par.BuildOrdinaryMap()) {
-    if (rel >= 0) {
-      matched_documents.push_back({id, rel, documents_.at(id).rating});
+  for (const auto &[id, rel] : doc_to_relev_par.BuildItems(*scheduler_)) {
+    if (rel == EXCLUDED_RELEVANCE) {
+      continue;
+    }
+    const DocumentData &data = documents_.at(id);
+    if (AcceptMatch(plan, id, data, doc_filter)) {
+      matched_documents.push_back({id, rel, data.rating});
     }
   }
 
@@ -334,24 +1294,9 @@ template <typename StringAlikeObject>
 SearchServer::WordsAndStatus
 SearchServer::MatchDocument(StringAlikeObject raw_query,
                             int document_id) const {
-  Query query = ParseQuery(string_view{raw_query});
-  set<string_view> words;
-  for (const auto &[word, docs] : word_to_docs_freq_) {
-    if (!docs.count(document_id)) { // no such word in document
-      continue;
-    }
-    if (binary_search(query.minus_words.begin(), query.minus_words.end(),
-                      word)) { // minus word found in query
-      return {vector<string_view>(), documents_.at(document_id).status};
-    }
-    if (binary_search(query.plus_words.begin(), query.plus_words.end(),
-                      word)) { // normal word found in query
-      words.insert(word);
-    }
-  }
-  vector<string_view> words_vector(words.begin(), words.end());
-  sort(words_vector.begin(), words_vector.end());
-  return {words_vector, documents_.at(document_id).status};
+  QueryArenaScope scratch;
+  return MatchQuery(ParseQuery(string_view{raw_query}, scratch.GetResource()),
+                    document_id);
 }
 
 template <typename StringAlikeObject>
@@ -364,36 +1309,23 @@ SearchServer::MatchDocument(const execution::sequenced_policy &,
 
 template <typename StringAlikeObject>
 SearchServer::WordsAndStatus
-SearchServer::MatchDocument(const execution::parallel_policy &,
+SearchServer::MatchDocument(const execution::parallel_policy &policy,
                             StringAlikeObject raw_query,
                             int document_id) const {
-  Query query = ParseQuery(string_view{raw_query});
-  vector<string_view> &mwords = query.minus_words, &pwords = query.plus_words;
-
-  if (any_of(execution::par, mwords.begin(), mwords.end(),
-             [this, document_id](string_view word) {
-               auto it = word_to_docs_freq_.find(word);
-               if (it != word_to_docs_freq_.end()) {
-                 return bool((*it).second.count(document_id));
-               }
-               return false;
-             })) {
-    return {vector<string_view>(), documents_.at(document_id).status};
-  }
+  QueryArenaScope scratch;
+  return MatchQuery(policy,
+                    ParseQuery(string_view{raw_query}, scratch.GetResource()),
+                    document_id);
+}
 
-  for_each(execution::par, pwords.begin(), pwords.end(),
-           [this, &document_id](string_view &word) {
-             auto it = word_to_docs_freq_.find(word);
-             if (!(it != word_to_docs_freq_.end() &&
-                   (*it).second.count(document_id))) {
-               word = "";
-             }
-           });
-
-  sort(pwords.begin(), pwords.end());
-  pwords.erase(unique(pwords.begin(), pwords.end()), pwords.end());
-  if (pwords.front().empty()) {
-    pwords.erase(query.plus_words.begin());
-  }
-  return {pwords, documents_.at(document_id).status};
-}
\ No newline at end of file
+template <typename StringAlikeObject, typename DocumentFilter>
+future<vector<Document>>
+SearchServer::FindTopDocumentsAsync(StringAlikeObject raw_query,
+                                    DocumentFilter doc_filter,
+                                    TaskPriority priority) const {
+  return scheduler_->Submit(
+      [this, query = string{raw_query}, doc_filter] {
+        return FindTopDocuments(execution::par, query, doc_filter);
+      },
+      priority);
+}
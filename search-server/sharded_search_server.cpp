@@ -0,0 +1,199 @@
+#include "sharded_search_server.h"
+
+ShardedSearchServer::ShardedSearchServer(size_t shard_count)
+    : ShardedSearchServer(shard_count, string_view{}) {}
+
+bool ShardedSearchServer::SetStopWords(string_view text) {
+  for (auto &shard : shards_) {
+    lock_guard lock(shard->mutex);
+    shard->server.SetStopWords(text);
+  }
+  return true;
+}
+
+void ShardedSearchServer::EnableFuzzySearch(const FuzzySearchParams &params) {
+  SearchServer::CheckFuzzySearchParams(params);
+  vector<unique_lock<shared_mutex>> locks;
+  for (auto &shard : shards_) {
+    locks.emplace_back(shard->mutex);
+  }
+  fuzzy_params_ = params;
+}
+
+void ShardedSearchServer::DisableFuzzySearch() {
+  vector<unique_lock<shared_mutex>> locks;
+  for (auto &shard : shards_) {
+    locks.emplace_back(shard->mutex);
+  }
+  fuzzy_params_.reset();
+}
+
+void ShardedSearchServer::SetTaskScheduler(
+    shared_ptr<TaskScheduler> scheduler) {
+  for (auto &shard : shards_) {
+    lock_guard lock(shard->mutex);
+    shard->server.SetTaskScheduler(scheduler);
+  }
+}
+
+void ShardedSearchServer::AddDocument(int document_id, string_view document,
+                                      DocumentStatus status,
+                                      const vector<int> &ratings) {
+  Shard &shard = GetShard(document_id);
+  {
+    lock_guard lock(shard.mutex);
+    shard.server.AddDocument(document_id, document, status, ratings);
+  }
+  lock_guard lock(ids_mutex_);
+  documents_ids_.insert(document_id);
+}
+
+void ShardedSearchServer::UpdateDocument(int document_id,
+                                         string_view document,
+                                         DocumentStatus status,
+                                         const vector<int> &ratings) {
+  Shard &shard = GetShard(document_id);
+  lock_guard lock(shard.mutex);
+  shard.server.UpdateDocument(document_id, document, status, ratings);
+}
+
+void ShardedSearchServer::SetDocumentStatus(int document_id,
+                                            DocumentStatus status) {
+  Shard &shard = GetShard(document_id);
+  lock_guard lock(shard.mutex);
+  shard.server.SetDocumentStatus(document_id, status);
+}
+
+void ShardedSearchServer::SetDocumentRating(int document_id,
+                                            const vector<int> &ratings) {
+  Shard &shard = GetShard(document_id);
+  lock_guard lock(shard.mutex);
+  shard.server.SetDocumentRating(document_id, ratings);
+}
+
+int ShardedSearchServer::GetDocumentCount() const {
+  lock_guard lock(ids_mutex_);
+  return documents_ids_.size();
+}
+
+MemoryStats ShardedSearchServer::GetMemoryStats() const {
+  MemoryStats stats;
+  for (const auto &shard : shards_) {
+    shared_lock lock(shard->mutex);
+    stats += shard->server.GetMemoryStats();
+  }
+  return stats;
+}
+
+map<string, double>
+ShardedSearchServer::GetWordFrequencies(int document_id) const {
+  const Shard &shard = GetShard(document_id);
+  shared_lock lock(shard.mutex);
+  const auto &frequencies = shard.server.GetWordFrequencies(document_id);
+  return {frequencies.begin(), frequencies.end()};
+}
+
+void ShardedSearchServer::RemoveDocument(int document_id) {
+  RemoveDocument(execution::seq, document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(execution::sequenced_policy policy,
+                                         int document_id) {
+  Shard &shard = GetShard(document_id);
+  {
+    lock_guard lock(shard.mutex);
+    shard.server.RemoveDocument(policy, document_id);
+  }
+  lock_guard lock(ids_mutex_);
+  documents_ids_.erase(document_id);
+}
+
+void ShardedSearchServer::RemoveDocument(execution::parallel_policy policy,
+                                         int document_id) {
+  Shard &shard = GetShard(document_id);
+  {
+    lock_guard lock(shard.mutex);
+    shard.server.RemoveDocument(policy, document_id);
+  }
+  lock_guard lock(ids_mutex_);
+  documents_ids_.erase(document_id);
+}
+
+ShardedSearchServer::Shard &ShardedSearchServer::GetShard(int document_id) {
+  return *shards_[static_cast<unsigned>(document_id) % shards_.size()];
+}
+
+const ShardedSearchServer::Shard &
+ShardedSearchServer::GetShard(int document_id) const {
+  return *shards_[static_cast<unsigned>(document_id) % shards_.size()];
+}
+
+vector<shared_lock<shared_mutex>> ShardedSearchServer::LockAllShards() const {
+  // Always in shard order, writers hold at most one shard lock at a time
+  vector<shared_lock<shared_mutex>> locks;
+  locks.reserve(shards_.size());
+  for (const auto &shard : shards_) {
+    locks.emplace_back(shard->mutex);
+  }
+  return locks;
+}
+
+void ShardedSearchServer::ComputeGlobalInvDocFreqs(
+    SearchServer::Query &query) const {
+  size_t document_count = 0;
+  vector<size_t> docs_with_word(query.plus_words.size());
+  for (const auto &shard : shards_) {
+    const SearchServer &server = shard->server;
+    document_count += server.documents_.size();
+    for (size_t i = 0; i < query.plus_words.size(); ++i) {
+      const auto it = server.word_to_docs_freq_.find(query.plus_words[i]);
+      if (it != server.word_to_docs_freq_.end()) {
+        docs_with_word[i] += it->second.size();
+      }
+    }
+  }
+  query.plus_inv_doc_freqs.assign(query.plus_words.size(), 0.0);
+  for (size_t i = 0; i < query.plus_words.size(); ++i) {
+    if (docs_with_word[i] > 0) {
+      query.plus_inv_doc_freqs[i] =
+          log(static_cast<double>(document_count) / docs_with_word[i]);
+    }
+  }
+}
+
+SearchServer::Query
+ShardedSearchServer::ParseQuery(string_view raw_query,
+                                pmr::memory_resource *resource) const {
+  // Stop words are the same on every shard, so any of them can parse; the
+  // shards themselves never expand fuzzy words
+  SearchServer::Query query =
+      shards_.front()->server.ParseQuery(raw_query, resource);
+  if (!fuzzy_params_) {
+    return query;
+  }
+  SearchServer::ExpandFuzzyWords(
+      query, *fuzzy_params_,
+      [this](string_view word) {
+        // A word in several dictionaries keeps its closest distance
+        map<string_view, int> terms;
+        for (const auto &shard : shards_) {
+          for (const auto &[term, distance] :
+               shard->server.FindFuzzyTerms(word, fuzzy_params_->max_edits)) {
+            const auto [it, inserted] = terms.emplace(term, distance);
+            it->second = min(it->second, distance);
+          }
+        }
+        return vector<pair<string_view, int>>(terms.begin(), terms.end());
+      },
+      [this](string_view term) {
+        size_t document_count = 0;
+        for (const auto &shard : shards_) {
+          const auto &index = shard->server.word_to_docs_freq_;
+          if (const auto it = index.find(term); it != index.end()) {
+            document_count += it->second.size();
+          }
+        }
+        return document_count;
+      });
+  return query;
+}
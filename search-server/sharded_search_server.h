@@ -0,0 +1,263 @@
+#pragma once
+
+#include <memory>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <tuple>
+
+#include "search_server.h"
+
+// Partitions documents by id across independent SearchServer shards. Queries
+// are scattered to every shard in parallel with inverse document frequencies
+// computed over the whole corpus, so relevance matches a single SearchServer
+// holding the same documents, and the per-shard top lists are merged.
+// Documents may be added and removed concurrently with queries; iterating
+// over ids must not overlap with modifications. Results that name words
+// own them, as a shard's dictionary may change once its lock is released.
+class ShardedSearchServer {
+public:
+  explicit ShardedSearchServer(size_t shard_count);
+
+  template <typename StopWords>
+  ShardedSearchServer(size_t shard_count, const StopWords &stopwords);
+
+  bool SetStopWords(string_view text);
+
+  // Query words are expanded with close words of every shard's dictionary,
+  // see SearchServer::EnableFuzzySearch
+  void EnableFuzzySearch(const FuzzySearchParams &params = {});
+
+  void DisableFuzzySearch();
+
+  // -------------------------------------------
+
+  template <typename StringAlikeObject>
+  void AddDocument(int document_id, StringAlikeObject document,
+                   DocumentStatus status, const vector<int> &ratings);
+
+  void AddDocument(int document_id, string_view document, DocumentStatus status,
+                   const vector<int> &ratings);
+
+  template <typename StringAlikeObject>
+  void UpdateDocument(int document_id, StringAlikeObject document,
+                      DocumentStatus status, const vector<int> &ratings);
+
+  void UpdateDocument(int document_id, string_view document,
+                      DocumentStatus status, const vector<int> &ratings);
+
+  void SetDocumentStatus(int document_id, DocumentStatus status);
+
+  void SetDocumentRating(int document_id, const vector<int> &ratings);
+
+  // -------------------------------------------
+
+  template <typename StringAlikeObject>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(StringAlikeObject raw_query) const;
+
+  template <typename StringAlikeObject>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(const execution::sequenced_policy &,
+                   StringAlikeObject raw_query) const;
+
+  template <typename StringAlikeObject>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(const execution::parallel_policy &,
+                   StringAlikeObject raw_query) const;
+
+  template <typename StringAlikeObject, typename DocumentFilter>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(StringAlikeObject raw_query,
+                   DocumentFilter doc_filter) const;
+
+  template <typename ExecPolicy, typename StringAlikeObject,
+            typename DocumentFilter>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(ExecPolicy &, StringAlikeObject raw_query,
+                   DocumentFilter doc_filter) const;
+
+  // ---------------------------------------------
+
+  using WordsAndStatus = tuple<vector<string>, DocumentStatus>;
+
+  template <typename StringAlikeObject>
+  [[nodiscard]] WordsAndStatus MatchDocument(StringAlikeObject raw_query,
+                                             int document_id) const;
+
+  template <typename ExecPolicy, typename StringAlikeObject>
+  [[nodiscard]] WordsAndStatus MatchDocument(ExecPolicy &policy,
+                                             StringAlikeObject raw_query,
+                                             int document_id) const;
+
+  // ---------------------------------------------
+
+  [[nodiscard]] int GetDocumentCount() const;
+
+  [[nodiscard]] size_t GetShardCount() const { return shards_.size(); }
+
+  // Sum over the shards; each shard has its own vocabulary and stop words
+  [[nodiscard]] MemoryStats GetMemoryStats() const;
+
+  // Shared by every shard and used to query them in parallel
+  void SetTaskScheduler(shared_ptr<TaskScheduler> scheduler);
+
+  [[nodiscard]] TaskScheduler &GetTaskScheduler() const {
+    return shards_.front()->server.GetTaskScheduler();
+  }
+
+  [[nodiscard]] map<string, double> GetWordFrequencies(int document_id) const;
+
+  void RemoveDocument(int document_id);
+
+  void RemoveDocument(execution::sequenced_policy, int document_id);
+
+  void RemoveDocument(execution::parallel_policy, int document_id);
+
+  [[nodiscard]] auto begin() const { return documents_ids_.begin(); }
+  [[nodiscard]] auto end() const { return documents_ids_.end(); }
+
+private:
+  struct Shard {
+    template <typename... Args>
+    explicit Shard(Args &&...args) : server(forward<Args>(args)...) {}
+
+    SearchServer server;
+    mutable shared_mutex mutex;
+  };
+
+  vector<unique_ptr<Shard>> shards_;
+  set<int> documents_ids_;
+  mutable mutex ids_mutex_;
+  // Changed with every shard locked exclusively, read with any shard locked
+  optional<FuzzySearchParams> fuzzy_params_;
+
+  Shard &GetShard(int document_id);
+
+  const Shard &GetShard(int document_id) const;
+
+  vector<shared_lock<shared_mutex>> LockAllShards() const;
+
+  void ComputeGlobalInvDocFreqs(SearchServer::Query &query) const;
+
+  // With every shard locked
+  SearchServer::Query ParseQuery(string_view raw_query,
+                                 pmr::memory_resource *resource) const;
+
+  // With every shard locked
+  template <typename ExecPolicy, typename DocumentFilter>
+  vector<Document> FindTopDocumentsByQuery(ExecPolicy &policy,
+                                           const SearchServer::Query &query,
+                                           DocumentFilter doc_filter) const;
+};
+
+template <typename StopWords>
+ShardedSearchServer::ShardedSearchServer(size_t shard_count,
+                                         const StopWords &stopwords) {
+  if (shard_count == 0) {
+    throw invalid_argument("At least one shard is required");
+  }
+  shards_.reserve(shard_count);
+  for (size_t i = 0; i < shard_count; ++i) {
+    shards_.push_back(make_unique<Shard>(stopwords));
+  }
+}
+
+template <typename StringAlikeObject>
+void ShardedSearchServer::AddDocument(int document_id,
+                                      StringAlikeObject document,
+                                      DocumentStatus status,
+                                      const vector<int> &ratings) {
+  AddDocument(document_id, string_view{document}, status, ratings);
+}
+
+template <typename StringAlikeObject>
+void ShardedSearchServer::UpdateDocument(int document_id,
+                                         StringAlikeObject document,
+                                         DocumentStatus status,
+                                         const vector<int> &ratings) {
+  UpdateDocument(document_id, string_view{document}, status, ratings);
+}
+
+template <typename StringAlikeObject>
+vector<Document>
+ShardedSearchServer::FindTopDocuments(StringAlikeObject raw_query) const {
+  return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename StringAlikeObject>
+vector<Document>
+ShardedSearchServer::FindTopDocuments(const execution::sequenced_policy &,
+                                      StringAlikeObject raw_query) const {
+  return FindTopDocuments(raw_query);
+}
+
+template <typename StringAlikeObject>
+vector<Document>
+ShardedSearchServer::FindTopDocuments(const execution::parallel_policy &policy,
+                                      StringAlikeObject raw_query) const {
+  return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+}
+
+template <typename StringAlikeObject, typename DocumentFilter>
+vector<Document>
+ShardedSearchServer::FindTopDocuments(StringAlikeObject raw_query,
+                                      DocumentFilter doc_filter) const {
+  return FindTopDocuments(execution::seq, raw_query, doc_filter);
+}
+
+template <typename ExecPolicy, typename StringAlikeObject,
+          typename DocumentFilter>
+vector<Document>
+ShardedSearchServer::FindTopDocuments(ExecPolicy &policy,
+                                      StringAlikeObject raw_query,
+                                      DocumentFilter doc_filter) const {
+  QueryArenaScope scratch;
+  const auto locks = LockAllShards();
+  const SearchServer::Query query =
+      ParseQuery(string_view{raw_query}, scratch.GetResource());
+  return FindTopDocumentsByQuery(policy, query, doc_filter);
+}
+
+template <typename ExecPolicy, typename DocumentFilter>
+vector<Document> ShardedSearchServer::FindTopDocumentsByQuery(
+    ExecPolicy &policy, const SearchServer::Query &query,
+    DocumentFilter doc_filter) const {
+  SearchServer::Query global_query = query;
+  ComputeGlobalInvDocFreqs(global_query);
+
+  vector<vector<Document>> shard_documents(shards_.size());
+  GetTaskScheduler().ParallelFor(0, shards_.size(), [&](size_t index) {
+    shard_documents[index] = shards_[index]->server.FindTopDocumentsByQuery(
+        policy, global_query, doc_filter);
+  });
+
+  vector<Document> matched_documents;
+  for (const auto &documents : shard_documents) {
+    matched_documents.insert(matched_documents.end(), documents.begin(),
+                             documents.end());
+  }
+  SearchServer::SortAndTrimDocuments(matched_documents);
+  return matched_documents;
+}
+
+template <typename StringAlikeObject>
+ShardedSearchServer::WordsAndStatus
+ShardedSearchServer::MatchDocument(StringAlikeObject raw_query,
+                                   int document_id) const {
+  return MatchDocument(execution::seq, raw_query, document_id);
+}
+
+template <typename ExecPolicy, typename StringAlikeObject>
+ShardedSearchServer::WordsAndStatus
+ShardedSearchServer::MatchDocument(ExecPolicy &policy,
+                                   StringAlikeObject raw_query,
+                                   int document_id) const {
+  const Shard &shard = GetShard(document_id);
+  shared_lock lock(shard.mutex);
+  const auto [words, status] =
+      shard.server.MatchDocument(policy, string_view{raw_query}, document_id);
+  return {vector<string>(words.begin(), words.end()), status};
+}
@@ -2,8 +2,9 @@
 
 using namespace std;
 
-vector<string_view> SplitIntoWords(string_view str) {
-  vector<string_view> result{};
+namespace {
+
+template <typename Words> void AppendWords(string_view str, Words &result) {
   auto pos = str.find_first_not_of(' ');
   str.remove_prefix(pos == string_view::npos ? str.size() : pos);
   while (!str.empty()) {
@@ -13,6 +14,19 @@ vector<string_view> SplitIntoWords(string_view str) {
     pos = str.find_first_not_of(' ', space);
     str.remove_prefix(pos == string_view::npos ? str.size() : pos);
   }
+}
+
+} // namespace
+
+vector<string_view> SplitIntoWords(string_view str) {
+  vector<string_view> result{};
+  AppendWords(str, result);
+  return result;
+}
 
+pmr::vector<string_view> SplitIntoWords(string_view str,
+                                        pmr::memory_resource *resource) {
+  pmr::vector<string_view> result{resource};
+  AppendWords(str, result);
   return result;
-}
\ No newline at end of file
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <memory_resource>
 #include <string>
 #include <vector>
 
-std::vector<std::string_view> SplitIntoWords(std::string_view str);
\ No newline at end of file
+std::vector<std::string_view> SplitIntoWords(std::string_view str);
+
+std::pmr::vector<std::string_view>
+SplitIntoWords(std::string_view str, std::pmr::memory_resource *resource);
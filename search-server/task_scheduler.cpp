@@ -0,0 +1,125 @@
+#include "task_scheduler.h"
+
+namespace {
+
+// Scheduler and queue index of the worker running on this thread
+thread_local const void *current_scheduler = nullptr;
+thread_local size_t current_worker = 0;
+
+} // namespace
+
+TaskScheduler::TaskScheduler(size_t thread_count) {
+  thread_count = max<size_t>(thread_count, 1);
+  for (size_t i = 0; i < thread_count; ++i) {
+    worker_queues_.push_back(make_unique<WorkerQueue>());
+  }
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back([this, i] { WorkerLoop(i); });
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    lock_guard lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_up_.notify_all();
+  for (thread &worker : threads_) {
+    worker.join();
+  }
+}
+
+shared_ptr<TaskScheduler> TaskScheduler::GetDefault() {
+  static const auto scheduler = make_shared<TaskScheduler>();
+  return scheduler;
+}
+
+void TaskScheduler::Push(Task task, TaskPriority priority) {
+  ++pending_tasks_;
+  if (priority == TaskPriority::HIGH) {
+    lock_guard lock(shared_mutex_);
+    high_priority_tasks_.push_back(move(task));
+  } else if (current_scheduler == this) {
+    WorkerQueue &queue = *worker_queues_[current_worker];
+    lock_guard lock(queue.mut);
+    queue.tasks.push_back(move(task));
+  } else {
+    lock_guard lock(shared_mutex_);
+    injected_tasks_.push_back(move(task));
+  }
+  {
+    lock_guard lock(sleep_mutex_);
+  }
+  wake_up_.notify_one();
+}
+
+optional<TaskScheduler::Task> TaskScheduler::PopTask() {
+  if (pending_tasks_ == 0) {
+    return nullopt;
+  }
+  const bool is_worker = current_scheduler == this;
+  {
+    lock_guard lock(shared_mutex_);
+    if (!high_priority_tasks_.empty()) {
+      Task task = move(high_priority_tasks_.front());
+      high_priority_tasks_.pop_front();
+      --pending_tasks_;
+      return task;
+    }
+  }
+  if (is_worker) {
+    WorkerQueue &queue = *worker_queues_[current_worker];
+    lock_guard lock(queue.mut);
+    if (!queue.tasks.empty()) {
+      Task task = move(queue.tasks.back());
+      queue.tasks.pop_back();
+      --pending_tasks_;
+      return task;
+    }
+  }
+  {
+    lock_guard lock(shared_mutex_);
+    if (!injected_tasks_.empty()) {
+      Task task = move(injected_tasks_.front());
+      injected_tasks_.pop_front();
+      --pending_tasks_;
+      return task;
+    }
+  }
+  const size_t start = is_worker ? current_worker + 1 : 0;
+  for (size_t i = 0; i < worker_queues_.size(); ++i) {
+    WorkerQueue &victim = *worker_queues_[(start + i) % worker_queues_.size()];
+    lock_guard lock(victim.mut);
+    if (!victim.tasks.empty()) {
+      Task task = move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --pending_tasks_;
+      return task;
+    }
+  }
+  return nullopt;
+}
+
+bool TaskScheduler::TryRunPendingTask() {
+  optional<Task> task = PopTask();
+  if (!task) {
+    return false;
+  }
+  (*task)();
+  return true;
+}
+
+void TaskScheduler::WorkerLoop(size_t index) {
+  current_scheduler = this;
+  current_worker = index;
+  while (true) {
+    if (TryRunPendingTask()) {
+      continue;
+    }
+    unique_lock lock(sleep_mutex_);
+    wake_up_.wait(lock, [this] { return stopping_ || pending_tasks_ > 0; });
+    if (stopping_ && pending_tasks_ == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+enum class TaskPriority { HIGH, NORMAL };
+
+// Work-stealing thread pool. Every worker pushes the tasks it spawns to its
+// own deque and takes them back LIFO; idle workers steal the oldest tasks of
+// others. Tasks submitted from outside go to a shared queue, HIGH priority
+// tasks to a separate one served before anything else.
+//
+// ParallelFor splits a range into chunks and the calling thread works on
+// them too, taking every chunk no other thread has started. Only then does
+// it block until the started ones finish, so it never waits for a chunk
+// nobody runs nor picks up unrelated work meanwhile. Parallel loops nested
+// inside tasks therefore share the same threads and cannot deadlock the
+// pool.
+class TaskScheduler {
+public:
+  explicit TaskScheduler(size_t thread_count = thread::hardware_concurrency());
+
+  TaskScheduler(const TaskScheduler &) = delete;
+  TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+  // Finishes every queued task before joining the workers
+  ~TaskScheduler();
+
+  // Process-wide pool with one thread per hardware thread
+  static shared_ptr<TaskScheduler> GetDefault();
+
+  [[nodiscard]] size_t GetThreadCount() const { return threads_.size(); }
+
+  template <typename Func>
+  [[nodiscard]] future<invoke_result_t<Func>>
+  Submit(Func func, TaskPriority priority = TaskPriority::NORMAL);
+
+  // Calls func(i) for every i in [begin, end)
+  template <typename Func>
+  void ParallelFor(size_t begin, size_t end, Func func);
+
+  template <typename RandomIt, typename Func>
+  void ForEach(RandomIt first, RandomIt last, Func func);
+
+private:
+  using Task = function<void()>;
+
+  struct WorkerQueue {
+    mutex mut;
+    deque<Task> tasks;
+  };
+
+  vector<unique_ptr<WorkerQueue>> worker_queues_;
+  mutex shared_mutex_;
+  deque<Task> high_priority_tasks_;
+  deque<Task> injected_tasks_;
+  atomic<size_t> pending_tasks_{0};
+  mutex sleep_mutex_;
+  condition_variable wake_up_;
+  bool stopping_ = false;
+  vector<thread> threads_;
+
+  void Push(Task task, TaskPriority priority);
+
+  // Runs one pending task if there is any
+  bool TryRunPendingTask();
+
+  optional<Task> PopTask();
+
+  void WorkerLoop(size_t index);
+};
+
+template <typename Func>
+future<invoke_result_t<Func>> TaskScheduler::Submit(Func func,
+                                                    TaskPriority priority) {
+  using Result = invoke_result_t<Func>;
+  auto task = make_shared<packaged_task<Result()>>(move(func));
+  future<Result> result = task->get_future();
+  Push([task] { (*task)(); }, priority);
+  return result;
+}
+
+template <typename Func>
+void TaskScheduler::ParallelFor(size_t begin, size_t end, Func func) {
+  if (begin >= end) {
+    return;
+  }
+  const size_t count = end - begin;
+  const size_t chunk_count = min(count, GetThreadCount() * 4);
+  if (chunk_count <= 1) {
+    for (size_t i = begin; i < end; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  struct State {
+    atomic<size_t> next_chunk{0};
+    atomic<size_t> finished_chunks{0};
+    mutex mut;
+    condition_variable finished;
+    exception_ptr error;
+  };
+  // Helpers that start after the loop is over must only touch the state
+  auto state = make_shared<State>();
+  const size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+  auto run_chunks = [state, &func, begin, end, chunk_count, chunk_size] {
+    for (size_t chunk = state->next_chunk++; chunk < chunk_count;
+         chunk = state->next_chunk++) {
+      try {
+        const size_t chunk_end = min(end, begin + (chunk + 1) * chunk_size);
+        for (size_t i = begin + chunk * chunk_size; i < chunk_end; ++i) {
+          func(i);
+        }
+      } catch (...) {
+        lock_guard lock(state->mut);
+        if (!state->error) {
+          state->error = current_exception();
+        }
+      }
+      if (++state->finished_chunks == chunk_count) {
+        lock_guard lock(state->mut);
+        state->finished.notify_one();
+      }
+    }
+  };
+
+  const size_t helpers = min(chunk_count - 1, GetThreadCount());
+  for (size_t i = 0; i < helpers; ++i) {
+    Push(run_chunks, TaskPriority::NORMAL);
+  }
+  run_chunks();
+  // Every chunk has started, the threads running them finish them
+  unique_lock lock(state->mut);
+  state->finished.wait(
+      lock, [&state, chunk_count] {
+        return state->finished_chunks == chunk_count;
+      });
+  if (state->error) {
+    rethrow_exception(state->error);
+  }
+}
+
+template <typename RandomIt, typename Func>
+void TaskScheduler::ForEach(RandomIt first, RandomIt last, Func func) {
+  ParallelFor(0, last - first, [&first, &func](size_t i) { func(first[i]); });
+}
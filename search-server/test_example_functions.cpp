@@ -1,4 +1,22 @@
 #include "test_example_functions.h"
+#include "allocation_counter.h"
+#include "concurrent_map.h"
+#include "durable_search_server.h"
+#include "process_queries.h"
+#include "read_input_functions.h"
+#include "request_queue.h"
+#include "sharded_search_server.h"
+#include "string_processing.h"
+#include "tiered_search_server.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
 
 void FindTopDocuments(const SearchServer &search_server,
                       const string &raw_query) {
@@ -50,8 +68,7 @@ void AssertImpl(bool value, const string &expr_str, const string &file,
   }
 }
 
-SearchServer GenerateTestServer() {
-  SearchServer server{"and in on with"s};
+template <typename Server> void FillTestServer(Server &server) {
   server.AddDocument(0, "white cat and fancy collar"s, DocumentStatus::ACTUAL,
                      {8, -3});
   server.AddDocument(1, "fluffy cat fluffy tail"s, DocumentStatus::ACTUAL,
@@ -68,6 +85,28 @@ SearchServer GenerateTestServer() {
                      {0, 0, 2, -1});
   server.AddDocument(7, "hippo expressive eyes"s, DocumentStatus::BANNED,
                      {4, 3, 2, -1});
+}
+
+string GenerateRandomText(mt19937 &generator, int max_word_count) {
+  string text;
+  for (int i = uniform_int_distribution(1, max_word_count)(generator); i > 0;
+       --i) {
+    text += "w"s + to_string(uniform_int_distribution(0, 39)(generator)) + " "s;
+  }
+  return text;
+}
+
+void FillRandomServer(SearchServer &server, mt19937 &generator) {
+  for (int id = 0; id < 300; ++id) {
+    server.AddDocument(id, GenerateRandomText(generator, 20),
+                       static_cast<DocumentStatus>(id % 3),
+                       {uniform_int_distribution(0, 3)(generator)});
+  }
+}
+
+SearchServer GenerateTestServer() {
+  SearchServer server{"and in on with"s};
+  FillTestServer(server);
   return server;
 }
 
@@ -96,6 +135,24 @@ void TestSorting() {
   for (size_t i = 0; i < 3; ++i) {
     ASSERT_EQUAL(result[i].id, expected_id[i]);
   }
+
+  // Equal relevance falls back to rating, then to id
+  SearchServer server;
+  for (const int id : {7, 3, 9, 5, 1}) {
+    server.AddDocument(id, "cat"s, DocumentStatus::ACTUAL, {id == 9 ? 2 : 1});
+  }
+  const vector<int> expected_ties = {9, 1, 3, 5, 7};
+  for (const QueryStrategy strategy :
+       {QueryStrategy::TERM_AT_A_TIME, QueryStrategy::DOCUMENT_AT_A_TIME,
+        QueryStrategy::PARALLEL}) {
+    server.ForceQueryStrategy(strategy);
+    vector<int> ids;
+    for (const Document &document :
+         server.FindTopDocuments(execution::par, "cat"s)) {
+      ids.push_back(document.id);
+    }
+    ASSERT(ids == expected_ties);
+  }
 }
 
 void TestRating() {
@@ -160,6 +217,1457 @@ void TestFilter() {
   }
 }
 
+void TestRemoveDocument() {
+  SearchServer server{"and"s};
+  server.AddDocument(1, "cat and dog"s, DocumentStatus::ACTUAL, {1});
+  server.AddDocument(2, "cat parrot"s, DocumentStatus::ACTUAL, {2});
+  server.RemoveDocument(1);
+  ASSERT_EQUAL(server.GetDocumentCount(), 1);
+  ASSERT(server.FindTopDocuments("dog"s).empty());
+  vector<Document> result = server.FindTopDocuments("cat"s);
+  ASSERT_EQUAL(result.size(), size_t{1});
+  ASSERT_EQUAL(result[0].id, 2);
+  server.RemoveDocument(execution::par, 2);
+  ASSERT(server.FindTopDocuments(execution::par, "cat parrot"s).empty());
+}
+
+void TestFuzzySearch() {
+  SearchServer server{"and"s};
+  server.AddDocument(1, "fluffy cat"s, DocumentStatus::ACTUAL, {1});
+  server.AddDocument(2, "groomed dog"s, DocumentStatus::ACTUAL, {2});
+  server.AddDocument(3, "fluffy tail"s, DocumentStatus::ACTUAL, {3});
+  ASSERT(server.FindTopDocuments("flufy"s).empty());
+
+  server.EnableFuzzySearch({1, 8, 3, 0.5});
+  vector<Document> result = server.FindTopDocuments("flufy grommed"s);
+  ASSERT_EQUAL(result.size(), size_t{3});
+  ASSERT_EQUAL(result[0].id, 2);
+  ASSERT_HINT(server.FindTopDocuments("fluffy"s)[0].relevance >
+                  server.FindTopDocuments("flufy"s)[0].relevance,
+              "Terms found with edits must weigh less than exact matches");
+  ASSERT_EQUAL(server.FindTopDocuments(execution::par, "flufy grommed"s).size(),
+               size_t{3});
+  ASSERT_HINT(server.FindTopDocuments("dig"s).size() == 1,
+              "Short words must be expanded too once long enough");
+  ASSERT(server.FindTopDocuments("ct"s).empty());
+  ASSERT(server.FindTopDocuments("flufy -cat"s)[0].id == 3);
+
+  const auto [words, status] = server.MatchDocument("flufy -dog"s, 1);
+  ASSERT_EQUAL(words.size(), size_t{1});
+  ASSERT_EQUAL(words[0], "fluffy"s);
+
+  server.EnableFuzzySearch({1, 0, 3, 0.5});
+  ASSERT(server.FindTopDocuments("flufy"s).empty());
+  server.DisableFuzzySearch();
+  ASSERT(server.FindTopDocuments("grommed"s).empty());
+}
+
+void TestShardedSearchServer() {
+  ShardedSearchServer server{3, "and in on with"s};
+  FillTestServer(server);
+  ASSERT_EQUAL(server.GetDocumentCount(), TEST_SERVER.GetDocumentCount());
+
+  const vector<string> queries = {"fluffy groomed cat dog -dinner"s,
+                                  "fluffy hippo cat"s, "in on and"s,
+                                  "expressive eyes -dog"s};
+  for (const string &query : queries) {
+    for (const auto status : {DocumentStatus::ACTUAL, DocumentStatus::BANNED}) {
+      const auto expected = TEST_SERVER.FindTopDocuments(query, status);
+      const auto seq_result = server.FindTopDocuments(query, status);
+      const auto par_result =
+          server.FindTopDocuments(execution::par, query, status);
+      ASSERT_EQUAL(seq_result.size(), expected.size());
+      ASSERT_EQUAL(par_result.size(), expected.size());
+      for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_EQUAL(seq_result[i].id, expected[i].id);
+        ASSERT_EQUAL(par_result[i].id, expected[i].id);
+        ASSERT_HINT(abs(seq_result[i].relevance - expected[i].relevance) <
+                        RELEVANCE_PRECISION,
+                    "Shards must use inverse document frequency of the "
+                    "whole corpus");
+      }
+    }
+  }
+
+  const auto [words, status] =
+      server.MatchDocument("fluffy groomed cat dog -dinner"s, 1);
+  ASSERT_EQUAL(words.size(), size_t{2});
+  ASSERT_EQUAL(server.GetWordFrequencies(1).size(), size_t{3});
+
+  // "groomed" is only in the shard of document 2, not in the first shard
+  SearchServer fuzzy_reference{"and in on with"s};
+  FillTestServer(fuzzy_reference);
+  fuzzy_reference.EnableFuzzySearch();
+  server.EnableFuzzySearch();
+  for (const string &query : {"groomd"s, "fluffi groomd cat -dinnr"s}) {
+    const auto expected = fuzzy_reference.FindTopDocuments(query);
+    const auto result = server.FindTopDocuments(query);
+    ASSERT_EQUAL_HINT(result.size(), expected.size(), query);
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQUAL_HINT(result[i].id, expected[i].id, query);
+      ASSERT_HINT(abs(result[i].relevance - expected[i].relevance) <
+                      RELEVANCE_PRECISION,
+                  query);
+    }
+  }
+  ASSERT_EQUAL(server.FindTopDocuments("groomd"s).size(), size_t{1});
+  server.DisableFuzzySearch();
+  ASSERT(server.FindTopDocuments("groomd"s).empty());
+
+  const auto batch = ProcessQueries(server, queries);
+  ASSERT_EQUAL(batch.size(), queries.size());
+  ASSERT_EQUAL(batch[0].size(), size_t{3});
+  ASSERT_EQUAL(ProcessQueriesJoined(server, queries).size(), size_t{6});
+
+  RequestQueue request_queue(server);
+  request_queue.AddFindRequest("in on and"s);
+  request_queue.AddFindRequest("fluffy hippo cat"s, DocumentStatus::BANNED);
+  ASSERT_EQUAL(request_queue.GetNoResultRequests(), 1);
+
+  server.RemoveDocument(2);
+  server.RemoveDocument(execution::par, 1);
+  ASSERT_EQUAL(server.GetDocumentCount(), 6);
+  ASSERT_EQUAL(server.FindTopDocuments("groomed fluffy"s).size(), size_t{1});
+  ASSERT_EQUAL(*server.begin(), 0);
+}
+
+void TestTaskScheduler() {
+  auto scheduler = make_shared<TaskScheduler>(2);
+  ASSERT_EQUAL(scheduler->GetThreadCount(), size_t{2});
+
+  // Nested loops inside tasks share two threads without deadlocking
+  vector<future<int>> sums;
+  for (int task = 0; task < 8; ++task) {
+    sums.push_back(scheduler->Submit([&scheduler] {
+      atomic<int> sum{0};
+      scheduler->ParallelFor(0, 100, [&](size_t i) {
+        scheduler->ParallelFor(0, 10, [&](size_t j) {
+          sum += static_cast<int>(i * 10 + j);
+        });
+      });
+      return sum.load();
+    }));
+  }
+  for (auto &sum : sums) {
+    ASSERT_EQUAL(sum.get(), 999 * 1000 / 2);
+  }
+  auto urgent = scheduler->Submit([] { return 42; }, TaskPriority::HIGH);
+  ASSERT_EQUAL(urgent.get(), 42);
+
+  bool thrown = false;
+  try {
+    scheduler->ParallelFor(0, 50, [](size_t i) {
+      if (i == 33) {
+        throw out_of_range("33");
+      }
+    });
+  } catch (const out_of_range &) {
+    thrown = true;
+  }
+  ASSERT_HINT(thrown, "Exceptions must propagate to the ParallelFor caller");
+
+  // A caller waiting for its last chunk leaves unrelated tasks to the pool
+  auto single = make_shared<TaskScheduler>(1);
+  const thread::id caller = this_thread::get_id();
+  atomic<int> started{0};
+  future<thread::id> unrelated;
+  single->ParallelFor(0, 2, [&](size_t) {
+    // Both chunks run at once, one on the caller and one on the worker
+    ++started;
+    while (started < 2) {
+      this_thread::yield();
+    }
+    if (this_thread::get_id() != caller) {
+      unrelated = single->Submit([] { return this_thread::get_id(); });
+      this_thread::sleep_for(chrono::milliseconds(20));
+    }
+  });
+  ASSERT(unrelated.get() != caller);
+
+  SearchServer server{"and in on with"s};
+  FillTestServer(server);
+  server.SetTaskScheduler(scheduler);
+  auto pending = server.FindTopDocumentsAsync("fluffy groomed cat dog"s);
+  auto banned = server.FindTopDocumentsAsync("hippo"s, DocumentStatus::BANNED,
+                                             TaskPriority::HIGH);
+  const auto expected = server.FindTopDocuments("fluffy groomed cat dog"s);
+  const auto result = pending.get();
+  ASSERT_EQUAL(result.size(), expected.size());
+  for (size_t i = 0; i < result.size(); ++i) {
+    ASSERT_EQUAL(result[i].id, expected[i].id);
+  }
+  ASSERT_EQUAL(banned.get().size(), size_t{2});
+  const auto [words, status] =
+      server.MatchDocument(execution::par, "-cat fluffy"s, 6);
+  ASSERT_EQUAL(words.size(), size_t{1});
+  ASSERT(get<0>(server.MatchDocument(execution::par, "-fluffy"s, 6)).empty());
+  ASSERT(get<0>(server.MatchDocument(execution::par, "-cat"s, 6)).empty());
+}
+
+void TestLoadCorpus() {
+  const string path = "/tmp/search_server_test_corpus.txt"s;
+  {
+    ofstream out(path);
+    out << "0\tACTUAL\t8 -3\twhite cat and fancy collar\n"s
+        << "1\t0\t7,2,7\tfluffy cat fluffy tail\r\n"s
+        << "\n"s
+        << "2\tACTUAL\t5 -12 2 1\tgroomed dog expressive eyes\n"s
+        << "3\tBANNED\t6 -2 6 1\tfunny hippo on deck\n"s
+        << "4\tIRRELEVANT\t1 5 -5 1\tbig whale in house\n"s
+        << "5\t1\t0 0 2 -1\tdog fluffy and fancy\n"s
+        << "6\tACTUAL\t0,0,2,-1\tdinner tasty and fluffy\n"s
+        << "7\tBANNED\t4 3 2 -1\thippo expressive eyes"s;
+  }
+  for (const auto storage : {TextStorage::REFERENCE, TextStorage::COPY}) {
+    SearchServer server{"and in on with"s};
+    // Tiny chunks make every record cross a chunk boundary
+    const size_t loaded = LoadCorpus(
+        server, path, {CorpusFormat::RECORDS, 0, size_t{10}, storage});
+    ASSERT_EQUAL(loaded, size_t{8});
+    for (const string &query :
+         {"fluffy groomed cat dog -dinner"s, "fluffy hippo cat"s}) {
+      const auto expected = TEST_SERVER.FindTopDocuments(query);
+      const auto result = server.FindTopDocuments(query);
+      ASSERT_EQUAL(result.size(), expected.size());
+      for (size_t i = 0; i < result.size(); ++i) {
+        ASSERT_EQUAL(result[i].id, expected[i].id);
+        ASSERT_EQUAL(result[i].rating, expected[i].rating);
+        ASSERT(abs(result[i].relevance - expected[i].relevance) <
+               RELEVANCE_PRECISION);
+      }
+    }
+  }
+
+  {
+    ofstream out(path);
+    out << "curly cat\nnasty dog\n\ncurly dog\n"s;
+  }
+  SearchServer server;
+  ASSERT_EQUAL(LoadCorpus(server, path, {CorpusFormat::LINES, 10}), size_t{3});
+  ASSERT_EQUAL(server.FindTopDocuments("curly"s).size(), size_t{2});
+  ASSERT_EQUAL(server.FindTopDocuments("nasty"s)[0].id, 11);
+
+  {
+    ofstream out(path);
+    out << "1\tACTUAL\t1\tgood record\n2\tFRESH\t1\tbad status\n"s;
+  }
+  // Only the chunks before the bad record are kept
+  for (const size_t chunk_size : {size_t{1} << 20, size_t{10}}) {
+    SearchServer rejecting;
+    bool rejected = false;
+    try {
+      LoadCorpus(rejecting, path, {CorpusFormat::RECORDS, 0, chunk_size});
+    } catch (const invalid_argument &) {
+      rejected = true;
+    }
+    ASSERT(rejected);
+    ASSERT_EQUAL(rejecting.GetDocumentCount(), chunk_size > 100 ? 0 : 1);
+  }
+  remove(path.c_str());
+
+  SearchServer batch_server;
+  batch_server.AddDocument(1, "cat"s, DocumentStatus::ACTUAL, {});
+  bool rejected = false;
+  try {
+    batch_server.AddDocuments(execution::par, {{2, "dog"sv}, {1, "cat"sv}});
+  } catch (const invalid_argument &) {
+    rejected = true;
+  }
+  ASSERT_HINT(rejected && batch_server.GetDocumentCount() == 1,
+              "Invalid batches must not be added partially");
+}
+
+void TestQueryArena() {
+  pmr::monotonic_buffer_resource index_memory;
+  SearchServer server{"and in on with"s, {&index_memory}};
+  FillTestServer(server);
+  const string_view query = "fluffy groomed cat dog -dinner"sv;
+  const auto expected = TEST_SERVER.FindTopDocuments(query);
+  ASSERT_EQUAL(server.FindTopDocuments(query).size(), expected.size());
+
+  // Once the arena has grown, little more than the returned vector is
+  // allocated
+  const size_t allocations_before = GetThreadAllocationCount();
+  const auto result = server.FindTopDocuments(query);
+  const size_t allocations = GetThreadAllocationCount() - allocations_before;
+  ASSERT_HINT(allocations <= 4, to_string(allocations) + " allocations"s);
+  ASSERT_EQUAL(result.size(), expected.size());
+  for (size_t i = 0; i < result.size(); ++i) {
+    ASSERT_EQUAL(result[i].id, expected[i].id);
+    ASSERT(abs(result[i].relevance - expected[i].relevance) <
+           RELEVANCE_PRECISION);
+  }
+
+  const auto [words, status] = server.MatchDocument(query, 1);
+  ASSERT_EQUAL(words.size(), size_t{2});
+  server.RemoveDocument(execution::seq, 1);
+  ASSERT(server.GetWordFrequencies(1).empty());
+  ASSERT_EQUAL(server.FindTopDocuments("fluffy"s).size(), size_t{1});
+}
+
+void TestQueryPlanner() {
+  const QueryPlan plan =
+      TEST_SERVER.ExplainQuery("fluffy groomed cat dog unicorn -dinner"s);
+  ASSERT_EQUAL(plan.strategy, QueryStrategy::DOCUMENT_AT_A_TIME);
+  ASSERT_EQUAL(plan.minus_words_strategy,
+               MinusWordsStrategy::COLLECT_DOCUMENTS);
+  vector<string> plus_words;
+  for (const auto &term : plan.plus_terms) {
+    plus_words.push_back(term.word);
+  }
+  ASSERT_HINT((plus_words ==
+               vector<string>{"groomed"s, "cat"s, "dog"s, "fluffy"s}),
+              "Rarest terms go first");
+  ASSERT_EQUAL(plan.plus_postings, size_t{8});
+  ASSERT_EQUAL(plan.minus_postings, size_t{1});
+  ASSERT(plan.missing_words == vector<string>{"unicorn"s});
+  ASSERT_EQUAL(TEST_SERVER.ExplainQuery("fluffy cat dog tail eyes hippo"s)
+                   .strategy,
+               QueryStrategy::TERM_AT_A_TIME);
+
+  // Every strategy against relevance computed from scratch
+  mt19937 generator{7};
+  SearchServer server{"w0"s};
+  FillRandomServer(server, generator);
+  map<string, int> document_freqs;
+  for (const int id : server) {
+    for (const auto &[word, _] : server.GetWordFrequencies(id)) {
+      ++document_freqs[string{word}];
+    }
+  }
+  for (int q = 0; q < 60; ++q) {
+    const string query =
+        GenerateRandomText(generator, 8) +
+        (q % 3 == 0 ? "-"s + GenerateRandomText(generator, 1) : ""s);
+    set<string> plus_words, minus_words;
+    for (const string_view word : SplitIntoWords(query)) {
+      if (word[0] == '-') {
+        minus_words.emplace(word.substr(1));
+      } else if (word != "w0"sv) {
+        plus_words.emplace(word);
+      }
+    }
+    vector<Document> expected;
+    for (const int id : server) {
+      const auto &words = server.GetWordFrequencies(id);
+      const auto [_, status] = server.MatchDocument(query, id);
+      bool excluded = status != DocumentStatus::ACTUAL;
+      double relevance = 0;
+      bool found = false;
+      for (const auto &[word, term_freq] : words) {
+        excluded = excluded || minus_words.count(string{word}) > 0;
+        if (plus_words.count(string{word}) > 0) {
+          found = true;
+          relevance += term_freq * log(server.GetDocumentCount() * 1.0 /
+                                       document_freqs[string{word}]);
+        }
+      }
+      if (found && !excluded) {
+        expected.push_back({id, relevance, 0});
+      }
+    }
+    sort(expected.begin(), expected.end(),
+         [](const Document &lhs, const Document &rhs) {
+           return lhs.relevance > rhs.relevance;
+         });
+    for (const optional<QueryStrategy> strategy :
+         {optional<QueryStrategy>{}, optional{QueryStrategy::TERM_AT_A_TIME},
+          optional{QueryStrategy::DOCUMENT_AT_A_TIME},
+          optional{QueryStrategy::PARALLEL}}) {
+      server.ForceQueryStrategy(strategy);
+      ostringstream hint_stream;
+      hint_stream << query << " with "s;
+      if (strategy) {
+        hint_stream << *strategy;
+      } else {
+        hint_stream << "the planner's strategy"s;
+      }
+      const string hint = hint_stream.str();
+      if (strategy) {
+        ASSERT_EQUAL_HINT(server.ExplainQuery(query).strategy, *strategy,
+                          hint);
+      }
+      const auto result = server.FindTopDocuments(query);
+      ASSERT_EQUAL_HINT(result.size(), min(expected.size(), size_t{5}), hint);
+      for (size_t i = 0; i < result.size(); ++i) {
+        ASSERT_HINT(abs(result[i].relevance - expected[i].relevance) <
+                        RELEVANCE_PRECISION,
+                    hint);
+      }
+    }
+    server.ForceQueryStrategy(nullopt);
+  }
+}
+
+void TestPruneFrequentWords() {
+  const auto expect_same_index = [](const SearchServer &lhs,
+                                    const SearchServer &rhs) {
+    ASSERT_EQUAL(lhs.GetDocumentCount(), rhs.GetDocumentCount());
+    for (const int id : lhs) {
+      const auto &lhs_words = lhs.GetWordFrequencies(id);
+      const auto &rhs_words = rhs.GetWordFrequencies(id);
+      ASSERT_EQUAL(lhs_words.size(), rhs_words.size());
+      for (const auto &[word, term_freq] : lhs_words) {
+        ASSERT(rhs_words.count(word) > 0);
+        ASSERT(abs(rhs_words.at(word) - term_freq) < RELEVANCE_PRECISION);
+      }
+    }
+  };
+
+  SearchServer server{"and in on with"s};
+  FillTestServer(server);
+  server.SetStopWords("fluffy eyes"s);
+  SearchServer expected{"and in on with fluffy eyes"s};
+  FillTestServer(expected);
+  expect_same_index(server, expected);
+  ASSERT(server.FindTopDocuments("fluffy"s).empty());
+  ASSERT_EQUAL(server.FindTopDocuments("tail"s)[0].id, 1);
+
+  // Only fluffy is in more than 30% of the 8 documents
+  SearchServer dropped{"and in on with"s};
+  FillTestServer(dropped);
+  ASSERT_EQUAL(dropped.PruneFrequentWords(0.3), size_t{1});
+  SearchServer without_frequent{"and in on with fluffy"s};
+  FillTestServer(without_frequent);
+  expect_same_index(dropped, without_frequent);
+  ASSERT(dropped.FindTopDocuments("fluffy"s).empty());
+
+  SearchServer demoted{"and in on with"s};
+  FillTestServer(demoted);
+  ASSERT_EQUAL(demoted.PruneFrequentWords(0.3, PruningMode::DEMOTE),
+               size_t{1});
+  const auto result = demoted.FindTopDocuments("fluffy tail"s);
+  ASSERT_EQUAL(result.size(), size_t{1});
+  ASSERT_EQUAL(result[0].id, 1);
+  ASSERT_HINT(demoted.FindTopDocuments("fluffy"s).size() == 2,
+              "Demoted words are used when nothing else matches");
+  ASSERT(demoted.ExplainQuery("fluffy tail"s).demoted_words ==
+         vector<string>{"fluffy"s});
+  ASSERT(demoted.FindTopDocuments("tail -cat"s).empty());
+
+  bool rejected = false;
+  try {
+    demoted.PruneFrequentWords(0.0);
+  } catch (const invalid_argument &) {
+    rejected = true;
+  }
+  ASSERT(rejected);
+}
+
+void TestUpdateDocument() {
+  SearchServer server{"and in on with"s};
+  FillTestServer(server);
+  server.BuildSimilarityIndex();
+  server.SetDocumentStatus(1, DocumentStatus::BANNED);
+  server.SetDocumentRating(2, {10, 20});
+  ASSERT_HINT(server.HasSimilarityIndex(), "Attribute updates keep postings");
+  ASSERT(server.FindTopDocuments("tail"s).empty());
+  ASSERT_EQUAL(server.FindTopDocuments("tail"s, DocumentStatus::BANNED)[0].id,
+               1);
+  ASSERT_EQUAL(server.FindTopDocuments("groomed"s)[0].rating, 15);
+
+  server.UpdateDocument(2, "groomed dog expressive eyes"s,
+                        DocumentStatus::ACTUAL, {15});
+  ASSERT_HINT(server.HasSimilarityIndex(), "Unchanged text keeps postings");
+
+  server.UpdateDocument(0, "white cat and white kitten"s,
+                        DocumentStatus::ACTUAL, {1});
+  ASSERT(!server.HasSimilarityIndex());
+  SearchServer expected{"and in on with"s};
+  FillTestServer(expected);
+  expected.RemoveDocument(0);
+  expected.AddDocument(0, "white cat and white kitten"s,
+                       DocumentStatus::ACTUAL, {1});
+  expected.SetDocumentStatus(1, DocumentStatus::BANNED);
+  for (const int id : expected) {
+    const auto &words = server.GetWordFrequencies(id);
+    ASSERT(words == expected.GetWordFrequencies(id));
+  }
+  ASSERT(server.FindTopDocuments("collar"s).empty());
+  ASSERT_EQUAL(server.FindTopDocuments("kitten"s)[0].id, 0);
+
+  bool rejected = false;
+  try {
+    server.UpdateDocument(100, "lost"s, DocumentStatus::ACTUAL, {});
+  } catch (const out_of_range &) {
+    rejected = true;
+  }
+  ASSERT(rejected);
+}
+
+void TestMemoryStats() {
+  SearchServer server{"and in on with"s};
+  MemoryStats stats = server.GetMemoryStats();
+  ASSERT_EQUAL(stats.stop_words.elements, 4u);
+  ASSERT_EQUAL(stats.GetTotalBytes(), stats.stop_words.bytes);
+
+  FillTestServer(server);
+  stats = server.GetMemoryStats();
+  size_t postings = 0;
+  map<string_view, size_t> document_freqs;
+  for (const int id : server) {
+    for (const auto &[word, _] : server.GetWordFrequencies(id)) {
+      ++document_freqs[word];
+      ++postings;
+    }
+  }
+  ASSERT_EQUAL(stats.vocabulary.elements, document_freqs.size());
+  ASSERT(stats.vocabulary.bytes > 0);
+  ASSERT_EQUAL(stats.postings.elements, postings);
+  ASSERT_EQUAL(stats.forward_index.elements, postings);
+  ASSERT(stats.postings.bytes >= postings * (sizeof(int) + sizeof(double)));
+  ASSERT_HINT(stats.document_text.elements > 0,
+              "Texts longer than the small string buffer are allocated");
+  ASSERT_EQUAL(stats.attributes.elements,
+               static_cast<size_t>(server.GetDocumentCount()));
+  ASSERT_EQUAL(stats.caches.bytes, 0u);
+  auto histogram_of = [](const map<string_view, size_t> &document_freqs) {
+    vector<size_t> histogram;
+    for (const auto &[word, count] : document_freqs) {
+      const size_t bucket = static_cast<size_t>(log2(count));
+      histogram.resize(max(histogram.size(), bucket + 1));
+      ++histogram[bucket];
+    }
+    return histogram;
+  };
+  ASSERT(stats.posting_list_lengths == histogram_of(document_freqs));
+
+  server.BuildSimilarityIndex();
+  stats = server.GetMemoryStats();
+  ASSERT_EQUAL(stats.caches.elements,
+               static_cast<size_t>(server.GetDocumentCount()));
+  ASSERT(stats.caches.bytes > 0);
+
+  // The histogram follows every change of the postings
+  server.UpdateDocument(0, "white cat and white kitten"s,
+                        DocumentStatus::ACTUAL, {1});
+  server.RemoveDocument(execution::par, 1);
+  server.RemoveDocument(2);
+  server.AddDocument(10, "fluffy fluffy dog"s, DocumentStatus::ACTUAL, {1});
+  document_freqs.clear();
+  for (const int id : server) {
+    for (const auto &[word, _] : server.GetWordFrequencies(id)) {
+      ++document_freqs[word];
+    }
+  }
+  ASSERT(server.GetMemoryStats().posting_list_lengths ==
+         histogram_of(document_freqs));
+
+  const size_t stop_words_bytes = stats.stop_words.bytes;
+  const vector<int> ids(server.begin(), server.end());
+  for (const int id : ids) {
+    server.RemoveDocument(id);
+  }
+  stats = server.GetMemoryStats();
+  ASSERT_HINT(stats.GetTotalBytes() == stop_words_bytes,
+              "Removing every document gives all index memory back");
+  ASSERT(stats.posting_list_lengths.empty());
+
+  ShardedSearchServer sharded{3, "and in on with"s};
+  FillTestServer(sharded);
+  const MemoryStats sharded_stats = sharded.GetMemoryStats();
+  ASSERT_EQUAL(sharded_stats.postings.elements, postings);
+  ASSERT_EQUAL(sharded_stats.stop_words.elements, 12u);
+}
+
+void TestStorageProfiles() {
+  const vector<string> queries = {"fluffy cat"s, "dog -fluffy"s,
+                                  "expressive hippo eyes"s, "fancy -collar"s};
+  for (const StorageProfile profile :
+       {StorageProfile::SEARCH_ONLY, StorageProfile::SEARCH_AND_MATCH}) {
+    SearchServer full{"and in on with"s};
+    FillTestServer(full);
+    SearchServerOptions options;
+    options.storage_profile = profile;
+    SearchServer lean{"and in on with"s, options};
+    FillTestServer(lean);
+    const MemoryStats stats = lean.GetMemoryStats();
+    ASSERT_EQUAL(stats.document_text.bytes, 0u);
+    ASSERT_EQUAL(stats.forward_index.bytes == 0,
+                 profile == StorageProfile::SEARCH_ONLY);
+
+    auto check_same = [&](const string &hint) {
+      for (const string &query : queries) {
+        const auto expected = full.FindTopDocuments(query);
+        const auto found = lean.FindTopDocuments(query);
+        ASSERT_EQUAL_HINT(found.size(), expected.size(), hint);
+        for (size_t i = 0; i < found.size(); ++i) {
+          ASSERT_EQUAL_HINT(found[i].id, expected[i].id, hint);
+          ASSERT_HINT(abs(found[i].relevance - expected[i].relevance) <
+                          RELEVANCE_PRECISION,
+                      hint);
+        }
+        for (const int id : full) {
+          ASSERT_HINT(lean.MatchDocument(query, id) ==
+                          full.MatchDocument(query, id),
+                      hint);
+          ASSERT_HINT(lean.MatchDocument(execution::par, query, id) ==
+                          full.MatchDocument(execution::par, query, id),
+                      hint);
+        }
+      }
+    };
+    check_same("Added"s);
+
+    for (SearchServer *server : {&full, &lean}) {
+      server->UpdateDocument(5, "dog fluffy fluffy collar"s,
+                             DocumentStatus::ACTUAL, {3});
+      server->RemoveDocument(execution::par, 1);
+      server->SetStopWords("fancy"s);
+    }
+    check_same("Updated"s);
+
+    bool available = true;
+    try {
+      [[maybe_unused]] const auto &words = lean.GetWordFrequencies(0);
+    } catch (const logic_error &) {
+      available = false;
+    }
+    ASSERT_EQUAL(available, profile != StorageProfile::SEARCH_ONLY);
+  }
+}
+
+void TestBatchResults() {
+  SearchServer server{"and in on with"s};
+  FillTestServer(server);
+  const vector<string> queries = {"fluffy cat"s, "nothing"s, "dog -fluffy"s,
+                                  "expressive hippo eyes"s, "tail"s};
+  const auto expected = ProcessQueries(server, queries);
+
+  auto check_same = [&expected](size_t index, DocumentRange documents) {
+    ASSERT_EQUAL(documents.size(), expected[index].size());
+    size_t i = 0;
+    for (const Document &document : documents) {
+      ASSERT_EQUAL(document.id, expected[index][i].id);
+      ASSERT_EQUAL(document.relevance, expected[index][i].relevance);
+      ++i;
+    }
+  };
+
+  QueryBatchResults results;
+  ProcessQueries(server, queries, results);
+  ASSERT_EQUAL(results.GetQueryCount(), queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    check_same(i, results.GetDocuments(i));
+  }
+  const Document *buffer = results.documents.data();
+  ProcessQueries(server, queries, results);
+  ASSERT_HINT(results.documents.data() == buffer,
+              "The next batch reuses the buffer");
+  check_same(3, results.GetDocuments(3));
+
+  ShardedSearchServer sharded{2, "and in on with"s};
+  FillTestServer(sharded);
+  ProcessQueries(sharded, queries, results);
+  for (size_t i = 0; i < queries.size(); ++i) {
+    ASSERT_EQUAL(results.GetDocuments(i).size(), expected[i].size());
+  }
+
+  mutex seen_mutex;
+  vector<int> seen(queries.size());
+  ProcessQueriesStreaming(server, queries,
+                          [&](size_t index, DocumentRange documents) {
+                            check_same(index, documents);
+                            lock_guard lock(seen_mutex);
+                            ++seen[index];
+                          });
+  ASSERT(seen == vector<int>(queries.size(), 1));
+  ASSERT_EQUAL(ProcessQueriesJoined(server, queries).size(),
+               results.documents.size());
+}
+
+void TestPreparedQuery() {
+  SearchServer server{"and in on with"s};
+  FillTestServer(server);
+  const vector<string> raw_queries = {"fluffy cat -collar"s, "nothing"s,
+                                      "dog -fluffy"s, "expressive eyes"s};
+  vector<PreparedQuery> queries;
+  for (const string &raw_query : raw_queries) {
+    // Prepared queries own their words
+    queries.push_back(server.PrepareQuery(string{raw_query}));
+  }
+
+  auto same_documents = [](const vector<Document> &lhs,
+                           const vector<Document> &rhs) {
+    return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                 [](const Document &lhs, const Document &rhs) {
+                   return lhs.id == rhs.id && lhs.relevance == rhs.relevance;
+                 });
+  };
+  auto check_same = [&](const string &hint) {
+    for (size_t i = 0; i < queries.size(); ++i) {
+      ASSERT_HINT(same_documents(server.FindTopDocuments(queries[i]),
+                                 server.FindTopDocuments(raw_queries[i])),
+                  hint);
+      ASSERT_HINT(
+          same_documents(server.FindTopDocuments(execution::par, queries[i],
+                                                 DocumentStatus::BANNED),
+                         server.FindTopDocuments(execution::par,
+                                                 raw_queries[i],
+                                                 DocumentStatus::BANNED)),
+          hint);
+      for (const int id : server) {
+        ASSERT_HINT(server.MatchDocument(queries[i], id) ==
+                        server.MatchDocument(raw_queries[i], id),
+                    hint);
+        ASSERT_HINT(server.MatchDocument(execution::par, queries[i], id) ==
+                        server.MatchDocument(raw_queries[i], id),
+                    hint);
+      }
+    }
+  };
+  ASSERT(!queries[0].IsStale());
+  check_same("Prepared"s);
+
+  server.AddDocument(20, "fluffy dog"s, DocumentStatus::ACTUAL, {1});
+  server.RemoveDocument(1);
+  ASSERT(queries[0].IsStale());
+  check_same("Stale"s);
+  queries[0] = server.PrepareQuery(raw_queries[0]);
+  ASSERT(!queries[0].IsStale());
+
+  QueryBatchResults prepared_results, raw_results;
+  ProcessQueries(server, queries, prepared_results);
+  ProcessQueries(server, raw_queries, raw_results);
+  ASSERT(prepared_results.offsets == raw_results.offsets);
+  for (size_t i = 0; i < prepared_results.documents.size(); ++i) {
+    ASSERT_EQUAL(prepared_results.documents[i].id,
+                 raw_results.documents[i].id);
+  }
+
+  SearchServer other;
+  const int id = *server.begin();
+  other.AddDocument(id, "w1 w2"s, DocumentStatus::ACTUAL, {1});
+  const vector<function<void()>> foreign_uses = {
+      [&] {
+        [[maybe_unused]] const auto documents =
+            other.FindTopDocuments(queries[0]);
+      },
+      [&] {
+        [[maybe_unused]] const auto match = other.MatchDocument(queries[0], id);
+      },
+      [&] {
+        [[maybe_unused]] const auto match =
+            other.MatchDocument(execution::seq, queries[0], id);
+      },
+      [&] {
+        [[maybe_unused]] const auto match =
+            other.MatchDocument(execution::par, queries[0], id);
+      }};
+  for (const auto &use : foreign_uses) {
+    bool rejected = false;
+    try {
+      use();
+    } catch (const invalid_argument &) {
+      rejected = true;
+    }
+    ASSERT(rejected);
+  }
+}
+
+void TestQueryBudget() {
+  mt19937 generator{11};
+  SearchServer server{"w0"s};
+  FillRandomServer(server, generator);
+  const string query = "w1 w2 w3 w4 -w5"s;
+  const vector<Document> full = server.FindTopDocuments(query);
+  ASSERT(!full.empty());
+
+  auto check = [&](const auto &policy, const string &hint) {
+    const QueryResults unlimited = server.FindTopDocuments(
+        policy, query, DocumentStatus::ACTUAL, QueryBudget{});
+    ASSERT_HINT(!unlimited.truncated, hint);
+    ASSERT_EQUAL_HINT(unlimited.documents.size(), full.size(), hint);
+    for (size_t i = 0; i < full.size(); ++i) {
+      ASSERT_EQUAL_HINT(unlimited.documents[i].id, full[i].id, hint);
+    }
+
+    QueryBudget small;
+    small.max_postings = 100;
+    const QueryResults partial =
+        server.FindTopDocuments(policy, query, DocumentStatus::ACTUAL, small);
+    ASSERT_HINT(partial.truncated, hint);
+    ASSERT_HINT(!partial.documents.empty(), hint);
+    for (const Document &document : partial.documents) {
+      // Scored documents are real matches, though their relevance may be
+      // partial
+      ASSERT_HINT(!get<0>(server.MatchDocument(query, document.id)).empty(),
+                  hint);
+    }
+
+    QueryBudget expired;
+    expired.deadline = chrono::steady_clock::now() - 1s;
+    const QueryResults late = server.FindTopDocuments(
+        policy, query, DocumentStatus::ACTUAL, expired);
+    ASSERT_HINT(late.truncated && late.documents.empty(), hint);
+
+    QueryBudget cancelled;
+    // The token is tripped from another thread before the query starts
+    thread([token = cancelled.cancellation] { token.Cancel(); }).join();
+    const QueryResults stopped = server.FindTopDocuments(
+        policy, query, DocumentStatus::ACTUAL, cancelled);
+    ASSERT_HINT(stopped.truncated && stopped.documents.empty(), hint);
+
+    const QueryResults prepared = server.FindTopDocuments(
+        policy, server.PrepareQuery(query), DocumentStatus::ACTUAL, small);
+    ASSERT_HINT(prepared.truncated, hint);
+  };
+  check(execution::seq, "Sequential"s);
+  check(execution::par, "Parallel"s);
+
+  // Budgets are charged in blocks, which must not cut off a query that fits
+  SearchServer large;
+  for (int id = 0; id < 1'100; ++id) {
+    large.AddDocument(id, "cat"s, DocumentStatus::ACTUAL, {1});
+  }
+  large.AddDocument(1'100, "dog"s, DocumentStatus::ACTUAL, {1});
+  const vector<pair<string, size_t>> fitting = {
+      {"cat"s, 1'100}, {"cat"s, 1'500}, {"cat dog"s, 1'101}, {"cat dog"s, 1'500}};
+  for (const auto &[query, max_postings] : fitting) {
+    QueryBudget enough;
+    enough.max_postings = max_postings;
+    const string hint = query + " within "s + to_string(max_postings);
+    const QueryResults sequential = large.FindTopDocuments(
+        execution::seq, query, DocumentStatus::ACTUAL, enough);
+    ASSERT_HINT(!sequential.truncated, hint);
+    ASSERT_EQUAL_HINT(sequential.documents.size(),
+                      size_t{MAX_RESULT_DOCUMENT_COUNT}, hint);
+    ASSERT_HINT(!large.FindTopDocuments(execution::par, query,
+                                        DocumentStatus::ACTUAL, enough)
+                     .truncated,
+                hint);
+  }
+  QueryBudget one_short;
+  one_short.max_postings = 1'099;
+  ASSERT(large.FindTopDocuments(execution::seq, "cat"s, DocumentStatus::ACTUAL,
+                                one_short)
+             .truncated);
+}
+
+void TestConcurrentMap() {
+  // Few shards and no expected size, so the tables have to grow
+  ConcurrentMap<string, double> relevance{0, 2};
+  ConcurrentMap<int, int> counts;
+  const int thread_count = 4;
+  const int key_count = 1000;
+  vector<thread> threads;
+  for (int t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&] {
+      for (int key = 0; key < key_count; ++key) {
+        relevance.Add("w"s + to_string(key), 0.5);
+        counts.Add(key, key);
+      }
+    });
+  }
+  for (thread &worker : threads) {
+    worker.join();
+  }
+  ASSERT_EQUAL(relevance.GetSize(), static_cast<size_t>(key_count));
+  ASSERT_EQUAL(relevance.Find("w7"s).value_or(0), 0.5 * thread_count);
+  ASSERT(!relevance.Find("w"s + to_string(key_count)));
+
+  const map<int, int> ordinary = counts.BuildOrdinaryMap();
+  ASSERT_EQUAL(ordinary.size(), static_cast<size_t>(key_count));
+  for (const auto &[key, count] : ordinary) {
+    ASSERT_EQUAL(count, key * thread_count);
+  }
+  TaskScheduler scheduler{3};
+  auto items = counts.BuildItems(scheduler);
+  sort(items.begin(), items.end());
+  const vector<pair<int, int>> expected(ordinary.begin(), ordinary.end());
+  ASSERT(items == expected);
+  counts.Store(3, -1);
+  ASSERT_EQUAL(counts.Find(3).value_or(0), -1);
+  // Locked access to arithmetic values, as before they became atomic
+  counts[3].ref_to_value += 5;
+  counts[key_count].ref_to_value -= 2;
+  ASSERT_EQUAL(counts.Find(3).value_or(0), 4);
+  ASSERT_EQUAL(counts.Find(key_count).value_or(0), -2);
+  relevance["w7"s].ref_to_value = 1.5;
+  ASSERT_EQUAL(relevance.Find("w7"s).value_or(0), 1.5);
+
+  ConcurrentMap<int, vector<int>> lists{16};
+  lists[1].ref_to_value.push_back(2);
+  lists[1].ref_to_value.push_back(3);
+  ASSERT(lists.Find(1) == optional(vector<int>{2, 3}));
+  ASSERT(!lists.Find(2));
+}
+
+void TestFacets() {
+  mt19937 generator{13};
+  SearchServer server{"w0"s};
+  for (int id = 0; id < 300; ++id) {
+    server.AddDocument(id, GenerateRandomText(generator, 20),
+                       static_cast<DocumentStatus>(id % 4), {id % 9 - 4});
+  }
+  const string query = "w1 w2 w3 -w4"s;
+  FacetCounts expected{3};
+  for (const int id : server) {
+    const auto [words, status] = server.MatchDocument(query, id);
+    if (!words.empty()) {
+      expected.Add(status, id % 9 - 4);
+    }
+  }
+  ASSERT(expected.GetTotalCount() > 0);
+  ASSERT(expected.by_rating.count(-6) > 0);
+
+  auto check = [&](const FacetedResults &results, DocumentStatus status,
+                   const string &hint) {
+    ASSERT_HINT(results.facets.by_status == expected.by_status, hint);
+    ASSERT_HINT(results.facets.by_rating == expected.by_rating, hint);
+    const vector<Document> top = server.FindTopDocuments(query, status);
+    ASSERT_EQUAL_HINT(results.documents.size(), top.size(), hint);
+    for (size_t i = 0; i < top.size(); ++i) {
+      ASSERT_EQUAL_HINT(results.documents[i].id, top[i].id, hint);
+    }
+  };
+  check(server.FindTopDocumentsWithFacets(query, DocumentStatus::ACTUAL, 3),
+        DocumentStatus::ACTUAL, "Sequential"s);
+  check(server.FindTopDocumentsWithFacets(execution::par, query,
+                                          DocumentStatus::BANNED, 3),
+        DocumentStatus::BANNED, "Parallel"s);
+
+  const FacetedResults nothing =
+      server.FindTopDocumentsWithFacets("unknown"s, DocumentStatus::ACTUAL);
+  ASSERT(nothing.documents.empty() && nothing.facets.GetTotalCount() == 0);
+}
+
+void TestSimilarDocuments() {
+  mt19937 generator{17};
+  SearchServer server{"w0"s};
+  FillRandomServer(server, generator);
+  map<string, double> inv_doc_freqs;
+  for (const int id : server) {
+    for (const auto &[word, _] : server.GetWordFrequencies(id)) {
+      ++inv_doc_freqs[string{word}];
+    }
+  }
+  for (auto &[_, freq] : inv_doc_freqs) {
+    freq = log(server.GetDocumentCount() / freq);
+  }
+  auto vector_of = [&](int id) {
+    map<string, double> weights;
+    for (const auto &[word, term_freq] : server.GetWordFrequencies(id)) {
+      weights[string{word}] = term_freq * inv_doc_freqs[string{word}];
+    }
+    return weights;
+  };
+  auto norm_of = [](const map<string, double> &weights) {
+    double norm = 0;
+    for (const auto &[_, weight] : weights) {
+      norm += weight * weight;
+    }
+    return sqrt(norm);
+  };
+
+  // Documents have fewer words than are looked up, so scores are exact
+  for (const int source : {0, 42, 299}) {
+    const auto source_vector = vector_of(source);
+    vector<Document> expected;
+    for (const int id : server) {
+      if (id == source || id % 3 != 0) {
+        continue;
+      }
+      const auto other = vector_of(id);
+      double dot_product = 0;
+      for (const auto &[word, weight] : source_vector) {
+        if (const auto it = other.find(word); it != other.end()) {
+          dot_product += weight * it->second;
+        }
+      }
+      if (dot_product > 0) {
+        expected.push_back(
+            {id, dot_product / (norm_of(source_vector) * norm_of(other)), 0});
+      }
+    }
+    sort(expected.begin(), expected.end(),
+         [](const Document &lhs, const Document &rhs) {
+           return lhs.relevance > rhs.relevance;
+         });
+    const vector<Document> similar = server.FindSimilarDocuments(source);
+    ASSERT_EQUAL(similar.size(), size_t{MAX_RESULT_DOCUMENT_COUNT});
+    for (size_t i = 0; i < similar.size(); ++i) {
+      ASSERT(abs(similar[i].relevance - expected[i].relevance) <
+             RELEVANCE_PRECISION);
+      ASSERT(similar[i].relevance <= 1 + RELEVANCE_PRECISION);
+    }
+    ASSERT_EQUAL(
+        server.FindSimilarDocuments(source, DocumentStatus::ACTUAL, 20).size(),
+        size_t{20});
+    const vector<Document> first_three = server.FindSimilarDocuments(source, 3);
+    ASSERT_EQUAL(first_three.size(), size_t{3});
+    for (size_t i = 0; i < first_three.size(); ++i) {
+      ASSERT_EQUAL(first_three[i].id, similar[i].id);
+    }
+  }
+
+  const vector<Document> without_index = server.FindSimilarDocuments(7);
+  server.BuildSimilarityIndex();
+  ASSERT(server.HasSimilarityIndex());
+  const vector<Document> with_index = server.FindSimilarDocuments(7);
+  ASSERT_EQUAL(with_index.size(), without_index.size());
+  for (size_t i = 0; i < with_index.size(); ++i) {
+    ASSERT_EQUAL(with_index[i].id, without_index[i].id);
+  }
+  server.AddDocument(1000, "w1 w2"s, DocumentStatus::ACTUAL, {1});
+  ASSERT(!server.HasSimilarityIndex());
+
+  // Norms bounded from the kept term frequencies pick the same documents as
+  // exact ones, also after words were dropped from the documents
+  server.UpdateDocument(7, "w1 w1 w3 w5 w8"s, DocumentStatus::ACTUAL, {2});
+  server.RemoveDocument(11);
+  ASSERT(server.PruneFrequentWords(0.3) > 0);
+  for (const int source : {7, 12, 100}) {
+    const vector<Document> bounded = server.FindSimilarDocuments(source);
+    server.BuildSimilarityIndex();
+    const vector<Document> exact = server.FindSimilarDocuments(source);
+    ASSERT(!exact.empty());
+    ASSERT_EQUAL(bounded.size(), exact.size());
+    for (size_t i = 0; i < exact.size(); ++i) {
+      ASSERT_EQUAL(bounded[i].id, exact[i].id);
+      ASSERT(abs(bounded[i].relevance - exact[i].relevance) <
+             RELEVANCE_PRECISION);
+    }
+    server.AddDocument(2000 + source, "w2 w4"s, DocumentStatus::ACTUAL, {1});
+  }
+
+  SearchServer pets{"and in on with"s};
+  FillTestServer(pets);
+  bool rejected = false;
+  try {
+    [[maybe_unused]] const auto documents = pets.FindSimilarDocuments(100);
+  } catch (const out_of_range &) {
+    rejected = true;
+  }
+  ASSERT(rejected);
+}
+
+void TestHitCount() {
+  mt19937 generator{19};
+  SearchServer server{"w0"s};
+  // Long enough for the most frequent words to get sketches
+  for (int id = 0; id < 3000; ++id) {
+    server.AddDocument(id, GenerateRandomText(generator, 40),
+                       static_cast<DocumentStatus>(id % 4), {1});
+  }
+  const vector<string> queries = {"w1"s,      "w1 w2 -w3"s, "w5 w6 w7 w8"s,
+                                  "-w1 w2"s,  "unknown"s,   "w9 -w9"s,
+                                  "w10 -w11 -w12"s};
+  vector<size_t> expected;
+  for (const string &query : queries) {
+    size_t count = 0;
+    for (const int id : server) {
+      count += !get<0>(server.MatchDocument(query, id)).empty();
+    }
+    expected.push_back(count);
+  }
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const HitCount exact = server.CountMatchingDocuments(queries[i]);
+    ASSERT(exact.IsExact());
+    ASSERT_EQUAL_HINT(exact.count, expected[i], queries[i]);
+    // Without sketches approximate counts are exact
+    ASSERT_EQUAL(server
+                     .CountMatchingDocuments(queries[i],
+                                             HitCountMode::APPROXIMATE)
+                     .count,
+                 expected[i]);
+  }
+
+  server.BuildHitCountSketches();
+  ASSERT(server.HasHitCountSketches());
+  ASSERT(server.GetMemoryStats().caches.elements > 0);
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const HitCount estimate =
+        server.CountMatchingDocuments(queries[i], HitCountMode::APPROXIMATE);
+    ASSERT_HINT(abs(static_cast<double>(estimate.count) - expected[i]) <=
+                    4 * estimate.standard_error,
+                queries[i]);
+    ASSERT_EQUAL(server.CountMatchingDocuments(queries[i]).count, expected[i]);
+  }
+  ASSERT(!server.CountMatchingDocuments("w1"s, HitCountMode::APPROXIMATE)
+              .IsExact());
+  server.RemoveDocument(0);
+  ASSERT(!server.HasHitCountSketches());
+
+  // Ids too far apart for a bitmap
+  SearchServer sparse;
+  for (int id : {5, 1'000'000, 2'000'000'000}) {
+    sparse.AddDocument(id, "cat dog"s, DocumentStatus::ACTUAL, {1});
+  }
+  sparse.AddDocument(7, "cat"s, DocumentStatus::BANNED, {1});
+  ASSERT_EQUAL(sparse.CountMatchingDocuments("cat"s).count, size_t{4});
+  ASSERT_EQUAL(sparse.CountMatchingDocuments("cat -dog"s).count, size_t{1});
+
+  // Dense ids, but a rare word's postings are sorted rather than set in a
+  // bitmap over every id
+  SearchServer spread;
+  for (int id = 0; id < 4'000; ++id) {
+    spread.AddDocument(id * 32, id % 1'000 == 0 ? "rare cat"s : "cat"s,
+                       DocumentStatus::ACTUAL, {1});
+  }
+  ASSERT_EQUAL(spread.CountMatchingDocuments("rare"s).count, size_t{4});
+  ASSERT_EQUAL(spread.CountMatchingDocuments("rare -cat"s).count, size_t{0});
+  ASSERT_EQUAL(spread.CountMatchingDocuments("cat -rare"s).count,
+               size_t{3'996});
+}
+
+void TestTieredSearchServer() {
+  const string path = "/tmp/search_server_test_cold_segment.bin"s;
+  const vector<pair<string, DocumentStatus>> texts = {
+      {"white cat fancy collar"s, DocumentStatus::ACTUAL},
+      {"fluffy cat fluffy tail"s, DocumentStatus::ACTUAL},
+      {"groomed dog expressive eyes"s, DocumentStatus::ACTUAL},
+      {"groomed starling eugene"s, DocumentStatus::BANNED},
+      {"white dog"s, DocumentStatus::ACTUAL}};
+  TieredSearchServer tiered{"and in"s};
+  SearchServer single{"and in"s};
+  for (int id = 0; id < static_cast<int>(texts.size()); ++id) {
+    tiered.AddDocument(id, texts[id].first, texts[id].second, {id});
+    single.AddDocument(id, texts[id].first, texts[id].second, {id});
+  }
+  ASSERT_EQUAL(tiered.FindTopDocuments("cat"s).size(), 2u);
+  ASSERT_EQUAL(tiered.MoveColdDocuments(path), 3u);
+  ASSERT_EQUAL(tiered.GetHotDocumentCount(), 2);
+  ASSERT_EQUAL(tiered.GetColdSegmentCount(), 1u);
+  ASSERT_EQUAL(tiered.GetDocumentCount(), 5);
+
+  // The hot tier cannot fill these, so they match a single server
+  for (const string &query : {"dog"s, "white -dog"s, "groomed white cat"s}) {
+    const vector<Document> expected = single.FindTopDocuments(query);
+    const vector<Document> found = tiered.FindTopDocuments(query);
+    ASSERT_EQUAL_HINT(found.size(), expected.size(), query);
+    for (size_t i = 0; i < found.size(); ++i) {
+      ASSERT_EQUAL_HINT(found[i].id, expected[i].id, query);
+      ASSERT_HINT(abs(found[i].relevance - expected[i].relevance) < 1e-6,
+                  query);
+      ASSERT_EQUAL_HINT(found[i].rating, expected[i].rating, query);
+    }
+  }
+  const vector<Document> banned =
+      tiered.FindTopDocuments("groomed"s, DocumentStatus::BANNED);
+  ASSERT(banned.size() == 1 && banned[0].id == 3);
+  const vector<Document> rated = tiered.FindTopDocuments(
+      "dog"s, [](int, DocumentStatus, int rating) { return rating > 2; });
+  ASSERT(rated.size() == 1 && rated[0].id == 4);
+
+  tiered.RemoveDocument(4);
+  ASSERT_EQUAL(tiered.GetDocumentCount(), 4);
+  ASSERT_EQUAL(tiered.FindTopDocuments("dog"s).size(), 1u);
+  try {
+    tiered.AddDocument(4, "white dog"s, DocumentStatus::ACTUAL, {1});
+    ASSERT_HINT(false, "Ids of removed cold documents stay taken"s);
+  } catch (const invalid_argument &) {
+  }
+
+  for (int id = 10; id < 10 + static_cast<int>(MAX_RESULT_DOCUMENT_COUNT);
+       ++id) {
+    tiered.AddDocument(id, "cat"s, DocumentStatus::ACTUAL, {1});
+  }
+  ASSERT_EQUAL(tiered.FindTopDocuments("cat"s).size(),
+               size_t{MAX_RESULT_DOCUMENT_COUNT});
+  const TierStats stats = tiered.GetTierStats();
+  ASSERT_EQUAL(stats.queries, 8u);
+  ASSERT_EQUAL(stats.hot_only_queries, 2u);
+  ASSERT_EQUAL(stats.cold_queries, 6u);
+  ASSERT_EQUAL(stats.hot_documents, 2u + 3u + MAX_RESULT_DOCUMENT_COUNT);
+  ASSERT_EQUAL(stats.cold_documents, 7u);
+
+  {
+    ofstream out(path, ios::trunc);
+    out << "not a segment"s;
+  }
+  try {
+    ColdSegment segment{path};
+    ASSERT_HINT(false, "Invalid segments are rejected"s);
+  } catch (const invalid_argument &) {
+  }
+  remove(path.c_str());
+}
+
+void TestFieldWeights() {
+  SearchServer server{"and with"s};
+  server.AddDocument(
+      0, {{"title"sv, "fluffy cat"sv}, {"body"sv, "collar and leash"sv}},
+      DocumentStatus::ACTUAL, {1});
+  server.AddDocument(
+      1, {{"title"sv, "collar"sv}, {"body"sv, "fluffy dog fluffy tail"sv}},
+      DocumentStatus::ACTUAL, {2});
+  server.AddDocument(2, "dog with collar"s, DocumentStatus::ACTUAL, {3});
+  server.AddDocument(3, "parrot"s, DocumentStatus::ACTUAL, {4});
+  ASSERT_EQUAL(server.GetMemoryStats().postings.elements, 19u);
+
+  auto relevance_of = [](const vector<Document> &documents, int id) {
+    for (const Document &document : documents) {
+      if (document.id == id) {
+        return document.relevance;
+      }
+    }
+    return -1.0;
+  };
+  const double fluffy_idf = log(4.0 / 2);
+  // Without weights fields score as one text
+  for (const FieldWeights &weights :
+       {FieldWeights{}, FieldWeights{{"title"s, 1.0}},
+        FieldWeights{{"tags"s, 5.0}}}) {
+    const vector<Document> found = server.FindTopDocuments(
+        execution::seq, "fluffy"s, DocumentStatus::ACTUAL, weights);
+    const vector<Document> expected = server.FindTopDocuments("fluffy"s);
+    ASSERT_EQUAL(found.size(), expected.size());
+    for (size_t i = 0; i < found.size(); ++i) {
+      ASSERT_EQUAL(found[i].id, expected[i].id);
+      ASSERT_EQUAL(found[i].relevance, expected[i].relevance);
+    }
+  }
+  ASSERT_EQUAL(server.FindTopDocuments("fluffy"s)[0].id, 1);
+
+  const FieldWeights title_boost = {{"title"s, 3.0}};
+  for (const vector<Document> &found :
+       {server.FindTopDocuments(execution::seq, "fluffy"s,
+                                DocumentStatus::ACTUAL, title_boost),
+        server.FindTopDocuments(execution::par, "fluffy"s,
+                                DocumentStatus::ACTUAL, title_boost)}) {
+    ASSERT_EQUAL(found.size(), 2u);
+    ASSERT_EQUAL(found[0].id, 0);
+    ASSERT(abs(found[0].relevance - fluffy_idf * 0.75) < 1e-9);
+    ASSERT(abs(found[1].relevance - fluffy_idf * 0.4) < 1e-9);
+  }
+  // A weight of zero keeps the document but not its field's score
+  const vector<Document> no_body = server.FindTopDocuments(
+      execution::par, "fluffy"s, DocumentStatus::ACTUAL,
+      FieldWeights{{"body"s, 0.0}});
+  ASSERT_EQUAL(no_body.size(), 2u);
+  ASSERT(abs(relevance_of(no_body, 1)) < 1e-9);
+  const vector<Document> collar = server.FindTopDocuments(
+      execution::seq, "collar -dog"s, DocumentStatus::ACTUAL,
+      FieldWeights{{"title"s, 2.0}});
+  ASSERT(collar.size() == 1 && collar[0].id == 0);
+  ASSERT(abs(collar[0].relevance - log(4.0 / 3) * 0.25) < 1e-9);
+  try {
+    (void)server.FindTopDocuments(execution::seq, "fluffy"s,
+                                  DocumentStatus::ACTUAL,
+                                  FieldWeights{{"title"s, -1.0}});
+    ASSERT_HINT(false, "Negative weights are rejected"s);
+  } catch (const invalid_argument &) {
+  }
+
+  server.RemoveDocument(0);
+  ASSERT_EQUAL(server.GetMemoryStats().postings.elements, 11u);
+  // Field term frequencies are rescaled with the document's
+  server.SetStopWords("fluffy"s);
+  const FieldWeights body_boost = {{"body"s, 2.0}};
+  vector<Document> dog = server.FindTopDocuments(
+      execution::seq, "dog"s, DocumentStatus::ACTUAL, body_boost);
+  ASSERT(abs(relevance_of(dog, 1) - log(1.5) * 2 / 3) < 1e-9);
+  ASSERT(abs(relevance_of(dog, 2) - log(1.5) / 2) < 1e-9);
+  // Plain text replaces the fields
+  server.UpdateDocument(1, "dog"s, DocumentStatus::ACTUAL, {2});
+  dog = server.FindTopDocuments(execution::seq, "dog"s,
+                                DocumentStatus::ACTUAL, body_boost);
+  ASSERT(abs(relevance_of(dog, 1) - log(1.5)) < 1e-9);
+  ASSERT_EQUAL(server.GetMemoryStats().postings.elements, 4u);
+}
+
+void TestSharedScanBatch() {
+  mt19937 generator{7};
+  SearchServer server{"w0"s};
+  FillRandomServer(server, generator);
+  server.SetTaskScheduler(make_shared<TaskScheduler>(3));
+  vector<string> queries;
+  for (int q = 0; q < 200; ++q) {
+    string query = GenerateRandomText(generator, 8);
+    if (q % 3 == 0) {
+      query += "-"s + GenerateRandomText(generator, 1);
+    }
+    queries.push_back(query);
+  }
+  queries.push_back("unknown"s);
+  queries.push_back("w0"s);
+
+  auto check_batch = [&server, &queries](const string &hint) {
+    const auto expected = ProcessQueries(server, queries);
+    QueryBatchResults results;
+    ProcessQueriesSharedScan(server, queries, results);
+    ASSERT_EQUAL_HINT(results.GetQueryCount(), queries.size(), hint);
+    for (size_t i = 0; i < queries.size(); ++i) {
+      const DocumentRange documents = results.GetDocuments(i);
+      ASSERT_EQUAL_HINT(documents.size(), expected[i].size(), queries[i]);
+      size_t j = 0;
+      for (const Document &document : documents) {
+        ASSERT_EQUAL_HINT(document.id, expected[i][j].id, hint);
+        // Bit for bit, as the additions happen in the same order
+        ASSERT_EQUAL_HINT(document.relevance, expected[i][j].relevance, hint);
+        ASSERT_EQUAL_HINT(document.rating, expected[i][j].rating, hint);
+        ++j;
+      }
+    }
+  };
+  check_batch("plain"s);
+  server.EnableFuzzySearch();
+  check_batch("fuzzy"s);
+  server.DisableFuzzySearch();
+  server.RemoveDocument(5);
+  server.SetDocumentStatus(6, DocumentStatus::ACTUAL);
+  check_batch("changed"s);
+
+  SearchServer empty;
+  QueryBatchResults results;
+  ProcessQueriesSharedScan(empty, {"cat"s, "dog"s}, results);
+  ASSERT_EQUAL(results.GetQueryCount(), 2u);
+  ASSERT(results.documents.empty());
+}
+
+void TestDurableSearchServer() {
+  const string directory =
+      "/tmp/search_server_test_wal_"s + to_string(getpid());
+  filesystem::remove_all(directory);
+  const vector<string> queries = {"fluffy cat"s, "dog -fluffy"s, "collar"s};
+  auto check_same = [&queries](const SearchServer &lhs,
+                               const SearchServer &rhs) {
+    ASSERT_EQUAL(lhs.GetDocumentCount(), rhs.GetDocumentCount());
+    for (const string &query : queries) {
+      const vector<Document> expected = lhs.FindTopDocuments(query);
+      const vector<Document> found = rhs.FindTopDocuments(query);
+      ASSERT_EQUAL_HINT(found.size(), expected.size(), query);
+      for (size_t i = 0; i < found.size(); ++i) {
+        ASSERT_EQUAL_HINT(found[i].id, expected[i].id, query);
+        ASSERT_EQUAL_HINT(found[i].rating, expected[i].rating, query);
+      }
+    }
+  };
+
+  SearchServer reference{"and in on with"s};
+  {
+    DurableSearchServer durable{directory, "and in on with"sv};
+    FillTestServer(durable);
+    FillTestServer(reference);
+    durable.RemoveDocument(2);
+    durable.RemoveDocument(100);
+    reference.RemoveDocument(2);
+    durable.Sync();
+    const WalStats stats = durable.GetWalStats();
+    ASSERT_EQUAL(stats.records, size_t(reference.GetDocumentCount() + 2));
+    ASSERT(stats.syncs >= 1 && stats.syncs <= stats.records);
+  }
+  {
+    DurableSearchServer durable{directory, "and in on with"sv};
+    ASSERT_EQUAL(durable.GetReplayedRecordCount(),
+                 size_t(reference.GetDocumentCount() + 2));
+    check_same(reference, durable.GetServer());
+    durable.Checkpoint();
+    durable.AddDocument(50, "fluffy dog"s, DocumentStatus::ACTUAL, {5});
+    reference.AddDocument(50, "fluffy dog"s, DocumentStatus::ACTUAL, {5});
+    try {
+      durable.AddDocument(50, "cat"s, DocumentStatus::ACTUAL, {1});
+      ASSERT_HINT(false, "Rejected changes are not logged"s);
+    } catch (const invalid_argument &) {
+    }
+  }
+  {
+    // A crash in the middle of a write leaves a torn record behind
+    ofstream log(directory + "/wal"s, ios::binary | ios::app);
+    log << "torn"s;
+  }
+  {
+    DurabilityOptions options;
+    options.wait_for_durability = true;
+    DurableSearchServer durable{directory, "and in on with"sv, options};
+    ASSERT_EQUAL(durable.GetReplayedRecordCount(), 1u);
+    check_same(reference, durable.GetServer());
+    durable.RemoveDocument(50);
+    reference.RemoveDocument(50);
+  }
+  {
+    DurableSearchServer durable{directory, "and in on with"sv};
+    check_same(reference, durable.GetServer());
+  }
+  {
+    ofstream snapshot(directory + "/snapshot"s, ios::binary | ios::app);
+    snapshot << "damaged"s;
+  }
+  try {
+    DurableSearchServer durable{directory, "and in on with"sv};
+    ASSERT_HINT(false, "Damaged snapshots are rejected"s);
+  } catch (const invalid_argument &) {
+  }
+  filesystem::remove_all(directory);
+}
+
+void TestFrozenIndex() {
+  vector<string> keys;
+  vector<pair<string_view, int>> items;
+  for (int i = 0; i < 10'000; ++i) {
+    keys.push_back("key"s + to_string(i));
+  }
+  for (int i = 0; i < 10'000; ++i) {
+    items.push_back({keys[i], i});
+  }
+  const MinimalPerfectHash<int> hash{items};
+  ASSERT_EQUAL(hash.GetSize(), size_t{10'000});
+  for (int i = 0; i < 10'000; ++i) {
+    const auto *entry = hash.Find(keys[i]);
+    ASSERT(entry != nullptr);
+    ASSERT_EQUAL(entry->value, i);
+    ASSERT(hash.Find("absent"s + to_string(i)) == nullptr);
+  }
+  ASSERT(MinimalPerfectHash<int>{}.Find("key0"s) == nullptr);
+  items.push_back({keys[3], 0});
+  try {
+    MinimalPerfectHash<int>{items};
+    ASSERT_HINT(false, "Repeated keys must throw");
+  } catch (const invalid_argument &) {
+  }
+
+  mt19937 generator{23};
+  SearchServer server{"w0 unused"s};
+  FillRandomServer(server, generator);
+  vector<string> queries;
+  for (int q = 0; q < 50; ++q) {
+    string query = GenerateRandomText(generator, 6) + "w0 w99"s;
+    if (q % 4 == 0) {
+      query += " -"s + GenerateRandomText(generator, 1);
+    }
+    queries.push_back(query);
+  }
+  vector<vector<Document>> expected;
+  vector<vector<string_view>> expected_words;
+  for (const string &query : queries) {
+    expected.push_back(server.FindTopDocuments(query));
+    expected_words.push_back(get<0>(server.MatchDocument(query, 42)));
+  }
+
+  server.Freeze();
+  ASSERT(server.IsFrozen());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const vector<Document> frozen = server.FindTopDocuments(queries[i]);
+    ASSERT_EQUAL(frozen.size(), expected[i].size());
+    for (size_t j = 0; j < frozen.size(); ++j) {
+      ASSERT_EQUAL(frozen[j].id, expected[i][j].id);
+      ASSERT(abs(frozen[j].relevance - expected[i][j].relevance) <
+             RELEVANCE_PRECISION);
+    }
+    ASSERT(server.FindTopDocuments(execution::par, queries[i]).size() ==
+           expected[i].size());
+    ASSERT(get<0>(server.MatchDocument(queries[i], 42)) == expected_words[i]);
+    ASSERT(get<0>(server.MatchDocument(execution::par, queries[i], 42)) ==
+           expected_words[i]);
+  }
+  ASSERT(server.FindTopDocuments("w0 unused"s).empty());
+  ASSERT(server.GetMemoryStats().caches.elements > 0);
+
+  // New stop words that are not indexed change no postings
+  server.SetStopWords("w77"s);
+  ASSERT(!server.IsFrozen());
+  server.Freeze();
+  ASSERT(server.FindTopDocuments("w77"s).empty());
+  server.AddDocument(1'000, "w99"s, DocumentStatus::ACTUAL, {1});
+  ASSERT(!server.IsFrozen());
+  server.Freeze();
+  ASSERT_EQUAL(server.FindTopDocuments("w99"s).size(), size_t{1});
+  server.RemoveDocument(1'000);
+  ASSERT(!server.IsFrozen());
+}
+
 void TestSearchServer() {
   TestExcludeStopWordsFromAddedDocumentContent();
   TestMinusWordsSupport();
@@ -169,4 +1677,27 @@ void TestSearchServer() {
   TestRelevance();
   TestStatus();
   TestFilter();
+  TestRemoveDocument();
+  TestFuzzySearch();
+  TestShardedSearchServer();
+  TestTaskScheduler();
+  TestLoadCorpus();
+  TestQueryArena();
+  TestQueryPlanner();
+  TestPruneFrequentWords();
+  TestUpdateDocument();
+  TestMemoryStats();
+  TestStorageProfiles();
+  TestBatchResults();
+  TestPreparedQuery();
+  TestQueryBudget();
+  TestConcurrentMap();
+  TestFacets();
+  TestSimilarDocuments();
+  TestHitCount();
+  TestTieredSearchServer();
+  TestFieldWeights();
+  TestSharedScanBatch();
+  TestDurableSearchServer();
+  TestFrozenIndex();
 }
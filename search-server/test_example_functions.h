@@ -54,6 +54,53 @@ void TestStatus();
 
 void TestFilter();
 
+void TestRemoveDocument();
+
+void TestFuzzySearch();
+
+void TestShardedSearchServer();
+
+void TestTaskScheduler();
+
+void TestLoadCorpus();
+
+void TestQueryArena();
+
+
+void TestQueryPlanner();
+
+void TestPruneFrequentWords();
+
+void TestUpdateDocument();
+
+void TestMemoryStats();
+
+void TestStorageProfiles();
+
+void TestBatchResults();
+
+void TestPreparedQuery();
+
+void TestQueryBudget();
+
+void TestConcurrentMap();
+
+void TestFacets();
+
+void TestSimilarDocuments();
+
+void TestHitCount();
+
+void TestTieredSearchServer();
+
+void TestFieldWeights();
+
+void TestSharedScanBatch();
+
+void TestDurableSearchServer();
+
+void TestFrozenIndex();
+
 void TestSearchServer();
 
 template <typename T, typename U>
@@ -0,0 +1,102 @@
+#include "tiered_search_server.h"
+#include <cmath>
+
+ostream &operator<<(ostream &os, const TierStats &stats) {
+  return os << "{ queries = "s << stats.queries << ", hot only = "s
+            << stats.hot_only_queries << ", cold = "s << stats.cold_queries
+            << ", hot documents = "s << stats.hot_documents
+            << ", cold documents = "s << stats.cold_documents << " }"s;
+}
+
+void TieredSearchServer::AddDocument(int document_id, string_view document,
+                                     DocumentStatus status,
+                                     const vector<int> &ratings) {
+  if (HasColdDocument(document_id)) {
+    throw invalid_argument("Either document ID or content is incorrect");
+  }
+  hot_.AddDocument(document_id, document, status, ratings);
+}
+
+void TieredSearchServer::RemoveDocument(int document_id) {
+  if (hot_.documents_.count(document_id) > 0) {
+    hot_.RemoveDocument(document_id);
+  } else if (HasColdDocument(document_id)) {
+    removed_cold_ids_.insert(document_id);
+  }
+}
+
+size_t TieredSearchServer::MoveColdDocuments(const string &path) {
+  return MoveColdDocuments(
+      path, [](int, DocumentStatus status, int, size_t accesses) {
+        return status != DocumentStatus::ACTUAL || accesses == 0;
+      });
+}
+
+int TieredSearchServer::GetDocumentCount() const {
+  size_t count = hot_.documents_.size();
+  for (const auto &segment : cold_segments_) {
+    count += segment->GetDocumentCount();
+  }
+  return static_cast<int>(count - removed_cold_ids_.size());
+}
+
+TierStats TieredSearchServer::GetTierStats() const {
+  TierStats stats;
+  stats.queries = counters_.queries.load(memory_order_relaxed);
+  stats.hot_only_queries = counters_.hot_only_queries.load(memory_order_relaxed);
+  stats.cold_queries = counters_.cold_queries.load(memory_order_relaxed);
+  stats.hot_documents = counters_.hot_documents.load(memory_order_relaxed);
+  stats.cold_documents = counters_.cold_documents.load(memory_order_relaxed);
+  return stats;
+}
+
+bool TieredSearchServer::HasColdDocument(int document_id) const {
+  for (const auto &segment : cold_segments_) {
+    if (segment->FindDocument(document_id) != nullptr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void TieredSearchServer::ComputeGlobalInvDocFreqs(
+    SearchServer::Query &query) const {
+  size_t document_count = hot_.documents_.size();
+  vector<size_t> docs_with_word(query.plus_words.size());
+  for (size_t i = 0; i < query.plus_words.size(); ++i) {
+    const auto it = hot_.word_to_docs_freq_.find(query.plus_words[i]);
+    if (it != hot_.word_to_docs_freq_.end()) {
+      docs_with_word[i] += it->second.size();
+    }
+  }
+  for (const auto &segment : cold_segments_) {
+    document_count += segment->GetDocumentCount();
+    for (size_t i = 0; i < query.plus_words.size(); ++i) {
+      docs_with_word[i] += segment->FindPostings(query.plus_words[i]).size;
+    }
+  }
+  query.plus_inv_doc_freqs.assign(query.plus_words.size(), 0.0);
+  for (size_t i = 0; i < query.plus_words.size(); ++i) {
+    if (docs_with_word[i] > 0) {
+      query.plus_inv_doc_freqs[i] =
+          log(static_cast<double>(document_count) / docs_with_word[i]);
+    }
+  }
+}
+
+void TieredSearchServer::RecordQuery(const vector<Document> &documents,
+                                     bool read_cold) const {
+  size_t hot_documents = 0;
+  for (const Document &document : documents) {
+    if (hot_.documents_.count(document.id) > 0) {
+      access_counts_->Add(document.id, 1);
+      ++hot_documents;
+    }
+  }
+  counters_.queries.fetch_add(1, memory_order_relaxed);
+  (read_cold ? counters_.cold_queries : counters_.hot_only_queries)
+      .fetch_add(1, memory_order_relaxed);
+  counters_.hot_documents.fetch_add(hot_documents, memory_order_relaxed);
+  counters_.cold_documents.fetch_add(documents.size() - hot_documents,
+                                     memory_order_relaxed);
+}
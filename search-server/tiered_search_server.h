@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cold_segment.h"
+#include "concurrent_map.h"
+#include "search_server.h"
+
+struct TierStats {
+  size_t queries = 0;
+  // Queries the hot tier filled on its own
+  size_t hot_only_queries = 0;
+  size_t cold_queries = 0;
+  // Documents returned from each tier
+  size_t hot_documents = 0;
+  size_t cold_documents = 0;
+
+  [[nodiscard]] double GetHotHitRate() const {
+    return queries == 0 ? 0.0 : static_cast<double>(hot_only_queries) / queries;
+  }
+};
+
+ostream &operator<<(ostream &os, const TierStats &stats);
+
+// Keeps the documents queries return in a SearchServer and moves the rest to
+// cold segments, files read through a memory mapping. A query runs against
+// the hot tier and reads the cold segments only if that returns fewer than
+// MAX_RESULT_DOCUMENT_COUNT documents, so a cold document may be left out
+// where a single server would rank it higher. Inverse document frequencies
+// are computed over both tiers; documents removed from a cold segment still
+// count in them until the segment is dropped.
+//
+// Queries may run concurrently with each other but not with changes.
+class TieredSearchServer {
+public:
+  TieredSearchServer() = default;
+
+  template <typename StopWords>
+  explicit TieredSearchServer(const StopWords &stop_words)
+      : hot_(stop_words) {}
+
+  void AddDocument(int document_id, string_view document, DocumentStatus status,
+                   const vector<int> &ratings);
+
+  // Unknown ids are ignored
+  void RemoveDocument(int document_id);
+
+  // -------------------------------------------
+
+  [[nodiscard]] vector<Document> FindTopDocuments(string_view raw_query) const {
+    return FindTopDocuments(execution::seq, raw_query, DocumentStatus::ACTUAL);
+  }
+
+  template <typename DocumentFilter>
+  [[nodiscard]] vector<Document>
+  FindTopDocuments(string_view raw_query, DocumentFilter doc_filter) const {
+    return FindTopDocuments(execution::seq, raw_query, doc_filter);
+  }
+
+  template <typename ExecPolicy, typename DocumentFilter>
+  [[nodiscard]] vector<Document> FindTopDocuments(ExecPolicy &policy,
+                                                  string_view raw_query,
+                                                  DocumentFilter doc_filter) const;
+
+  // -------------------------------------------
+
+  // Writes documents for which is_cold(id, status, rating, times returned
+  // since the previous move) holds to a new segment at path and drops them
+  // from memory. Returns how many were moved; the counts start over.
+  template <typename Predicate>
+  size_t MoveColdDocuments(const string &path, Predicate is_cold);
+
+  // Moves documents that are not ACTUAL or were not returned since the
+  // previous move
+  size_t MoveColdDocuments(const string &path);
+
+  [[nodiscard]] int GetDocumentCount() const;
+
+  [[nodiscard]] int GetHotDocumentCount() const {
+    return hot_.GetDocumentCount();
+  }
+
+  [[nodiscard]] size_t GetColdSegmentCount() const {
+    return cold_segments_.size();
+  }
+
+  [[nodiscard]] TierStats GetTierStats() const;
+
+  [[nodiscard]] const SearchServer &GetHotServer() const { return hot_; }
+
+private:
+  struct Counters {
+    atomic<size_t> queries{0};
+    atomic<size_t> hot_only_queries{0};
+    atomic<size_t> cold_queries{0};
+    atomic<size_t> hot_documents{0};
+    atomic<size_t> cold_documents{0};
+  };
+
+  SearchServer hot_;
+  vector<unique_ptr<ColdSegment>> cold_segments_;
+  // Removed from a cold segment, which cannot change
+  set<int> removed_cold_ids_;
+  // Times each hot document was returned, see MoveColdDocuments
+  unique_ptr<ConcurrentMap<int, size_t>> access_counts_ =
+      make_unique<ConcurrentMap<int, size_t>>();
+  mutable Counters counters_;
+
+  // Also for removed documents, whose ids stay taken
+  bool HasColdDocument(int document_id) const;
+
+  void ComputeGlobalInvDocFreqs(SearchServer::Query &query) const;
+
+  template <typename DocumentFilter>
+  void FindColdDocuments(const ColdSegment &segment,
+                         const SearchServer::Query &query,
+                         DocumentFilter &doc_filter,
+                         vector<Document> &documents) const;
+
+  void RecordQuery(const vector<Document> &documents, bool read_cold) const;
+};
+
+template <typename ExecPolicy, typename DocumentFilter>
+vector<Document>
+TieredSearchServer::FindTopDocuments(ExecPolicy &policy, string_view raw_query,
+                                     DocumentFilter doc_filter) const {
+  if constexpr (is_same_v<DocumentFilter, DocumentStatus>) {
+    return FindTopDocuments(
+        policy, raw_query,
+        [doc_filter](int, DocumentStatus status, int) {
+          return status == doc_filter;
+        });
+  } else {
+    QueryArenaScope scratch;
+    SearchServer::Query query =
+        hot_.ParseQuery(raw_query, scratch.GetResource());
+    ComputeGlobalInvDocFreqs(query);
+    vector<Document> documents =
+        hot_.FindTopDocumentsByQuery(policy, query, doc_filter);
+    const bool read_cold = documents.size() < MAX_RESULT_DOCUMENT_COUNT &&
+                           !cold_segments_.empty();
+    if (read_cold) {
+      for (const auto &segment : cold_segments_) {
+        FindColdDocuments(*segment, query, doc_filter, documents);
+      }
+      SearchServer::SortAndTrimDocuments(documents);
+    }
+    RecordQuery(documents, read_cold);
+    return documents;
+  }
+}
+
+template <typename DocumentFilter>
+void TieredSearchServer::FindColdDocuments(const ColdSegment &segment,
+                                           const SearchServer::Query &query,
+                                           DocumentFilter &doc_filter,
+                                           vector<Document> &documents) const {
+  vector<ColdSegment::Postings> plus_postings;
+  for (const string_view word : query.plus_words) {
+    plus_postings.push_back(segment.FindPostings(word));
+    // Every list is requested before any is read
+    segment.Prefetch(plus_postings.back());
+  }
+  vector<int> excluded_ids;
+  for (const string_view word : query.minus_words) {
+    const ColdSegment::Postings postings = segment.FindPostings(word);
+    excluded_ids.insert(excluded_ids.end(), postings.ids,
+                        postings.ids + postings.size);
+  }
+  sort(excluded_ids.begin(), excluded_ids.end());
+
+  unordered_map<int, double> doc_to_relev;
+  for (size_t i = 0; i < plus_postings.size(); ++i) {
+    const double factor =
+        query.plus_inv_doc_freqs[i] *
+        (query.plus_weights.empty() ? 1.0 : query.plus_weights[i]);
+    const ColdSegment::Postings &postings = plus_postings[i];
+    for (size_t j = 0; j < postings.size; ++j) {
+      doc_to_relev[postings.ids[j]] += factor * postings.term_freqs[j];
+    }
+  }
+  for (const auto &[id, relevance] : doc_to_relev) {
+    if (removed_cold_ids_.count(id) > 0 ||
+        binary_search(excluded_ids.begin(), excluded_ids.end(), id)) {
+      continue;
+    }
+    const ColdSegment::DocumentEntry &entry = *segment.FindDocument(id);
+    const auto status = static_cast<DocumentStatus>(entry.status);
+    if (doc_filter(id, status, entry.rating)) {
+      documents.push_back({id, relevance, entry.rating});
+    }
+  }
+}
+
+template <typename Predicate>
+size_t TieredSearchServer::MoveColdDocuments(const string &path,
+                                             Predicate is_cold) {
+  vector<ColdSegment::DocumentWords> cold_documents;
+  for (const auto &[id, data] : hot_.documents_) {
+    if (is_cold(id, data.status, data.rating,
+                access_counts_->Find(id).value_or(0))) {
+      // Words view the hot dictionary until the document is removed
+      cold_documents.push_back(
+          {id, data.status, data.rating, hot_.CollectDocumentWords(id)});
+    }
+  }
+  access_counts_ = make_unique<ConcurrentMap<int, size_t>>();
+  if (cold_documents.empty()) {
+    return 0;
+  }
+  ColdSegment::Write(path, cold_documents);
+  cold_segments_.push_back(make_unique<ColdSegment>(path));
+  for (const ColdSegment::DocumentWords &document : cold_documents) {
+    hot_.RemoveDocument(document.id);
+  }
+  return cold_documents.size();
+}
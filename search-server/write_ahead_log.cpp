@@ -0,0 +1,265 @@
+#include "write_ahead_log.h"
+#include "read_input_functions.h"
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+// Sequence, type, id, status and rating in front of the text
+const size_t RECORD_FIXED_SIZE = 8 + 1 + 3 * 4;
+// Payload size and its CRC-32
+const size_t RECORD_HEADER_SIZE = 2 * 4;
+
+uint32_t ComputeCrc32(string_view data) {
+  static const array<uint32_t, 256> table = [] {
+    array<uint32_t, 256> result{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; ++bit) {
+        crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+      }
+      result[i] = crc;
+    }
+    return result;
+  }();
+  uint32_t crc = 0xFFFFFFFFu;
+  for (const char c : data) {
+    crc = table[(crc ^ static_cast<uint8_t>(c)) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+template <typename T> void AppendValue(string &out, T value) {
+  out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> T ReadValue(const char *&data) {
+  T value;
+  memcpy(&value, data, sizeof(value));
+  data += sizeof(value);
+  return value;
+}
+
+void WriteAll(int fd, string_view data) {
+  while (!data.empty()) {
+    const ssize_t written = write(fd, data.data(), data.size());
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw system_error(errno, generic_category(), "write");
+    }
+    data.remove_prefix(written);
+  }
+}
+
+// A file created or renamed in the directory only survives a crash once the
+// directory is synced
+void SyncParentDirectory(const string &path) {
+  const string directory = filesystem::path(path).parent_path().string();
+  const int directory_fd = open(directory.empty() ? "." : directory.c_str(),
+                                O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (directory_fd >= 0) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const string &path, uint64_t next_sequence,
+                             const WalOptions &options)
+    : options_(options), next_sequence_(next_sequence),
+      durable_sequence_(next_sequence - 1) {
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw system_error(errno, generic_category(), "open " + path);
+  }
+  SyncParentDirectory(path);
+  writer_ = thread([this] { RunWriter(); });
+}
+
+WriteAheadLog::~WriteAheadLog() {
+  {
+    lock_guard lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_one();
+  writer_.join();
+  close(fd_);
+}
+
+uint64_t WriteAheadLog::Append(WalRecord record) {
+  lock_guard lock(mutex_);
+  record.sequence = next_sequence_++;
+  const bool was_empty = buffer_.empty();
+  Encode(record, buffer_);
+  ++stats_.records;
+  if (was_empty) {
+    work_cv_.notify_one();
+  }
+  return record.sequence;
+}
+
+void WriteAheadLog::WaitDurable(uint64_t sequence) {
+  unique_lock lock(mutex_);
+  if (durable_sequence_ < sequence && !error_) {
+    // Whatever is appended while this sync runs waits for the next one
+    flush_requested_ = true;
+    work_cv_.notify_one();
+    durable_cv_.wait(lock, [this, sequence] {
+      return durable_sequence_ >= sequence || error_;
+    });
+  }
+  if (error_) {
+    rethrow_exception(error_);
+  }
+}
+
+void WriteAheadLog::Sync() { WaitDurable(GetLastSequence()); }
+
+uint64_t WriteAheadLog::GetLastSequence() const {
+  lock_guard lock(mutex_);
+  return next_sequence_ - 1;
+}
+
+void WriteAheadLog::Reset() {
+  Sync();
+  lock_guard lock(file_mutex_);
+  if (ftruncate(fd_, 0) < 0 || fdatasync(fd_) < 0) {
+    throw system_error(errno, generic_category(), "truncate log");
+  }
+}
+
+WalStats WriteAheadLog::GetStats() const {
+  lock_guard lock(mutex_);
+  return stats_;
+}
+
+void WriteAheadLog::RunWriter() {
+  unique_lock lock(mutex_);
+  while (true) {
+    work_cv_.wait(lock, [this] { return stop_ || !buffer_.empty(); });
+    if (buffer_.empty()) {
+      return;
+    }
+    // Lets more records join this sync
+    work_cv_.wait_for(lock, options_.commit_interval,
+                      [this] { return stop_ || flush_requested_; });
+    string pending;
+    swap(pending, buffer_);
+    const uint64_t last_sequence = next_sequence_ - 1;
+    flush_requested_ = false;
+    lock.unlock();
+    exception_ptr error;
+    try {
+      lock_guard file_lock(file_mutex_);
+      WriteAll(fd_, pending);
+      if (fdatasync(fd_) < 0) {
+        throw system_error(errno, generic_category(), "sync log");
+      }
+    } catch (...) {
+      error = current_exception();
+    }
+    lock.lock();
+    if (error) {
+      error_ = error;
+    } else {
+      durable_sequence_ = last_sequence;
+      ++stats_.syncs;
+      stats_.bytes += pending.size();
+    }
+    durable_cv_.notify_all();
+  }
+}
+
+void WriteAheadLog::Encode(const WalRecord &record, string &out) {
+  const size_t header_offset = out.size();
+  out.resize(out.size() + RECORD_HEADER_SIZE);
+  const size_t payload_offset = out.size();
+  AppendValue(out, record.sequence);
+  AppendValue(out, static_cast<uint8_t>(record.type));
+  AppendValue(out, static_cast<int32_t>(record.document_id));
+  AppendValue(out, static_cast<int32_t>(record.status));
+  AppendValue(out, static_cast<int32_t>(record.rating));
+  out += record.text;
+  const string_view payload = string_view{out}.substr(payload_offset);
+  const uint32_t header[2] = {static_cast<uint32_t>(payload.size()),
+                              ComputeCrc32(payload)};
+  memcpy(out.data() + header_offset, header, sizeof(header));
+}
+
+vector<WalRecord> WriteAheadLog::Read(const string &path,
+                                      size_t *valid_size) {
+  vector<WalRecord> records;
+  size_t offset = 0;
+  if (filesystem::exists(path)) {
+    const MappedFile file(path);
+    const string_view contents = file.GetContents();
+    while (contents.size() - offset >= RECORD_HEADER_SIZE) {
+      const char *data = contents.data() + offset;
+      const auto payload_size = ReadValue<uint32_t>(data);
+      const auto crc = ReadValue<uint32_t>(data);
+      if (payload_size < RECORD_FIXED_SIZE ||
+          payload_size > contents.size() - offset - RECORD_HEADER_SIZE ||
+          ComputeCrc32({data, payload_size}) != crc) {
+        break;
+      }
+      WalRecord record;
+      record.sequence = ReadValue<uint64_t>(data);
+      const auto type = ReadValue<uint8_t>(data);
+      if (type < static_cast<uint8_t>(WalRecordType::ADD) ||
+          type > static_cast<uint8_t>(WalRecordType::CHECKPOINT)) {
+        break;
+      }
+      record.type = static_cast<WalRecordType>(type);
+      record.document_id = ReadValue<int32_t>(data);
+      record.status = static_cast<DocumentStatus>(ReadValue<int32_t>(data));
+      record.rating = ReadValue<int32_t>(data);
+      record.text.assign(data, payload_size - RECORD_FIXED_SIZE);
+      records.push_back(move(record));
+      offset += RECORD_HEADER_SIZE + payload_size;
+    }
+  }
+  if (valid_size) {
+    *valid_size = offset;
+  }
+  return records;
+}
+
+vector<WalRecord> WriteAheadLog::Recover(const string &path) {
+  size_t valid_size = 0;
+  vector<WalRecord> records = Read(path, &valid_size);
+  if (filesystem::exists(path) && filesystem::file_size(path) > valid_size) {
+    filesystem::resize_file(path, valid_size);
+  }
+  return records;
+}
+
+void WriteAheadLog::WriteFileAtomically(const string &path,
+                                        string_view contents) {
+  const string temporary_path = path + ".tmp"s;
+  const int fd =
+      open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+           0644);
+  if (fd < 0) {
+    throw system_error(errno, generic_category(), "open " + temporary_path);
+  }
+  try {
+    WriteAll(fd, contents);
+    if (fsync(fd) < 0) {
+      throw system_error(errno, generic_category(), "sync " + temporary_path);
+    }
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  close(fd);
+  filesystem::rename(temporary_path, path);
+  SyncParentDirectory(path);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "document.h"
+
+using namespace std;
+
+enum class WalRecordType : uint8_t {
+  ADD = 1,
+  REMOVE = 2,
+  // Opens a snapshot, its sequence is the last mutation the snapshot holds
+  CHECKPOINT = 3
+};
+
+struct WalRecord {
+  uint64_t sequence = 0;
+  WalRecordType type = WalRecordType::ADD;
+  int document_id = 0;
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  // Already averaged
+  int rating = 0;
+  string text;
+};
+
+struct WalOptions {
+  // Longest an appended record waits before the log writer syncs it unless
+  // someone waits for it sooner
+  chrono::microseconds commit_interval{2000};
+};
+
+struct WalStats {
+  size_t records = 0;
+  size_t syncs = 0;
+  size_t bytes = 0;
+};
+
+// Append-only file of index mutations. Appends only copy the record into a
+// buffer; a writer thread writes the buffer and fdatasyncs it once
+// commit_interval passed or someone waits for durability, so records
+// appended meanwhile share one sync (group commit). Every record carries
+// its length and a CRC-32, and reading stops at the first torn or damaged
+// one, as a crash in the middle of a write leaves it.
+class WriteAheadLog {
+public:
+  // Appends to the file at path, which is created if missing; records are
+  // numbered from next_sequence on. Throws system_error.
+  WriteAheadLog(const string &path, uint64_t next_sequence,
+                const WalOptions &options = {});
+
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  // Syncs whatever is still buffered
+  ~WriteAheadLog();
+
+  // Returns the sequence number given to the record
+  uint64_t Append(WalRecord record);
+
+  // Blocks until the record and all before it are on disk. Throws
+  // system_error if writing the log failed.
+  void WaitDurable(uint64_t sequence);
+
+  void Sync();
+
+  // Sequence number of the last record appended
+  [[nodiscard]] uint64_t GetLastSequence() const;
+
+  // Drops every record, e.g. once a snapshot holds them
+  void Reset();
+
+  [[nodiscard]] WalStats GetStats() const;
+
+  // Records of the file in order up to the first damaged one, none if the
+  // file is missing. Cuts the file after the last good record, so appends
+  // do not follow a torn one.
+  static vector<WalRecord> Recover(const string &path);
+
+  // Records up to the first damaged one; valid_size gets the bytes they take
+  static vector<WalRecord> Read(const string &path,
+                                size_t *valid_size = nullptr);
+
+  static void Encode(const WalRecord &record, string &out);
+
+  // Replaces the file at path with contents through a synced temporary
+  // file, so a crash leaves either the old or the new contents
+  static void WriteFileAtomically(const string &path, string_view contents);
+
+private:
+  int fd_ = -1;
+  WalOptions options_;
+  mutable mutex mutex_;
+  // Held while the file is written, so Reset does not cut a write short
+  mutex file_mutex_;
+  condition_variable work_cv_;
+  condition_variable durable_cv_;
+  string buffer_;
+  uint64_t next_sequence_;
+  uint64_t durable_sequence_;
+  bool flush_requested_ = false;
+  bool stop_ = false;
+  exception_ptr error_;
+  WalStats stats_;
+  thread writer_;
+
+  void RunWriter();
+};
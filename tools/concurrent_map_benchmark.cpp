@@ -0,0 +1,230 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_map.h"
+
+using namespace std;
+
+namespace {
+
+// ConcurrentMap as it was before open addressing: a fixed number of
+// std::map buckets, each behind a mutex
+template <typename Key, typename Value> class BucketConcurrentMap {
+private:
+  struct Bucket {
+    mutex mut;
+    map<Key, Value> dict;
+  };
+
+public:
+  struct Access {
+    lock_guard<mutex> guard;
+    Value &ref_to_value;
+
+    Access(const Key &key, Bucket &bucket)
+        : guard(bucket.mut), ref_to_value(bucket.dict[key]) {}
+  };
+
+  explicit BucketConcurrentMap(size_t bucket_count) : buckets_(bucket_count) {}
+
+  Access operator[](const Key &key) {
+    auto &bucket = buckets_[static_cast<uint64_t>(key) % buckets_.size()];
+    return {key, bucket};
+  }
+
+  map<Key, Value> BuildOrdinaryMap() {
+    map<Key, Value> result;
+    for (auto &[mut, dict] : buckets_) {
+      lock_guard g(mut);
+      result.insert(dict.begin(), dict.end());
+    }
+    return result;
+  }
+
+private:
+  vector<Bucket> buckets_;
+};
+
+struct BenchmarkConfig {
+  size_t max_threads = 64;
+  size_t operations = 1'000'000;
+  int keys = 100'000;
+  // Share of operations that only read
+  double read_share = 0;
+};
+
+// Keys of all threads together, each thread reads or adds in its own order
+vector<vector<int>> GenerateKeys(const BenchmarkConfig &config,
+                                 size_t thread_count) {
+  vector<vector<int>> keys(thread_count);
+  const size_t per_thread = config.operations / thread_count;
+  for (size_t t = 0; t < thread_count; ++t) {
+    mt19937 generator(t);
+    uniform_int_distribution<int> key(0, config.keys - 1);
+    keys[t].reserve(per_thread);
+    for (size_t i = 0; i < per_thread; ++i) {
+      keys[t].push_back(key(generator));
+    }
+  }
+  return keys;
+}
+
+template <typename Operation>
+double RunThreads(const vector<vector<int>> &keys, Operation operation) {
+  const auto start = chrono::steady_clock::now();
+  vector<thread> threads;
+  for (size_t t = 0; t < keys.size(); ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i < keys[t].size(); ++i) {
+        operation(keys[t][i], i);
+      }
+    });
+  }
+  for (thread &worker : threads) {
+    worker.join();
+  }
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+struct BenchmarkResult {
+  double bucket_seconds = 0;
+  double hash_seconds = 0;
+  double bucket_total = 0;
+  double hash_total = 0;
+};
+
+// Every operation adds 1 to its key or reads it, as scoring accumulates
+// relevance per document
+BenchmarkResult RunBenchmark(const BenchmarkConfig &config,
+                             size_t thread_count) {
+  const vector<vector<int>> keys = GenerateKeys(config, thread_count);
+  const size_t reads_per_100 = static_cast<size_t>(config.read_share * 100);
+  BenchmarkResult result;
+
+  BucketConcurrentMap<int, double> bucket_map{100};
+  result.bucket_seconds = RunThreads(keys, [&](int key, size_t i) {
+    if (i % 100 < reads_per_100) {
+      [[maybe_unused]] volatile double value = bucket_map[key].ref_to_value;
+    } else {
+      bucket_map[key].ref_to_value += 1;
+    }
+  });
+  for (const auto &[_, value] : bucket_map.BuildOrdinaryMap()) {
+    result.bucket_total += value;
+  }
+
+  ConcurrentMap<int, double> hash_map;
+  result.hash_seconds = RunThreads(keys, [&](int key, size_t i) {
+    if (i % 100 < reads_per_100) {
+      [[maybe_unused]] volatile double value = hash_map.Find(key).value_or(0);
+    } else {
+      hash_map.Add(key, 1);
+    }
+  });
+  for (const auto &[_, value] : hash_map.BuildItems(*TaskScheduler::GetDefault())) {
+    result.hash_total += value;
+  }
+  return result;
+}
+
+void PrintHeader() {
+  cout << setw(8) << "threads"s << setw(10) << "reads"s << setw(16)
+       << "bucket Mops/s"s << setw(16) << "hash Mops/s"s << setw(10)
+       << "speedup"s << endl;
+}
+
+void PrintResult(const BenchmarkConfig &config, size_t thread_count,
+                 const BenchmarkResult &result) {
+  const double operations =
+      static_cast<double>(config.operations / thread_count * thread_count);
+  cout << fixed << setprecision(2) << setw(8) << thread_count << setw(9)
+       << config.read_share * 100 << '%' << setw(16)
+       << operations / result.bucket_seconds / 1e6 << setw(16)
+       << operations / result.hash_seconds / 1e6 << setw(10)
+       << result.bucket_seconds / result.hash_seconds << endl;
+}
+
+void RunAll(BenchmarkConfig config) {
+  PrintHeader();
+  for (const double read_share : {0.0, 0.9}) {
+    config.read_share = read_share;
+    for (size_t threads = 1; threads <= config.max_threads; threads *= 2) {
+      PrintResult(config, threads, RunBenchmark(config, threads));
+    }
+  }
+}
+
+// Both maps see the same additions, so their totals agree with the count of
+// additions at any thread count
+bool RunSelfTest() {
+  BenchmarkConfig config;
+  config.max_threads = 8;
+  config.operations = 100'000;
+  config.keys = 5'000;
+  PrintHeader();
+  for (const double read_share : {0.0, 0.5}) {
+    config.read_share = read_share;
+    for (size_t threads = 1; threads <= config.max_threads; threads *= 2) {
+      const BenchmarkResult result = RunBenchmark(config, threads);
+      PrintResult(config, threads, result);
+      const size_t per_thread = config.operations / threads;
+      size_t additions = 0;
+      for (size_t i = 0; i < per_thread; ++i) {
+        additions += i % 100 >= static_cast<size_t>(read_share * 100);
+      }
+      additions *= threads;
+      if (result.bucket_total != additions || result.hash_total != additions) {
+        cerr << "Self-test check failed: "s << additions << " additions, "s
+             << result.bucket_total << " and "s << result.hash_total
+             << " counted"s << endl;
+        cout << "Self-test FAILED"s << endl;
+        return false;
+      }
+    }
+  }
+  cout << "Self-test passed"s << endl;
+  return true;
+}
+
+void PrintUsage() {
+  cerr << "Usage: concurrent_map_benchmark --self-test\n"
+          "       concurrent_map_benchmark [--max-threads N] "
+          "[--operations N] [--keys N]"s
+       << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchmarkConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg == "--self-test"s) {
+      return RunSelfTest() ? 0 : 1;
+    }
+    if (i + 1 == argc) {
+      PrintUsage();
+      return 1;
+    }
+    const string value = argv[++i];
+    if (arg == "--max-threads"s) {
+      config.max_threads = max<size_t>(1, stoul(value));
+    } else if (arg == "--operations"s) {
+      config.operations = stoul(value);
+    } else if (arg == "--keys"s) {
+      config.keys = max(1, stoi(value));
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  RunAll(config);
+  return 0;
+}
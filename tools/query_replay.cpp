@@ -0,0 +1,454 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "read_input_functions.h"
+#include "search_server.h"
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+enum class OperationType { FIND, ADD, REMOVE };
+
+struct Operation {
+  OperationType type = OperationType::FIND;
+  int document_id = 0;
+  DocumentStatus status = DocumentStatus::ACTUAL;
+  int rating = 0;
+  // Query or document text
+  string text;
+};
+
+enum class Arrival { UNIFORM, POISSON };
+
+struct ReplayConfig {
+  string corpus_path;
+  CorpusFormat corpus_format = CorpusFormat::LINES;
+  string log_path;
+  string stop_words;
+  // Operations started per second
+  double rate = 1000;
+  size_t threads = max(1u, thread::hardware_concurrency());
+  // The log is replayed in a loop up to this many operations, 0 for once;
+  // later passes add and remove documents under shifted ids
+  size_t operations = 0;
+  Arrival arrival = Arrival::UNIFORM;
+};
+
+struct Sample {
+  OperationType type;
+  // From the scheduled start, so a stalled server is charged for the
+  // operations that queued up behind it rather than only for what it ran
+  double latency_us;
+  // From the actual start
+  double service_us;
+  bool ok;
+};
+
+struct ReplayReport {
+  vector<Sample> samples;
+  double seconds = 0;
+};
+
+// One operation per line:
+//   find<TAB>query
+//   add<TAB>id<TAB>status<TAB>ratings<TAB>text  (as CorpusFormat::RECORDS)
+//   remove<TAB>id
+// A line without one of these tags is a query.
+Operation ParseOperation(string_view line) {
+  Operation operation;
+  const size_t tab = line.find('\t');
+  const string_view tag = line.substr(0, tab);
+  const string_view rest =
+      tab == string_view::npos ? string_view{} : line.substr(tab + 1);
+  if (tab != string_view::npos && tag == "add"sv) {
+    const DocumentRecord record = ParseDocumentRecord(rest);
+    operation.type = OperationType::ADD;
+    operation.document_id = record.id;
+    operation.status = record.status;
+    operation.rating = record.rating;
+    operation.text = record.text;
+  } else if (tab != string_view::npos && tag == "remove"sv) {
+    operation.type = OperationType::REMOVE;
+    operation.document_id = stoi(string{rest});
+  } else {
+    operation.text = tab != string_view::npos && tag == "find"sv ? rest : line;
+  }
+  return operation;
+}
+
+vector<Operation> ReadOperations(const string &path) {
+  ifstream input(path);
+  if (!input) {
+    throw runtime_error("Cannot open "s + path);
+  }
+  vector<Operation> operations;
+  string line;
+  while (getline(input, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      operations.push_back(ParseOperation(line));
+    }
+  }
+  return operations;
+}
+
+vector<Clock::duration> ScheduleArrivals(const ReplayConfig &config,
+                                         size_t count) {
+  vector<Clock::duration> offsets(count);
+  mt19937 generator;
+  exponential_distribution<double> gap(config.rate);
+  double seconds = 0;
+  for (size_t i = 0; i < count; ++i) {
+    offsets[i] = chrono::duration_cast<Clock::duration>(
+        chrono::duration<double>(seconds));
+    seconds += config.arrival == Arrival::POISSON ? gap(generator)
+                                                  : 1.0 / config.rate;
+  }
+  return offsets;
+}
+
+// Passes over the log after the first shift the ids of added and removed
+// documents by a multiple of the result, which lies past every id in the
+// server and the log, so each pass adds and removes documents of its own.
+// Throws invalid_argument if that cannot work: the log removes documents
+// it does not add, or the shifted ids would not fit in an int.
+int ComputePassIdStride(const SearchServer &server,
+                        const vector<Operation> &log, size_t passes) {
+  int max_id = -1;
+  for (const int id : server) {
+    max_id = max(max_id, id);
+  }
+  unordered_set<int> added;
+  for (const Operation &operation : log) {
+    if (operation.type == OperationType::ADD) {
+      added.insert(operation.document_id);
+    }
+    if (operation.type != OperationType::FIND) {
+      max_id = max(max_id, operation.document_id);
+    }
+  }
+  for (const Operation &operation : log) {
+    if (operation.type == OperationType::REMOVE &&
+        !added.count(operation.document_id)) {
+      throw invalid_argument(
+          "The log removes document "s + to_string(operation.document_id) +
+          " without adding it, so it cannot be replayed more than once"s);
+    }
+  }
+  const int64_t stride = int64_t{max_id} + 1;
+  if (!added.empty() && stride * static_cast<int64_t>(passes) > INT_MAX) {
+    throw invalid_argument("Too many passes over the log for its ids"s);
+  }
+  return static_cast<int>(stride);
+}
+
+bool Execute(SearchServer &server, shared_mutex &mutex,
+             const Operation &operation, int document_id) {
+  try {
+    switch (operation.type) {
+    case OperationType::FIND: {
+      shared_lock lock(mutex);
+      [[maybe_unused]] const auto documents =
+          server.FindTopDocuments(operation.text);
+      break;
+    }
+    case OperationType::ADD: {
+      lock_guard lock(mutex);
+      server.AddDocument(document_id, operation.text, operation.status,
+                         {operation.rating});
+      break;
+    }
+    case OperationType::REMOVE: {
+      lock_guard lock(mutex);
+      server.RemoveDocument(document_id);
+      break;
+    }
+    }
+  } catch (const exception &) {
+    return false;
+  }
+  return true;
+}
+
+// Every operation is due at a fixed time whether or not earlier ones have
+// finished (open loop); worker threads take them in order. Throws
+// invalid_argument if the log cannot be repeated up to config.operations,
+// see ComputePassIdStride.
+ReplayReport Replay(SearchServer &server, const vector<Operation> &log,
+                    const ReplayConfig &config) {
+  const size_t count = config.operations == 0 ? log.size() : config.operations;
+  const size_t passes = (count + log.size() - 1) / log.size();
+  const int id_stride =
+      passes > 1 ? ComputePassIdStride(server, log, passes) : 0;
+  const vector<Clock::duration> offsets = ScheduleArrivals(config, count);
+  shared_mutex mutex;
+  atomic<size_t> next{0};
+  vector<vector<Sample>> samples(config.threads);
+  const auto start = Clock::now();
+  vector<thread> threads;
+  for (size_t t = 0; t < config.threads; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = next++; i < count; i = next++) {
+        const auto scheduled = start + offsets[i];
+        this_thread::sleep_until(scheduled);
+        const auto begin = Clock::now();
+        const Operation &operation = log[i % log.size()];
+        const int pass = static_cast<int>(i / log.size());
+        const bool ok = Execute(server, mutex, operation,
+                                operation.document_id + pass * id_stride);
+        const auto end = Clock::now();
+        samples[t].push_back(
+            {operation.type,
+             chrono::duration<double, micro>(end - scheduled).count(),
+             chrono::duration<double, micro>(end - begin).count(), ok});
+      }
+    });
+  }
+  for (thread &t : threads) {
+    t.join();
+  }
+
+  ReplayReport report;
+  report.seconds = chrono::duration<double>(Clock::now() - start).count();
+  for (const auto &part : samples) {
+    report.samples.insert(report.samples.end(), part.begin(), part.end());
+  }
+  return report;
+}
+
+double Percentile(vector<double> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  const size_t index = min(values.size() - 1, size_t(p * values.size()));
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+void PrintLatencies(const string &title, vector<double> values) {
+  cout << title << ": p50 = "s << Percentile(values, 0.5) << ", p90 = "s
+       << Percentile(values, 0.9) << ", p99 = "s << Percentile(values, 0.99)
+       << ", p99.9 = "s << Percentile(values, 0.999) << ", max = "s
+       << Percentile(values, 1.0) << endl;
+}
+
+void PrintReport(const ReplayReport &report, const ReplayConfig &config) {
+  size_t counts[3] = {};
+  size_t errors = 0;
+  vector<double> find_latencies, find_service, update_latencies;
+  for (const Sample &sample : report.samples) {
+    ++counts[static_cast<int>(sample.type)];
+    errors += sample.ok ? 0 : 1;
+    if (sample.type == OperationType::FIND) {
+      find_latencies.push_back(sample.latency_us);
+      find_service.push_back(sample.service_us);
+    } else {
+      update_latencies.push_back(sample.latency_us);
+    }
+  }
+  cout << "Operations: "s << report.samples.size() << " (find "s << counts[0]
+       << ", add "s << counts[1] << ", remove "s << counts[2]
+       << "), errors: "s << errors << endl;
+  cout << "Target rate: "s << config.rate << " op/s, achieved: "s
+       << report.samples.size() / report.seconds << " op/s over "s
+       << report.seconds << " s"s << endl;
+  PrintLatencies("Find latency us"s, move(find_latencies));
+  PrintLatencies("Find service time us"s, move(find_service));
+  if (!update_latencies.empty()) {
+    PrintLatencies("Add/remove latency us"s, move(update_latencies));
+  }
+}
+
+void LoadServer(SearchServer &server, const ReplayConfig &config) {
+  if (config.corpus_path.empty()) {
+    return;
+  }
+  CorpusLoadOptions options;
+  options.format = config.corpus_format;
+  const size_t loaded = LoadCorpus(server, config.corpus_path, options);
+  cout << "Loaded "s << loaded << " documents"s << endl;
+}
+
+#define CHECK(expr)                                                            \
+  if (!(expr)) {                                                               \
+    cerr << "Self-test check failed: "s << #expr << endl;                      \
+    return false;                                                              \
+  }
+
+// Replays a generated log at a sustainable rate and then far above
+// capacity, where only latencies measured from the schedule keep growing
+bool RunSelfTest() {
+  const string prefix = "/tmp/search_query_replay_"s + to_string(getpid());
+  const string corpus_path = prefix + ".corpus"s;
+  const string log_path = prefix + ".log"s;
+  mt19937 generator;
+  auto random_text = [&generator](int word_count) {
+    string text;
+    for (int i = 0; i < word_count; ++i) {
+      text += (i > 0 ? " w"s : "w"s) +
+              to_string(uniform_int_distribution(0, 300)(generator));
+    }
+    return text;
+  };
+  {
+    ofstream corpus(corpus_path);
+    for (int i = 0; i < 2'000; ++i) {
+      corpus << random_text(40) << '\n';
+    }
+    ofstream log(log_path);
+    for (int i = 0; i < 1'000; ++i) {
+      if (i % 20 == 5) {
+        log << "add\t"s << 10'000 + i << "\tACTUAL\t1 2\t"s << random_text(20)
+            << '\n';
+      } else if (i % 20 == 15) {
+        log << "remove\t"s << 10'000 + i - 10 << '\n';
+      } else {
+        log << (i % 2 == 0 ? "find\t"s : ""s) << random_text(5) << '\n';
+      }
+    }
+  }
+
+  bool ok = [&] {
+    const vector<Operation> log = ReadOperations(log_path);
+    CHECK(log.size() == 1'000);
+    CHECK(log[5].type == OperationType::ADD && log[5].document_id == 10'005);
+    CHECK(log[15].type == OperationType::REMOVE);
+    CHECK(log[1].type == OperationType::FIND && !log[1].text.empty());
+
+    ReplayConfig config;
+    config.corpus_path = corpus_path;
+    config.rate = 2'000;
+    config.threads = 2;
+    config.arrival = Arrival::POISSON;
+    SearchServer server;
+    LoadServer(server, config);
+    CHECK(server.GetDocumentCount() == 2'000);
+    const ReplayReport report = Replay(server, log, config);
+    PrintReport(report, config);
+    CHECK(report.samples.size() == log.size());
+    for (const Sample &sample : report.samples) {
+      CHECK(sample.ok);
+      CHECK(sample.latency_us >= sample.service_us);
+    }
+
+    // Everything is due at once; one thread works through the backlog
+    config.rate = 1e9;
+    config.threads = 1;
+    config.operations = 2'000;
+    const ReplayReport overload = Replay(server, log, config);
+    PrintReport(overload, config);
+    vector<double> latencies, service;
+    for (const Sample &sample : overload.samples) {
+      // The second pass adds and removes documents of its own
+      CHECK(sample.ok);
+      latencies.push_back(sample.latency_us);
+      service.push_back(sample.service_us);
+    }
+    CHECK(Percentile(latencies, 0.99) > 10 * Percentile(service, 0.99));
+    CHECK(server.GetDocumentCount() == 2'000);
+
+    // Removing a corpus document can only be replayed once
+    Operation remove_loaded;
+    remove_loaded.type = OperationType::REMOVE;
+    remove_loaded.document_id = 3;
+    bool rejected = false;
+    try {
+      Replay(server, {remove_loaded}, config);
+    } catch (const invalid_argument &) {
+      rejected = true;
+    }
+    CHECK(rejected);
+    return true;
+  }();
+
+  remove(corpus_path.c_str());
+  remove(log_path.c_str());
+  cout << (ok ? "Self-test passed"s : "Self-test FAILED"s) << endl;
+  return ok;
+}
+
+void PrintUsage() {
+  cerr << "Usage: search_query_replay --self-test\n"
+          "       search_query_replay --log PATH [--corpus PATH] "
+          "[--corpus-format lines|records] [--stop-words \"WORDS\"] "
+          "[--rate OPS_PER_SEC] [--threads N] [--operations N] "
+          "[--arrival uniform|poisson]"s
+       << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  ReplayConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg == "--self-test"s) {
+      return RunSelfTest() ? 0 : 1;
+    }
+    if (i + 1 == argc) {
+      PrintUsage();
+      return 1;
+    }
+    const string value = argv[++i];
+    if (arg == "--log"s) {
+      config.log_path = value;
+    } else if (arg == "--corpus"s) {
+      config.corpus_path = value;
+    } else if (arg == "--corpus-format"s && value == "lines"s) {
+      config.corpus_format = CorpusFormat::LINES;
+    } else if (arg == "--corpus-format"s && value == "records"s) {
+      config.corpus_format = CorpusFormat::RECORDS;
+    } else if (arg == "--stop-words"s) {
+      config.stop_words = value;
+    } else if (arg == "--rate"s) {
+      config.rate = stod(value);
+    } else if (arg == "--threads"s) {
+      config.threads = max<size_t>(1, stoul(value));
+    } else if (arg == "--operations"s) {
+      config.operations = stoul(value);
+    } else if (arg == "--arrival"s && value == "uniform"s) {
+      config.arrival = Arrival::UNIFORM;
+    } else if (arg == "--arrival"s && value == "poisson"s) {
+      config.arrival = Arrival::POISSON;
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (config.log_path.empty() || !(config.rate > 0)) {
+    PrintUsage();
+    return 1;
+  }
+
+  SearchServer server{config.stop_words};
+  LoadServer(server, config);
+  const vector<Operation> log = ReadOperations(config.log_path);
+  if (log.empty()) {
+    cerr << "The log has no operations"s << endl;
+    return 1;
+  }
+  try {
+    const ReplayReport report = Replay(server, log, config);
+    PrintReport(report, config);
+  } catch (const invalid_argument &e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "durable_search_server.h"
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+struct BenchmarkConfig {
+  string directory = "/tmp/search_wal_benchmark"s;
+  // Mutations started per second
+  double rate = 5'000;
+  double seconds = 3;
+  size_t threads = 4;
+};
+
+struct Mutation {
+  bool remove = false;
+  int document_id = 0;
+  string text;
+};
+
+// Mostly additions; every tenth mutation removes a document added shortly
+// before
+vector<Mutation> GenerateMutations(const BenchmarkConfig &config) {
+  const size_t count = static_cast<size_t>(config.rate * config.seconds);
+  mt19937 generator;
+  vector<Mutation> mutations(count);
+  for (size_t i = 0; i < count; ++i) {
+    Mutation &mutation = mutations[i];
+    if (i % 10 == 9) {
+      mutation.remove = true;
+      mutation.document_id = static_cast<int>(i - 5);
+      continue;
+    }
+    mutation.document_id = static_cast<int>(i);
+    for (int word = 0; word < 30; ++word) {
+      mutation.text += (word > 0 ? " w"s : "w"s) +
+                       to_string(uniform_int_distribution(0, 5'000)(generator));
+    }
+  }
+  return mutations;
+}
+
+double Percentile(vector<double> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  const size_t index = min(values.size() - 1, size_t(p * values.size()));
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+struct RunReport {
+  // From the start of each call to its return
+  vector<double> latencies_us;
+  double seconds = 0;
+};
+
+// Thread t applies mutations t, t + threads, ... each at its scheduled time
+template <typename Apply>
+RunReport RunMutations(const vector<Mutation> &mutations,
+                       const BenchmarkConfig &config, Apply apply) {
+  RunReport report;
+  vector<vector<double>> latencies(config.threads);
+  const auto start = Clock::now();
+  vector<thread> threads;
+  for (size_t t = 0; t < config.threads; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = t; i < mutations.size(); i += config.threads) {
+        this_thread::sleep_until(
+            start + chrono::duration_cast<Clock::duration>(
+                        chrono::duration<double>(i / config.rate)));
+        const auto begin = Clock::now();
+        apply(mutations[i]);
+        latencies[t].push_back(
+            chrono::duration<double, micro>(Clock::now() - begin).count());
+      }
+    });
+  }
+  for (thread &worker : threads) {
+    worker.join();
+  }
+  report.seconds = chrono::duration<double>(Clock::now() - start).count();
+  for (const vector<double> &part : latencies) {
+    report.latencies_us.insert(report.latencies_us.end(), part.begin(),
+                               part.end());
+  }
+  return report;
+}
+
+void PrintReport(const string &title, RunReport report) {
+  vector<double> &values = report.latencies_us;
+  double total = 0;
+  for (const double value : values) {
+    total += value;
+  }
+  cout << fixed << setprecision(1) << setw(14) << title << ": "s
+       << values.size() / report.seconds << " mutations/s, latency us mean "s
+       << (values.empty() ? 0 : total / values.size()) << ", p50 "s
+       << Percentile(values, 0.5) << ", p99 "s << Percentile(values, 0.99)
+       << ", max "s << Percentile(values, 1.0) << endl;
+}
+
+void PrintWalStats(const WalStats &stats) {
+  cout << setw(14) << ""s << "  "s << stats.records << " records in "s
+       << stats.syncs << " syncs, "s << setprecision(1)
+       << (stats.syncs > 0 ? double(stats.records) / stats.syncs : 0.0)
+       << " records per sync, "s << stats.bytes / 1024 << " KiB"s << endl;
+}
+
+void ApplyDurable(DurableSearchServer &server, const Mutation &mutation) {
+  if (mutation.remove) {
+    server.RemoveDocument(mutation.document_id);
+  } else {
+    server.AddDocument(mutation.document_id, mutation.text,
+                       DocumentStatus::ACTUAL, {1, 2, 3});
+  }
+}
+
+// Runs the same mutations against an index without a log, with a log
+// synced in the background and with every mutation waiting for its sync;
+// returns the document count the last run left
+int RunAll(const BenchmarkConfig &config) {
+  const vector<Mutation> mutations = GenerateMutations(config);
+  cout << mutations.size() << " mutations at "s << config.rate
+       << " per second from "s << config.threads << " threads"s << endl;
+
+  SearchServer memory_server;
+  mutex memory_mutex;
+  PrintReport("in memory"s,
+              RunMutations(mutations, config, [&](const Mutation &mutation) {
+                lock_guard lock(memory_mutex);
+                if (mutation.remove) {
+                  // Unknown ids are ignored, as by DurableSearchServer
+                  memory_server.RemoveDocument(mutation.document_id);
+                } else {
+                  memory_server.AddDocument(mutation.document_id,
+                                            mutation.text,
+                                            DocumentStatus::ACTUAL, {1, 2, 3});
+                }
+              }));
+
+  int document_count = 0;
+  for (const bool wait : {false, true}) {
+    filesystem::remove_all(config.directory);
+    DurabilityOptions options;
+    options.wait_for_durability = wait;
+    DurableSearchServer server(config.directory, {}, options);
+    PrintReport(wait ? "durable"s : "group commit"s,
+                RunMutations(mutations, config, [&](const Mutation &mutation) {
+                  ApplyDurable(server, mutation);
+                }));
+    server.Sync();
+    PrintWalStats(server.GetWalStats());
+    document_count = server.GetServer().GetDocumentCount();
+  }
+
+  const auto start = Clock::now();
+  const DurableSearchServer reopened(config.directory);
+  cout << "Replayed "s << reopened.GetReplayedRecordCount() << " records in "s
+       << setprecision(3)
+       << chrono::duration<double>(Clock::now() - start).count() << " s"s
+       << endl;
+  if (reopened.GetServer().GetDocumentCount() != document_count) {
+    cerr << "Replay restored "s << reopened.GetServer().GetDocumentCount()
+         << " documents instead of "s << document_count << endl;
+    return -1;
+  }
+  return document_count;
+}
+
+#define CHECK(expr)                                                            \
+  if (!(expr)) {                                                               \
+    cerr << "Self-test check failed: "s << #expr << endl;                      \
+    return false;                                                              \
+  }
+
+// A short run whose log must restore the same index, also once a torn
+// record follows it and once a checkpoint replaced it
+bool RunSelfTest() {
+  BenchmarkConfig config;
+  config.directory = "/tmp/search_wal_benchmark_"s + to_string(getpid());
+  config.rate = 2'000;
+  config.seconds = 0.5;
+  config.threads = 2;
+
+  bool ok = [&] {
+    const int document_count = RunAll(config);
+    CHECK(document_count > 0);
+
+    {
+      ofstream log(config.directory + "/wal"s, ios::binary | ios::app);
+      log << "torn"s;
+    }
+    {
+      DurableSearchServer server(config.directory);
+      CHECK(server.GetServer().GetDocumentCount() == document_count);
+      server.AddDocument(1'000'000, "after torn record"s,
+                         DocumentStatus::ACTUAL, {1});
+      server.Checkpoint();
+    }
+    const DurableSearchServer reopened(config.directory);
+    CHECK(reopened.GetReplayedRecordCount() == 0);
+    CHECK(reopened.GetServer().GetDocumentCount() == document_count + 1);
+    return true;
+  }();
+
+  filesystem::remove_all(config.directory);
+  cout << (ok ? "Self-test passed"s : "Self-test FAILED"s) << endl;
+  return ok;
+}
+
+void PrintUsage() {
+  cerr << "Usage: wal_benchmark --self-test\n"
+          "       wal_benchmark [--dir PATH] [--rate MUTATIONS_PER_SEC] "
+          "[--seconds N] [--threads N]"s
+       << endl;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  BenchmarkConfig config;
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (arg == "--self-test"s) {
+      return RunSelfTest() ? 0 : 1;
+    }
+    if (i + 1 == argc) {
+      PrintUsage();
+      return 1;
+    }
+    const string value = argv[++i];
+    if (arg == "--dir"s) {
+      config.directory = value;
+    } else if (arg == "--rate"s) {
+      config.rate = stod(value);
+    } else if (arg == "--seconds"s) {
+      config.seconds = stod(value);
+    } else if (arg == "--threads"s) {
+      config.threads = max<size_t>(1, stoul(value));
+    } else {
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (!(config.rate > 0) || !(config.seconds > 0)) {
+    PrintUsage();
+    return 1;
+  }
+  const int document_count = RunAll(config);
+  filesystem::remove_all(config.directory);
+  return document_count < 0 ? 1 : 0;
+}